@@ -0,0 +1,112 @@
+/**
+ * Copyright 2019 Sergey Tyultyaev
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+// Allocator throughput on nearly-full images.
+//
+// lfs_alloc() is static, so lfs.c is built into this file. The lookahead is
+// filled with a random bitmap of used blocks and drained with lfs_alloc()
+// over and over; lookahead refills (filesystem traversals) are not timed.
+//
+// Usage: build/bench/alloc [<seconds per case>]
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "lfs/lfs.c"
+
+#include "bench.h"
+
+static int bench(lfs_size_t block_count, unsigned fill, double seconds)
+{
+    int result = 0;
+
+    struct lfs_config config = {
+        .block_count = block_count,
+        // whole image, the lfs-tool default
+        .lookahead_size = ((block_count + 7) / 8 + 7) / 8 * 8,
+    };
+    lfs_t lfs = {.cfg = &config};
+
+    uint32_t *used = calloc(1, config.lookahead_size);
+    lfs.free.buffer = malloc(config.lookahead_size);
+    if (used == NULL || lfs.free.buffer == NULL) {
+        fprintf(stderr, "malloc() failed\n");
+        result = -1;
+        goto done;
+    }
+
+    srand(block_count + fill);
+    lfs_size_t nfree = 0;
+    for (lfs_block_t i = 0; i < block_count; i++) {
+        if ((unsigned)rand() % 1000 < fill) {
+            used[i / 32] |= 1U << (i % 32);
+        } else {
+            nfree += 1;
+        }
+    }
+
+    uint64_t allocs = 0;
+    uint64_t start = now_ns();
+    uint64_t elapsed = 0;
+    do {
+        memcpy(lfs.free.buffer, used, config.lookahead_size);
+        // start mid-image so the block number wraps
+        lfs.free.off = block_count / 2;
+        lfs.free.size = block_count;
+        lfs.free.i = 0;
+        lfs.free.ack = block_count;
+
+        for (lfs_size_t i = 0; i < nfree; i++) {
+            lfs_block_t block;
+            if (lfs_alloc(&lfs, &block) != 0 || block >= block_count) {
+                fprintf(stderr, "lfs_alloc() failed\n");
+                result = -1;
+                goto done;
+            }
+        }
+
+        allocs += nfree;
+        elapsed = now_ns() - start;
+    } while (elapsed < seconds * 1e9);
+
+    printf("%10u %5.1f%% %12.2f %10.1f\n", (unsigned)block_count, fill / 10.0,
+           allocs / (elapsed / 1e9) / 1e6, (double)elapsed / allocs);
+
+done:
+    free(lfs.free.buffer);
+    free(used);
+    return result;
+}
+
+int main(int argc, char *argv[])
+{
+    static const lfs_size_t counts[] = {65536, 65000};
+    static const unsigned fills[] = {500, 900, 970, 990};
+
+    double seconds = argc > 1 ? atof(argv[1]) : 0.5;
+
+    printf("%10s %6s %12s %10s\n", "blocks", "used", "Malloc/s", "ns/alloc");
+    for (size_t c = 0; c < sizeof(counts) / sizeof(counts[0]); c++) {
+        for (size_t f = 0; f < sizeof(fills) / sizeof(fills[0]); f++) {
+            if (bench(counts[c], fills[f], seconds) != 0) {
+                return EXIT_FAILURE;
+            }
+        }
+    }
+
+    return EXIT_SUCCESS;
+}
@@ -0,0 +1,165 @@
+/**
+ * Copyright 2019 Sergey Tyultyaev
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+// Metadata compaction of attribute-heavy directories.
+//
+// Files with a few user attributes each are created in one directory of a
+// RAM image with the lfs-tool geometry, then all of them are renamed into a
+// second directory. The metadata pair cache is off so every compaction goes
+// through lfs_dir_traverse, its counters are reported per commit.
+//
+// Usage: build/bench/attr [<number of files>...]
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "lfs/lfs.h"
+#include "bench.h"
+
+#define BLOCK_SIZE 4096
+#define IO_SIZE 256
+#define ATTRS 4
+
+static void report(const char *phase, unsigned files, uint64_t elapsed, const lfs_t *lfs)
+{
+    printf("%8u %7s %10.3f %10.1f %10.1f %6u\n", files, phase, elapsed / 1e9, (double)elapsed / files / 1e3,
+           lfs->traverse.commits ? (double)lfs->traverse.tags / lfs->traverse.commits : 0.0,
+           (unsigned)lfs->traverse.depth);
+}
+
+static int bench(unsigned files)
+{
+    int result = 0;
+
+    lfs_size_t block_count = files / 4 + 1024;
+    struct bench_ram ram = {0};
+    struct lfs_config config = {
+        .context = &ram,
+        .read = bench_ram_read,
+        .prog = bench_ram_prog,
+        .erase = bench_ram_erase,
+        .sync = bench_ram_sync,
+        .read_size = IO_SIZE,
+        .prog_size = IO_SIZE,
+        .block_size = BLOCK_SIZE,
+        .block_count = block_count,
+        .block_cycles = -1,
+        .cache_size = IO_SIZE,
+        .lookahead_size = ((block_count + 7) / 8 + 7) / 8 * 8,
+    };
+    lfs_t lfs;
+    bool mounted = false;
+
+    ram.image = malloc((size_t)block_count * BLOCK_SIZE);
+    if (ram.image == NULL) {
+        fprintf(stderr, "malloc() failed\n");
+        result = -1;
+        goto done;
+    }
+
+    int err = lfs_format(&lfs, &config);
+    if (err == 0) {
+        err = lfs_mount(&lfs, &config);
+    }
+    if (err == 0) {
+        mounted = true;
+        err = lfs_mkdir(&lfs, "src");
+    }
+    if (err == 0) {
+        err = lfs_mkdir(&lfs, "dst");
+    }
+    if (err != 0) {
+        fprintf(stderr, "lfs_mkdir() failed: %d\n", err);
+        result = -1;
+        goto done;
+    }
+
+    char path[32];
+    char to[32];
+    lfs.traverse = (struct lfs_traverse){0};
+    uint64_t start = now_ns();
+    for (unsigned i = 0; i < files; i++) {
+        snprintf(path, sizeof(path), "src/file%07u", i);
+
+        lfs_file_t file;
+        err = lfs_file_open(&lfs, &file, path, LFS_O_WRONLY | LFS_O_CREAT | LFS_O_EXCL);
+        if (err == 0) {
+            err = lfs_file_close(&lfs, &file);
+        }
+        for (uint8_t type = 0; type < ATTRS && err == 0; type++) {
+            uint32_t value = i * ATTRS + type;
+            err = lfs_setattr(&lfs, path, type, &value, sizeof(value));
+        }
+        if (err != 0) {
+            fprintf(stderr, "create %s failed: %d\n", path, err);
+            result = -1;
+            goto done;
+        }
+    }
+    report("create", files, now_ns() - start, &lfs);
+
+    lfs.traverse = (struct lfs_traverse){0};
+    start = now_ns();
+    for (unsigned i = 0; i < files; i++) {
+        snprintf(path, sizeof(path), "src/file%07u", i);
+        snprintf(to, sizeof(to), "dst/file%07u", i);
+
+        err = lfs_rename(&lfs, path, to);
+        if (err != 0) {
+            fprintf(stderr, "rename %s failed: %d\n", path, err);
+            result = -1;
+            goto done;
+        }
+    }
+    report("rename", files, now_ns() - start, &lfs);
+
+    for (unsigned i = 0; i < files; i++) {
+        snprintf(path, sizeof(path), "dst/file%07u", i);
+
+        for (uint8_t type = 0; type < ATTRS; type++) {
+            uint32_t value;
+            lfs_ssize_t res = lfs_getattr(&lfs, path, type, &value, sizeof(value));
+            if (res != sizeof(value) || value != i * ATTRS + type) {
+                fprintf(stderr, "read back %s failed: %d\n", path, (int)res);
+                result = -1;
+                goto done;
+            }
+        }
+    }
+
+done:
+    if (mounted) {
+        lfs_unmount(&lfs);
+    }
+    free(ram.image);
+    return result;
+}
+
+int main(int argc, char *argv[])
+{
+    static const unsigned counts[] = {100, 1000};
+
+    printf("%8s %7s %10s %10s %10s %6s\n", "files", "phase", "seconds", "us/file", "tags/cmt", "depth");
+    for (int c = 0; c < (argc > 1 ? argc - 1 : (int)(sizeof(counts) / sizeof(counts[0]))); c++) {
+        unsigned files = argc > 1 ? (unsigned)atoi(argv[c + 1]) : counts[c];
+        if (bench(files) != 0) {
+            return EXIT_FAILURE;
+        }
+    }
+
+    return EXIT_SUCCESS;
+}
@@ -0,0 +1,69 @@
+#!/bin/sh
+#
+# Compares block device backends on image creation and cold-cache extraction.
+#
+# Usage: bench/bd.sh [<source directory>] [<number of blocks>] [<backends>]
+#
+# Without a source directory a synthetic tree is generated. Page cache is
+# dropped before every extraction when /proc/sys/vm/drop_caches is writable
+# (run as root on CI), otherwise the numbers are warm-cache.
+
+set -e
+
+TOOL=${TOOL:-./lfs-tool}
+BLOCKS=${2:-16384}
+BACKENDS=${3:-"stdio mmap pread uring ram"}
+
+WORK=$(mktemp -d)
+trap 'rm -rf "$WORK"' EXIT
+
+SRC=$1
+if [ -z "$SRC" ]; then
+    SRC=$WORK/src
+    for d in $(seq 0 19); do
+        mkdir -p "$SRC/d$d/sub"
+        for f in $(seq 0 49); do
+            head -c $(( (f * 7919 + d * 104729) % 65536 )) /dev/urandom > "$SRC/d$d/sub/f$f"
+        done
+    done
+fi
+
+drop_caches() {
+    sync
+    if [ -w /proc/sys/vm/drop_caches ]; then
+        echo 3 > /proc/sys/vm/drop_caches
+        return 0
+    fi
+    return 1
+}
+
+now_ms() {
+    echo $(( $(date +%s%N) / 1000000 ))
+}
+
+if ! drop_caches; then
+    echo "warning: cannot drop page cache, results are warm-cache" >&2
+fi
+
+printf "%-8s %12s %12s\n" backend "create, ms" "extract, ms"
+
+for bd in $BACKENDS; do
+    image=$WORK/$bd.img
+
+    start=$(now_ms)
+    "$TOOL" -t "$bd" -a "$BLOCKS" -i "$image" -d "$SRC" -c > /dev/null
+    create=$(( $(now_ms) - start ))
+
+    out=$WORK/$bd.out
+    mkdir -p "$out"
+    drop_caches || true
+
+    start=$(now_ms)
+    "$TOOL" -t "$bd" -a "$BLOCKS" -i "$image" -d "$out" -x > /dev/null
+    extract=$(( $(now_ms) - start ))
+
+    diff -r "$SRC" "$out" > /dev/null
+    rm -rf "$out" "$image"
+
+    printf "%-8s %12d %12d\n" "$bd" "$create" "$extract"
+done
@@ -0,0 +1,70 @@
+/**
+ * Copyright 2019 Sergey Tyultyaev
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+// Shared by the benchmarks, each of which is a single file: a monotonic
+// clock and the RAM block device of the lfs benchmarks.
+
+#pragma once
+
+#include <stdint.h>
+#include <string.h>
+#include <time.h>
+
+#include "lfs/lfs.h"
+
+static inline uint64_t now_ns(void)
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * 1000000000 + ts.tv_nsec;
+}
+
+// context of the lfs_config of an image in RAM, read calls are counted
+struct bench_ram
+{
+    uint8_t *image;
+    uint64_t reads;
+};
+
+static inline int bench_ram_read(const struct lfs_config *c, lfs_block_t block, lfs_off_t off, void *buffer,
+                                 lfs_size_t size)
+{
+    struct bench_ram *ram = c->context;
+    ram->reads++;
+    memcpy(buffer, ram->image + (size_t)block * c->block_size + off, size);
+    return 0;
+}
+
+static inline int bench_ram_prog(const struct lfs_config *c, lfs_block_t block, lfs_off_t off, const void *buffer,
+                                 lfs_size_t size)
+{
+    struct bench_ram *ram = c->context;
+    memcpy(ram->image + (size_t)block * c->block_size + off, buffer, size);
+    return 0;
+}
+
+static inline int bench_ram_erase(const struct lfs_config *c, lfs_block_t block)
+{
+    struct bench_ram *ram = c->context;
+    memset(ram->image + (size_t)block * c->block_size, 0xff, c->block_size);
+    return 0;
+}
+
+static inline int bench_ram_sync(const struct lfs_config *c)
+{
+    (void)c;
+    return 0;
+}
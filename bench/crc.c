@@ -0,0 +1,90 @@
+/**
+ * Copyright 2019 Sergey Tyultyaev
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+// lfs_crc throughput per implementation and buffer size.
+//
+// Usage: build/bench/crc [<seconds per case>]
+
+#include <stdio.h>
+#include <stdlib.h>
+
+#include "lfs/lfs_util.h"
+
+#include "bench.h"
+
+#define BUFFER_SIZE 65536
+
+static double bench(lfs_crc_t crc, const uint8_t *buffer, size_t size, double seconds)
+{
+    uint64_t bytes = 0;
+    uint64_t start = now_ns();
+    uint64_t elapsed = 0;
+    // fed back so the calls are not optimized away
+    volatile uint32_t sink = 0xffffffff;
+
+    do {
+        for (size_t off = 0; off + size <= BUFFER_SIZE; off += size) {
+            sink = crc(sink, buffer + off, size);
+        }
+        bytes += BUFFER_SIZE / size * size;
+        elapsed = now_ns() - start;
+    } while (elapsed < seconds * 1e9);
+
+    return bytes / (elapsed / 1e9) / (1024 * 1024);
+}
+
+int main(int argc, char *argv[])
+{
+    static const size_t sizes[] = {4, 16, 64, 256, 512, 4096, 65536};
+    static uint8_t buffer[BUFFER_SIZE];
+
+    double seconds = argc > 1 ? atof(argv[1]) : 0.2;
+
+    srand(1);
+    for (size_t i = 0; i < sizeof(buffer); i++) {
+        buffer[i] = rand();
+    }
+
+    struct {
+        const char *name;
+        lfs_crc_t crc;
+    } impls[] = {
+        {"nibble", lfs_crc_nibble},
+        {"slice8", lfs_crc_slice8},
+        {"hw", lfs_crc_hw()},
+        {"lfs_crc", lfs_crc},
+    };
+
+    printf("%8s", "MiB/s");
+    for (size_t i = 0; i < sizeof(impls) / sizeof(impls[0]); i++) {
+        printf(" %10s", impls[i].name);
+    }
+    printf("\n");
+
+    for (size_t s = 0; s < sizeof(sizes) / sizeof(sizes[0]); s++) {
+        printf("%8zu", sizes[s]);
+        for (size_t i = 0; i < sizeof(impls) / sizeof(impls[0]); i++) {
+            if (impls[i].crc == NULL) {
+                printf(" %10s", "-");
+                continue;
+            }
+            printf(" %10.1f", bench(impls[i].crc, buffer, sizes[s], seconds));
+        }
+        printf("\n");
+    }
+
+    return EXIT_SUCCESS;
+}
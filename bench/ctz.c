@@ -0,0 +1,176 @@
+/**
+ * Copyright 2019 Sergey Tyultyaev
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+// Reads of one large file.
+//
+// A file is written to a RAM image with the lfs-tool geometry, then read in
+// order and at random offsets in chunks of the block size, with the CTZ
+// position cache off and at the lfs-tool default. Block device reads are
+// counted per chunk, the data is checked.
+//
+// Usage: build/bench/ctz [<file size in MiB>...]
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "lfs/lfs.h"
+#include "bench.h"
+
+#define BLOCK_SIZE 4096
+#define IO_SIZE 256
+#define CHUNKS 10000
+
+// byte at pos of the file, cheap to check
+static uint8_t pattern(lfs_off_t pos)
+{
+    return (uint8_t)(pos * 2654435761u >> 24);
+}
+
+static int bench(unsigned mib, lfs_size_t ctz_cache_size)
+{
+    int result = 0;
+
+    lfs_size_t size = mib << 20;
+    lfs_size_t block_count = size / (BLOCK_SIZE - 64) + 64;
+    struct bench_ram ram = {0};
+    struct lfs_config config = {
+        .context = &ram,
+        .read = bench_ram_read,
+        .prog = bench_ram_prog,
+        .erase = bench_ram_erase,
+        .sync = bench_ram_sync,
+        .read_size = IO_SIZE,
+        .prog_size = IO_SIZE,
+        .block_size = BLOCK_SIZE,
+        .block_count = block_count,
+        .block_cycles = -1,
+        .cache_size = IO_SIZE,
+        .lookahead_size = ((block_count + 7) / 8 + 7) / 8 * 8,
+        .ctz_cache_size = ctz_cache_size,
+    };
+    lfs_t lfs;
+    lfs_file_t file;
+    bool mounted = false;
+    bool opened = false;
+
+    uint8_t *buffer = malloc(BLOCK_SIZE);
+    ram.image = malloc((size_t)block_count * BLOCK_SIZE);
+    if (buffer == NULL || ram.image == NULL) {
+        fprintf(stderr, "malloc() failed\n");
+        result = -1;
+        goto done;
+    }
+
+    int err = lfs_format(&lfs, &config);
+    if (err == 0) {
+        err = lfs_mount(&lfs, &config);
+    }
+    if (err == 0) {
+        mounted = true;
+        err = lfs_file_open(&lfs, &file, "file", LFS_O_RDWR | LFS_O_CREAT);
+    }
+    if (err == 0) {
+        opened = true;
+    }
+    for (lfs_off_t pos = 0; pos < size && err == 0; pos += BLOCK_SIZE) {
+        for (lfs_off_t i = 0; i < BLOCK_SIZE; i++) {
+            buffer[i] = pattern(pos + i);
+        }
+        lfs_ssize_t res = lfs_file_write(&lfs, &file, buffer, BLOCK_SIZE);
+        if (res < 0) {
+            err = res;
+        }
+    }
+    if (err == 0) {
+        err = lfs_file_sync(&lfs, &file);
+    }
+    if (err != 0) {
+        fprintf(stderr, "write failed: %d\n", err);
+        result = -1;
+        goto done;
+    }
+
+    srand(mib);
+    for (int random = 0; random < 2; random++) {
+        lfs_size_t chunks = random ? CHUNKS : size / BLOCK_SIZE;
+        ram.reads = 0;
+        err = lfs_file_rewind(&lfs, &file);
+
+        uint64_t start = now_ns();
+        for (lfs_size_t c = 0; c < chunks && err == 0; c++) {
+            lfs_off_t pos = c * BLOCK_SIZE;
+            if (random) {
+                pos = (((uint64_t)rand() << 31) ^ (uint64_t)rand()) % (size - BLOCK_SIZE);
+                lfs_soff_t res = lfs_file_seek(&lfs, &file, pos, LFS_SEEK_SET);
+                if (res < 0) {
+                    err = res;
+                    break;
+                }
+            }
+
+            lfs_ssize_t res = lfs_file_read(&lfs, &file, buffer, BLOCK_SIZE);
+            if (res != BLOCK_SIZE) {
+                err = res < 0 ? res : LFS_ERR_CORRUPT;
+                break;
+            }
+            for (lfs_off_t i = 0; i < BLOCK_SIZE; i++) {
+                if (buffer[i] != pattern(pos + i)) {
+                    err = LFS_ERR_CORRUPT;
+                    break;
+                }
+            }
+        }
+        uint64_t elapsed = now_ns() - start;
+        if (err != 0) {
+            fprintf(stderr, "read failed: %d\n", err);
+            result = -1;
+            goto done;
+        }
+
+        printf("%8u %9s %6u %10.3f %10.1f %10.1f\n", mib, random ? "random" : "in order", (unsigned)ctz_cache_size,
+               elapsed / 1e9, (double)elapsed / chunks / 1e3, (double)ram.reads / chunks);
+    }
+
+done:
+    if (opened) {
+        lfs_file_close(&lfs, &file);
+    }
+    if (mounted) {
+        lfs_unmount(&lfs);
+    }
+    free(ram.image);
+    free(buffer);
+    return result;
+}
+
+int main(int argc, char *argv[])
+{
+    static const unsigned sizes[] = {4, 64, 512};
+    static const lfs_size_t ctz_cache_sizes[] = {0, 64};
+
+    printf("%8s %9s %6s %10s %10s %10s\n", "MiB", "order", "cache", "seconds", "us/read", "bd/read");
+    for (int s = 0; s < (argc > 1 ? argc - 1 : (int)(sizeof(sizes) / sizeof(sizes[0]))); s++) {
+        unsigned mib = argc > 1 ? (unsigned)atoi(argv[s + 1]) : sizes[s];
+        for (size_t c = 0; c < sizeof(ctz_cache_sizes) / sizeof(ctz_cache_sizes[0]); c++) {
+            if (bench(mib, ctz_cache_sizes[c]) != 0) {
+                return EXIT_FAILURE;
+            }
+        }
+    }
+
+    return EXIT_SUCCESS;
+}
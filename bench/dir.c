@@ -0,0 +1,168 @@
+/**
+ * Copyright 2019 Sergey Tyultyaev
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+// File creation in one large directory.
+//
+// Small files are created in a single directory of a RAM image with the
+// lfs-tool geometry and caches, in name order (a sorted source listing)
+// and shuffled. Each case runs with bulk_load off and on, the images are
+// checked by reading every file back.
+//
+// Usage: build/bench/dir [<number of files>...]
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "lfs/lfs.h"
+#include "bench.h"
+
+#define BLOCK_SIZE 4096
+#define IO_SIZE 256
+
+static int bench(unsigned files, bool shuffled, bool bulk_load)
+{
+    int result = 0;
+
+    // room for directory pairs at a quarter block per entry plus slack
+    lfs_size_t block_count = files / 4 + 1024;
+    struct bench_ram ram = {0};
+    struct lfs_config config = {
+        .context = &ram,
+        .read = bench_ram_read,
+        .prog = bench_ram_prog,
+        .erase = bench_ram_erase,
+        .sync = bench_ram_sync,
+        .read_size = IO_SIZE,
+        .prog_size = IO_SIZE,
+        .block_size = BLOCK_SIZE,
+        .block_count = block_count,
+        .block_cycles = -1,
+        .cache_size = IO_SIZE,
+        .lookahead_size = ((block_count + 7) / 8 + 7) / 8 * 8,
+        .mdir_cache_size = 1024,
+        .name_index_size = 64,
+        .bulk_load = bulk_load,
+    };
+    lfs_t lfs;
+    bool mounted = false;
+
+    unsigned *order = malloc(files * sizeof(*order));
+    ram.image = malloc((size_t)block_count * BLOCK_SIZE);
+    if (order == NULL || ram.image == NULL) {
+        fprintf(stderr, "malloc() failed\n");
+        result = -1;
+        goto done;
+    }
+
+    srand(files);
+    for (unsigned i = 0; i < files; i++) {
+        order[i] = i;
+    }
+    for (unsigned i = files; shuffled && i > 1; i--) {
+        unsigned j = (unsigned)rand() % i;
+        unsigned t = order[i - 1];
+        order[i - 1] = order[j];
+        order[j] = t;
+    }
+
+    int err = lfs_format(&lfs, &config);
+    if (err == 0) {
+        err = lfs_mount(&lfs, &config);
+    }
+    if (err == 0) {
+        mounted = true;
+        err = lfs_mkdir(&lfs, "dir");
+    }
+    if (err != 0) {
+        fprintf(stderr, "lfs_mkdir() failed: %d\n", err);
+        result = -1;
+        goto done;
+    }
+
+    char path[32];
+    uint64_t start = now_ns();
+    for (unsigned i = 0; i < files; i++) {
+        snprintf(path, sizeof(path), "dir/file%07u", order[i]);
+
+        lfs_file_t file;
+        err = lfs_file_open(&lfs, &file, path, LFS_O_WRONLY | LFS_O_CREAT | LFS_O_EXCL);
+        if (err == 0) {
+            lfs_ssize_t res = lfs_file_write(&lfs, &file, path, strlen(path));
+            err = lfs_file_close(&lfs, &file);
+            if (res < 0) {
+                err = res;
+            }
+        }
+        if (err != 0) {
+            fprintf(stderr, "create %s failed: %d\n", path, err);
+            result = -1;
+            goto done;
+        }
+    }
+    uint64_t elapsed = now_ns() - start;
+
+    lfs_ssize_t used = lfs_fs_size(&lfs);
+    for (unsigned i = 0; i < files && used >= 0; i++) {
+        snprintf(path, sizeof(path), "dir/file%07u", i);
+
+        char data[32];
+        lfs_file_t file;
+        err = lfs_file_open(&lfs, &file, path, LFS_O_RDONLY);
+        if (err == 0) {
+            lfs_ssize_t res = lfs_file_read(&lfs, &file, data, sizeof(data));
+            err = lfs_file_close(&lfs, &file);
+            if (res != (lfs_ssize_t)strlen(path) || memcmp(data, path, res) != 0) {
+                err = LFS_ERR_CORRUPT;
+            }
+        }
+        if (err != 0) {
+            fprintf(stderr, "read back %s failed: %d\n", path, err);
+            result = -1;
+            goto done;
+        }
+    }
+
+    printf("%8u %9s %5s %10.3f %10.1f %8d\n", files, shuffled ? "shuffled" : "in order", bulk_load ? "on" : "off",
+           elapsed / 1e9, (double)elapsed / files / 1e3, (int)used);
+
+done:
+    if (mounted) {
+        lfs_unmount(&lfs);
+    }
+    free(ram.image);
+    free(order);
+    return result;
+}
+
+int main(int argc, char *argv[])
+{
+    static const unsigned counts[] = {1000, 10000, 100000};
+
+    printf("%8s %9s %5s %10s %10s %8s\n", "files", "order", "bulk", "seconds", "us/file", "blocks");
+    for (int c = 0; c < (argc > 1 ? argc - 1 : (int)(sizeof(counts) / sizeof(counts[0]))); c++) {
+        unsigned files = argc > 1 ? (unsigned)atoi(argv[c + 1]) : counts[c];
+        for (int shuffled = 0; shuffled < 2; shuffled++) {
+            for (int bulk_load = 0; bulk_load < 2; bulk_load++) {
+                if (bench(files, shuffled, bulk_load) != 0) {
+                    return EXIT_FAILURE;
+                }
+            }
+        }
+    }
+
+    return EXIT_SUCCESS;
+}
@@ -0,0 +1,178 @@
+/**
+ * Copyright 2019 Sergey Tyultyaev
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include "bd.h"
+
+#include <sys/stat.h>
+#include <sys/types.h>
+#include <string.h>
+
+#include "macro.h"
+#include "bd_stdio.h"
+#include "bd_mmap.h"
+#include "bd_pread.h"
+#include "bd_uring.h"
+#include "bd_ram.h"
+#include "bd_erased.h"
+#include "bd_cache.h"
+#include "bd_stats.h"
+#include "bd_trace.h"
+#include "bd_flash.h"
+#include "bd_wear.h"
+
+static bd_type_t bd_type_auto(const char *image, bool write)
+{
+    struct stat st = {0};
+
+    if (strcmp(image, "-") == 0) {
+        return BD_TYPE_RAM;
+    }
+
+    if (stat(image, &st) != 0) {
+        // does not exist yet, will be created as a regular file
+        return write ? BD_TYPE_MMAP : BD_TYPE_STDIO;
+    }
+
+    if (S_ISREG(st.st_mode)) {
+        return BD_TYPE_MMAP;
+    }
+
+    // stdio seeks on every operation, pipes and character devices are
+    // streamed through RAM like "-"
+    return S_ISBLK(st.st_mode) ? BD_TYPE_STDIO : BD_TYPE_RAM;
+}
+
+struct bd *bd_open(const struct bd_config *config, const char *image, bool write, size_t block_size,
+                   size_t block_count)
+{
+    struct bd *result = NULL;
+
+    struct bd *bd = NULL;
+    struct bd *cache = NULL;
+
+    CHECK_ERROR(config != NULL, NULL, "config == NULL");
+    CHECK_ERROR(image != NULL, NULL, "image == NULL");
+    CHECK_ERROR(block_size != 0 && block_count != 0, NULL, "invalid geometry: %zu x %zu", block_count, block_size);
+
+    bd_type_t type = config->type;
+    bool fallback = type == BD_TYPE_AUTO;
+    if (fallback) {
+        type = bd_type_auto(image, write);
+    }
+
+    CHECK_ERROR(strcmp(image, "-") != 0 || type == BD_TYPE_RAM, NULL, "standard streams need the ram device");
+
+    switch (type) {
+        case BD_TYPE_MMAP:
+            bd = bd_mmap_open(image, write, block_size, block_count);
+            if (bd != NULL || !fallback) {
+                break;
+            }
+            INFO("mmap is not available for %s, using stdio", image);
+            /* FALLTHROUGH */
+        case BD_TYPE_STDIO:
+            bd = bd_stdio_open(image, write, block_size, block_count);
+            break;
+        case BD_TYPE_URING:
+            bd = bd_uring_open(image, write, block_size, block_count);
+            if (bd != NULL) {
+                break;
+            }
+            INFO("io_uring is not available, using pread");
+            /* FALLTHROUGH */
+        case BD_TYPE_PREAD:
+            bd = bd_pread_open(image, write, block_size, block_count);
+            break;
+        case BD_TYPE_RAM:
+            bd = bd_ram_open(image, write, config->sparse, block_size, block_count);
+            break;
+        case BD_TYPE_AUTO:
+        default:
+            CHECK_ERROR(false, NULL, "unknown block device type: %d", type);
+    }
+
+    CHECK_ERROR(bd != NULL, NULL, "cannot open %s", image);
+
+    struct bd *erased = bd_erased_open(bd, write, config->sparse);
+    CHECK_ERROR(erased != NULL, NULL, "bd_erased_open() failed");
+    bd = erased;
+
+    if (config->cache_blocks != 0) {
+        cache = bd_cache_open(bd, config->cache_blocks);
+        CHECK_ERROR(cache != NULL, NULL, "bd_cache_open() failed");
+        bd = cache;
+    }
+
+    if (config->wear != NULL) {
+        struct bd *wear = bd_wear_open(bd, config->wear);
+        CHECK_ERROR(wear != NULL, NULL, "bd_wear_open() failed");
+        bd = wear;
+    }
+
+    if (config->flash != NULL) {
+        struct bd *flash = bd_flash_open(bd, config->flash);
+        CHECK_ERROR(flash != NULL, NULL, "bd_flash_open() failed");
+        bd = flash;
+    }
+
+    if (config->trace != NULL) {
+        struct bd *trace = bd_trace_open(bd, config->trace);
+        CHECK_ERROR(trace != NULL, NULL, "bd_trace_open() failed");
+        bd = trace;
+    }
+
+    // on top, bd_stats_report() expects it there
+    if (config->stats) {
+        struct bd *stats = bd_stats_open(bd, cache);
+        CHECK_ERROR(stats != NULL, NULL, "bd_stats_open() failed");
+        bd = stats;
+    }
+
+    result = bd;
+
+done:
+    if (result == NULL && bd != NULL) {
+        bd->close(bd);
+    }
+    return result;
+}
+
+int bd_type_parse(const char *str, bd_type_t *type)
+{
+    int result = 0;
+
+    CHECK_ERROR(str != NULL, -1, "str == NULL");
+    CHECK_ERROR(type != NULL, -1, "type == NULL");
+
+    if (strcmp(str, "auto") == 0) {
+        *type = BD_TYPE_AUTO;
+    } else if (strcmp(str, "stdio") == 0) {
+        *type = BD_TYPE_STDIO;
+    } else if (strcmp(str, "mmap") == 0) {
+        *type = BD_TYPE_MMAP;
+    } else if (strcmp(str, "pread") == 0) {
+        *type = BD_TYPE_PREAD;
+    } else if (strcmp(str, "uring") == 0) {
+        *type = BD_TYPE_URING;
+    } else if (strcmp(str, "ram") == 0) {
+        *type = BD_TYPE_RAM;
+    } else {
+        CHECK_ERROR(false, -1, "unknown block device: %s", str);
+    }
+
+done:
+    return result;
+}
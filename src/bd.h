@@ -0,0 +1,72 @@
+// Copyright 2019 Sergey Tyultyaev
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#pragma once
+
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdlib.h>
+
+struct bd_flash;
+
+typedef enum {
+    BD_TYPE_AUTO = 0,
+    BD_TYPE_STDIO,
+    BD_TYPE_MMAP,
+    BD_TYPE_PREAD,
+    BD_TYPE_URING,
+    BD_TYPE_RAM,
+} bd_type_t;
+
+struct bd_config
+{
+    bd_type_t type;
+    // leave blocks never written by lfs as holes instead of filling with 0xff,
+    // they read back as zeroes
+    bool sparse;
+    // size of the write-back block cache in blocks, 0 disables it
+    size_t cache_blocks;
+    // count operations issued by lfs, see bd_stats
+    bool stats;
+    // record operations issued by lfs to this file, see bd_trace
+    const char *trace;
+    // charge operations issued by lfs to this flash timing model, see bd_flash
+    struct bd_flash *flash;
+    // write per-block erase and prog counters to this file on close, see bd_wear
+    const char *wear;
+};
+
+// Block device backing an lfs image. Offsets are relative to the block start.
+struct bd
+{
+    void *opaque;
+    size_t block_size;
+    size_t block_count;
+
+    int (*read)(struct bd *bd, uint32_t block, uint32_t off, void *buffer, size_t size);
+    int (*prog)(struct bd *bd, uint32_t block, uint32_t off, const void *buffer, size_t size);
+    int (*erase)(struct bd *bd, uint32_t block);
+    int (*sync)(struct bd *bd);
+    // Flushes everything to the image and releases the block device.
+    int (*close)(struct bd *bd);
+};
+
+// Opens image as a block device. When write is set the image is (re)created
+// in the erased state. BD_TYPE_AUTO picks mmap for regular files, stdio for
+// block devices and ram for anything else (pipes, character devices), which
+// cannot seek. Image "-" is stdout (write) or stdin, it is always held in RAM.
+struct bd *bd_open(const struct bd_config *config, const char *image, bool write, size_t block_size,
+                   size_t block_count);
+
+int bd_type_parse(const char *str, bd_type_t *type);
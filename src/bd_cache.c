@@ -0,0 +1,364 @@
+/**
+ * Copyright 2019 Sergey Tyultyaev
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include "bd_cache.h"
+
+#include <stdlib.h>
+#include <string.h>
+
+#include "macro.h"
+
+#define LINE_NONE UINT32_MAX
+
+struct cache_line
+{
+    uint32_t block;
+    // LRU list, head is the most recently used
+    uint32_t prev;
+    uint32_t next;
+    // dirty range, lo == hi when clean
+    uint32_t lo;
+    uint32_t hi;
+    uint8_t *data;
+};
+
+struct cache_dirty
+{
+    uint32_t block;
+    uint32_t line;
+};
+
+struct bd_cache
+{
+    struct bd *lower;
+
+    struct cache_line *lines;
+    size_t count;
+    uint32_t head;
+    uint32_t tail;
+    // block -> line, LINE_NONE when not cached
+    uint32_t *index;
+    // scratch for writing dirty lines back in block order
+    struct cache_dirty *dirty;
+
+    struct bd_cache_stats stats;
+};
+
+static void lru_unlink(struct bd_cache *context, uint32_t i)
+{
+    struct cache_line *line = &context->lines[i];
+
+    if (line->prev != LINE_NONE) {
+        context->lines[line->prev].next = line->next;
+    } else {
+        context->head = line->next;
+    }
+
+    if (line->next != LINE_NONE) {
+        context->lines[line->next].prev = line->prev;
+    } else {
+        context->tail = line->prev;
+    }
+}
+
+static void lru_push(struct bd_cache *context, uint32_t i)
+{
+    struct cache_line *line = &context->lines[i];
+
+    line->prev = LINE_NONE;
+    line->next = context->head;
+
+    if (context->head != LINE_NONE) {
+        context->lines[context->head].prev = i;
+    } else {
+        context->tail = i;
+    }
+    context->head = i;
+}
+
+static int cache_writeback(struct bd_cache *context, struct cache_line *line)
+{
+    int result = 0;
+
+    if (line->lo == line->hi) {
+        goto done;
+    }
+
+    struct bd *lower = context->lower;
+    int err = lower->prog(lower, line->block, line->lo, line->data + line->lo, line->hi - line->lo);
+    CHECK_ERROR(err == 0, err, "lower->prog() failed: %d", err);
+
+    line->lo = line->hi = 0;
+    context->stats.writebacks++;
+
+done:
+    return result;
+}
+
+// Returns the line holding block, loading it from lower on a miss.
+static struct cache_line *cache_get(struct bd *bd, uint32_t block)
+{
+    struct cache_line *result = NULL;
+    struct bd_cache *context = bd->opaque;
+
+    uint32_t i = context->index[block];
+    if (i != LINE_NONE) {
+        context->stats.hits++;
+        lru_unlink(context, i);
+        lru_push(context, i);
+        result = &context->lines[i];
+        goto done;
+    }
+
+    context->stats.misses++;
+
+    // reuse the least recently used line
+    i = context->tail;
+    struct cache_line *line = &context->lines[i];
+    if (line->block != LINE_NONE) {
+        int err = cache_writeback(context, line);
+        CHECK_ERROR(err == 0, NULL, "cache_writeback() failed: %d", err);
+
+        context->index[line->block] = LINE_NONE;
+        line->block = LINE_NONE;
+        context->stats.evictions++;
+    }
+
+    int err = context->lower->read(context->lower, block, 0, line->data, bd->block_size);
+    CHECK_ERROR(err == 0, NULL, "lower->read() failed: %d", err);
+
+    line->block = block;
+    line->lo = line->hi = 0;
+    context->index[block] = i;
+
+    lru_unlink(context, i);
+    lru_push(context, i);
+
+    result = line;
+
+done:
+    return result;
+}
+
+static int bd_cache_read(struct bd *bd, uint32_t block, uint32_t off, void *buffer, size_t size)
+{
+    int result = 0;
+
+    struct cache_line *line = cache_get(bd, block);
+    CHECK_ERROR(line != NULL, -1, "cache_get() failed");
+
+    memcpy(buffer, line->data + off, size);
+
+done:
+    return result;
+}
+
+static int bd_cache_prog(struct bd *bd, uint32_t block, uint32_t off, const void *buffer, size_t size)
+{
+    int result = 0;
+
+    struct cache_line *line = cache_get(bd, block);
+    CHECK_ERROR(line != NULL, -1, "cache_get() failed");
+
+    memcpy(line->data + off, buffer, size);
+
+    if (line->lo == line->hi) {
+        line->lo = off;
+        line->hi = off + size;
+    } else {
+        // the line holds the whole block, gaps are written back unchanged
+        line->lo = off < line->lo ? off : line->lo;
+        line->hi = off + size > line->hi ? off + size : line->hi;
+    }
+
+done:
+    return result;
+}
+
+static int bd_cache_erase(struct bd *bd, uint32_t block)
+{
+    struct bd_cache *context = bd->opaque;
+
+    uint32_t i = context->index[block];
+    if (i != LINE_NONE) {
+        // pending progs are lost to the erase anyway
+        struct cache_line *line = &context->lines[i];
+        memset(line->data, 0xff, bd->block_size);
+        line->lo = line->hi = 0;
+    }
+
+    return context->lower->erase(context->lower, block);
+}
+
+static int dirty_cmp(const void *a, const void *b)
+{
+    const struct cache_dirty *da = a;
+    const struct cache_dirty *db = b;
+    return (da->block > db->block) - (da->block < db->block);
+}
+
+static int cache_flush(struct bd_cache *context)
+{
+    int result = 0;
+
+    size_t count = 0;
+    for (size_t i = 0; i < context->count; i++) {
+        struct cache_line *line = &context->lines[i];
+        if (line->lo != line->hi) {
+            context->dirty[count].block = line->block;
+            context->dirty[count].line = i;
+            count++;
+        }
+    }
+
+    // in block order, so the image is written sequentially
+    qsort(context->dirty, count, sizeof(*context->dirty), dirty_cmp);
+
+    for (size_t i = 0; i < count; i++) {
+        int err = cache_writeback(context, &context->lines[context->dirty[i].line]);
+        CHECK_ERROR(err == 0, err, "cache_writeback() failed: %d", err);
+    }
+
+done:
+    return result;
+}
+
+static int bd_cache_sync(struct bd *bd)
+{
+    int result = 0;
+    struct bd_cache *context = bd->opaque;
+
+    int err = cache_flush(context);
+    CHECK_ERROR(err == 0, err, "cache_flush() failed: %d", err);
+
+    result = context->lower->sync(context->lower);
+
+done:
+    return result;
+}
+
+static void cache_release(struct bd_cache *context)
+{
+    if (context->lines != NULL) {
+        for (size_t i = 0; i < context->count; i++) {
+            free(context->lines[i].data);
+        }
+    }
+    free(context->lines);
+    free(context->index);
+    free(context->dirty);
+    free(context);
+}
+
+static int bd_cache_close(struct bd *bd)
+{
+    int result = 0;
+
+    struct bd_cache *context = NULL;
+
+    CHECK_ERROR(bd != NULL, -1, "bd == NULL");
+
+    context = bd->opaque;
+
+    INFO("block cache: hits: %llu, misses: %llu, evictions: %llu, writebacks: %llu",
+         (unsigned long long)context->stats.hits, (unsigned long long)context->stats.misses,
+         (unsigned long long)context->stats.evictions, (unsigned long long)context->stats.writebacks);
+
+    int err = cache_flush(context);
+    CHECK_ERROR(err == 0, err, "cache_flush() failed: %d", err);
+
+done:
+    if (context != NULL) {
+        int err = context->lower->close(context->lower);
+        if (err != 0) {
+            ERROR("lower->close() failed: %d", err);
+            result = -1;
+        }
+        cache_release(context);
+        free(bd);
+    }
+    return result;
+}
+
+void bd_cache_get_stats(struct bd *bd, struct bd_cache_stats *stats)
+{
+    const struct bd_cache *context = bd->opaque;
+    *stats = context->stats;
+}
+
+struct bd *bd_cache_open(struct bd *lower, size_t blocks)
+{
+    struct bd *result = NULL;
+
+    struct bd *bd = NULL;
+    struct bd_cache *context = NULL;
+
+    CHECK_ERROR(lower != NULL, NULL, "lower == NULL");
+    CHECK_ERROR(blocks != 0, NULL, "blocks == 0");
+
+    bd = calloc(1, sizeof(*bd));
+    CHECK_ERROR(bd != NULL, NULL, "calloc() failed");
+
+    context = calloc(1, sizeof(*context));
+    CHECK_ERROR(context != NULL, NULL, "calloc() failed");
+
+    if (blocks > lower->block_count) {
+        blocks = lower->block_count;
+    }
+
+    context->index = malloc(lower->block_count * sizeof(*context->index));
+    CHECK_ERROR(context->index != NULL, NULL, "malloc() failed");
+    for (size_t i = 0; i < lower->block_count; i++) {
+        context->index[i] = LINE_NONE;
+    }
+
+    context->lines = calloc(blocks, sizeof(*context->lines));
+    CHECK_ERROR(context->lines != NULL, NULL, "calloc() failed");
+    context->count = blocks;
+
+    context->dirty = malloc(blocks * sizeof(*context->dirty));
+    CHECK_ERROR(context->dirty != NULL, NULL, "malloc() failed");
+
+    context->head = context->tail = LINE_NONE;
+    for (size_t i = 0; i < blocks; i++) {
+        context->lines[i].block = LINE_NONE;
+        context->lines[i].data = malloc(lower->block_size);
+        CHECK_ERROR(context->lines[i].data != NULL, NULL, "malloc() failed");
+        lru_push(context, i);
+    }
+
+    context->lower = lower;
+
+    bd->opaque = context;
+    bd->block_size = lower->block_size;
+    bd->block_count = lower->block_count;
+    bd->read = bd_cache_read;
+    bd->prog = bd_cache_prog;
+    bd->erase = bd_cache_erase;
+    bd->sync = bd_cache_sync;
+    bd->close = bd_cache_close;
+
+    result = bd;
+
+done:
+    if (result == NULL) {
+        if (context != NULL) {
+            cache_release(context);
+        }
+        free(bd);
+    }
+    return result;
+}
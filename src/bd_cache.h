@@ -0,0 +1,34 @@
+// Copyright 2019 Sergey Tyultyaev
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#pragma once
+
+#include "bd.h"
+
+struct bd_cache_stats
+{
+    uint64_t hits;
+    uint64_t misses;
+    uint64_t evictions;
+    // dirty blocks written to lower, by sync or eviction
+    uint64_t writebacks;
+};
+
+// Write-back LRU cache of whole blocks on top of lower. Progs are merged in
+// the cached block and written to lower as one prog on sync, close or
+// eviction. Counters are logged on close. Takes ownership of lower.
+struct bd *bd_cache_open(struct bd *lower, size_t blocks);
+
+// Counters so far of a block device returned by bd_cache_open().
+void bd_cache_get_stats(struct bd *bd, struct bd_cache_stats *stats);
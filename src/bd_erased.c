@@ -0,0 +1,188 @@
+/**
+ * Copyright 2019 Sergey Tyultyaev
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include "bd_erased.h"
+
+#include <stdlib.h>
+#include <string.h>
+
+#include "macro.h"
+#include "util.h"
+
+struct bd_erased
+{
+    struct bd *lower;
+    bool sparse;
+    // blocks that read back as 0xff: erased and not programmed since
+    uint32_t *erased;
+    // erased blocks that were never written to the image
+    uint32_t *pristine;
+};
+
+static int bd_erased_read(struct bd *bd, uint32_t block, uint32_t off, void *buffer, size_t size)
+{
+    int result = 0;
+    struct bd_erased *context = bd->opaque;
+
+    CHECK_ERROR(block < bd->block_count, -1, "read past the end of image: block: %u", block);
+
+    if (bitmap_test(context->erased, block)) {
+        memset(buffer, 0xff, size);
+        goto done;
+    }
+
+    result = context->lower->read(context->lower, block, off, buffer, size);
+
+done:
+    return result;
+}
+
+static int bd_erased_prog(struct bd *bd, uint32_t block, uint32_t off, const void *buffer, size_t size)
+{
+    int result = 0;
+    struct bd_erased *context = bd->opaque;
+    struct bd *lower = context->lower;
+
+    CHECK_ERROR(block < bd->block_count, -1, "prog past the end of image: block: %u", block);
+
+    if (bitmap_test(context->pristine, block)) {
+        // the rest of the block must read back as erased as well
+        int err = lower->erase(lower, block);
+        CHECK_ERROR(err == 0, err, "lower->erase() failed: %d", err);
+        bitmap_clear(context->pristine, block);
+    }
+
+    bitmap_clear(context->erased, block);
+
+    result = lower->prog(lower, block, off, buffer, size);
+
+done:
+    return result;
+}
+
+static int bd_erased_erase(struct bd *bd, uint32_t block)
+{
+    int result = 0;
+    struct bd_erased *context = bd->opaque;
+
+    CHECK_ERROR(block < bd->block_count, -1, "erase past the end of image: block: %u", block);
+
+    if (bitmap_test(context->erased, block)) {
+        goto done;
+    }
+
+    result = context->lower->erase(context->lower, block);
+    CHECK_ERROR(result == 0, result, "lower->erase() failed: %d", result);
+
+    bitmap_set(context->erased, block);
+
+done:
+    return result;
+}
+
+static int bd_erased_sync(struct bd *bd)
+{
+    struct bd_erased *context = bd->opaque;
+    return context->lower->sync(context->lower);
+}
+
+static int bd_erased_close(struct bd *bd)
+{
+    int result = 0;
+
+    struct bd_erased *context = NULL;
+
+    CHECK_ERROR(bd != NULL, -1, "bd == NULL");
+
+    context = bd->opaque;
+
+    if (!context->sparse) {
+        for (size_t i = 0; i < bd->block_count; i++) {
+            if (bitmap_test(context->pristine, i)) {
+                int err = context->lower->erase(context->lower, i);
+                CHECK_ERROR(err == 0, -1, "lower->erase() failed: %d", err);
+            }
+        }
+    }
+
+done:
+    if (context != NULL) {
+        int err = context->lower->close(context->lower);
+        if (err != 0) {
+            ERROR("lower->close() failed: %d", err);
+            result = -1;
+        }
+        free(context->erased);
+        free(context->pristine);
+        free(context);
+        free(bd);
+    }
+    return result;
+}
+
+struct bd *bd_erased_open(struct bd *lower, bool pristine, bool sparse)
+{
+    struct bd *result = NULL;
+
+    struct bd *bd = NULL;
+    struct bd_erased *context = NULL;
+
+    CHECK_ERROR(lower != NULL, NULL, "lower == NULL");
+
+    bd = calloc(1, sizeof(*bd));
+    CHECK_ERROR(bd != NULL, NULL, "calloc() failed");
+
+    context = calloc(1, sizeof(*context));
+    CHECK_ERROR(context != NULL, NULL, "calloc() failed");
+
+    context->erased = bitmap_alloc(lower->block_count);
+    CHECK_ERROR(context->erased != NULL, NULL, "bitmap_alloc() failed");
+
+    context->pristine = bitmap_alloc(lower->block_count);
+    CHECK_ERROR(context->pristine != NULL, NULL, "bitmap_alloc() failed");
+
+    if (pristine) {
+        for (size_t i = 0; i < lower->block_count; i++) {
+            bitmap_set(context->erased, i);
+            bitmap_set(context->pristine, i);
+        }
+    }
+
+    context->lower = lower;
+    context->sparse = sparse;
+
+    bd->opaque = context;
+    bd->block_size = lower->block_size;
+    bd->block_count = lower->block_count;
+    bd->read = bd_erased_read;
+    bd->prog = bd_erased_prog;
+    bd->erase = bd_erased_erase;
+    bd->sync = bd_erased_sync;
+    bd->close = bd_erased_close;
+
+    result = bd;
+
+done:
+    if (result == NULL) {
+        if (context != NULL) {
+            free(context->erased);
+            free(context->pristine);
+        }
+        free(context);
+        free(bd);
+    }
+    return result;
+}
@@ -0,0 +1,24 @@
+// Copyright 2019 Sergey Tyultyaev
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#pragma once
+
+#include "bd.h"
+
+// Tracks which blocks of lower are erased. Reads of erased blocks and
+// repeated erases do not reach lower. With pristine set, lower is a freshly
+// created image whose blocks are holes: they are written out on first prog,
+// and on close either filled with 0xff or, with sparse set, left as holes.
+// Takes ownership of lower.
+struct bd *bd_erased_open(struct bd *lower, bool pristine, bool sparse);
@@ -0,0 +1,235 @@
+/**
+ * Copyright 2019 Sergey Tyultyaev
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include "bd_flash.h"
+
+#include <errno.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "macro.h"
+
+struct bd_flash_context
+{
+    struct bd *lower;
+    struct bd_flash *flash;
+};
+
+// Typical datasheet figures: quad SPI NOR at ~50 MB/s with 256 byte pages
+// and 4 KiB sectors, SPI NAND with 2 KiB pages and 128 KiB blocks.
+static const struct bd_flash m_presets[] = {
+    {
+        .name = "nor",
+        .read_setup = 1000,
+        .read_byte = 20,
+        .read_page = 0,
+        .prog_page = 700000,
+        .prog_byte = 20,
+        .page_size = 256,
+        .erase = 45000000,
+    },
+    {
+        .name = "nand",
+        .read_setup = 60000,
+        .read_byte = 20,
+        .read_page = 2048,
+        .prog_page = 400000,
+        .prog_byte = 20,
+        .page_size = 2048,
+        .erase = 3000000,
+    },
+};
+
+static uint64_t pages(uint32_t off, size_t size, size_t page)
+{
+    if (size == 0) {
+        return 0;
+    }
+    return (off + size - 1) / page - off / page + 1;
+}
+
+static int bd_flash_read(struct bd *bd, uint32_t block, uint32_t off, void *buffer, size_t size)
+{
+    struct bd_flash_context *context = bd->opaque;
+    struct bd_flash *flash = context->flash;
+
+    uint64_t setups = flash->read_page != 0 ? pages(off, size, flash->read_page) : 1;
+    flash->read_time += setups * flash->read_setup + size * flash->read_byte;
+
+    return context->lower->read(context->lower, block, off, buffer, size);
+}
+
+static int bd_flash_prog(struct bd *bd, uint32_t block, uint32_t off, const void *buffer, size_t size)
+{
+    struct bd_flash_context *context = bd->opaque;
+    struct bd_flash *flash = context->flash;
+
+    flash->prog_time += pages(off, size, flash->page_size) * flash->prog_page + size * flash->prog_byte;
+
+    return context->lower->prog(context->lower, block, off, buffer, size);
+}
+
+static int bd_flash_erase(struct bd *bd, uint32_t block)
+{
+    struct bd_flash_context *context = bd->opaque;
+
+    context->flash->erase_time += context->flash->erase;
+
+    return context->lower->erase(context->lower, block);
+}
+
+static int bd_flash_sync(struct bd *bd)
+{
+    struct bd_flash_context *context = bd->opaque;
+    return context->lower->sync(context->lower);
+}
+
+static int bd_flash_close(struct bd *bd)
+{
+    int result = 0;
+
+    CHECK_ERROR(bd != NULL, -1, "bd == NULL");
+
+    struct bd_flash_context *context = bd->opaque;
+
+    result = context->lower->close(context->lower);
+
+    free(context);
+    free(bd);
+
+done:
+    return result;
+}
+
+static int parse_u64(const char *str, uint64_t *value)
+{
+    int result = 0;
+
+    char *endptr = NULL;
+    errno = 0;
+
+    unsigned long long parsed = strtoull(str, &endptr, 10);
+    CHECK_ERROR(endptr != str && *endptr == '\0' && errno == 0, -1, "invalid number: %s", str);
+
+    *value = parsed;
+
+done:
+    return result;
+}
+
+int bd_flash_parse(const char *str, struct bd_flash *flash)
+{
+    int result = 0;
+
+    char *copy = NULL;
+
+    CHECK_ERROR(str != NULL, -1, "str == NULL");
+    CHECK_ERROR(flash != NULL, -1, "flash == NULL");
+
+    copy = strdup(str);
+    CHECK_ERROR(copy != NULL, -1, "strdup() failed");
+
+    char *name = copy;
+    char *params = strchr(copy, ',');
+    if (params != NULL) {
+        *params++ = '\0';
+    }
+
+    size_t i = 0;
+    for (; i < sizeof(m_presets) / sizeof(m_presets[0]); i++) {
+        if (strcmp(name, m_presets[i].name) == 0) {
+            *flash = m_presets[i];
+            break;
+        }
+    }
+    CHECK_ERROR(i < sizeof(m_presets) / sizeof(m_presets[0]), -1, "unknown flash preset: %s", name);
+
+    while (params != NULL && *params != '\0') {
+        char *key = params;
+        params = strchr(params, ',');
+        if (params != NULL) {
+            *params++ = '\0';
+        }
+
+        char *value = strchr(key, '=');
+        CHECK_ERROR(value != NULL, -1, "expected <key>=<value>: %s", key);
+        *value++ = '\0';
+
+        uint64_t number = 0;
+        CHECK_ERROR(parse_u64(value, &number) == 0, -1, "parse_u64() failed");
+
+        if (strcmp(key, "read_setup") == 0) {
+            flash->read_setup = number;
+        } else if (strcmp(key, "read_byte") == 0) {
+            flash->read_byte = number;
+        } else if (strcmp(key, "read_page") == 0) {
+            flash->read_page = number;
+        } else if (strcmp(key, "prog_page") == 0) {
+            flash->prog_page = number;
+        } else if (strcmp(key, "prog_byte") == 0) {
+            flash->prog_byte = number;
+        } else if (strcmp(key, "page_size") == 0) {
+            CHECK_ERROR(number != 0, -1, "page_size must not be 0");
+            flash->page_size = number;
+        } else if (strcmp(key, "erase") == 0) {
+            flash->erase = number;
+        } else {
+            CHECK_ERROR(false, -1, "unknown flash parameter: %s", key);
+        }
+    }
+
+done:
+    free(copy);
+    return result;
+}
+
+struct bd *bd_flash_open(struct bd *lower, struct bd_flash *flash)
+{
+    struct bd *result = NULL;
+
+    struct bd *bd = NULL;
+    struct bd_flash_context *context = NULL;
+
+    CHECK_ERROR(lower != NULL, NULL, "lower == NULL");
+    CHECK_ERROR(flash != NULL && flash->page_size != 0, NULL, "invalid flash model");
+
+    bd = calloc(1, sizeof(*bd));
+    CHECK_ERROR(bd != NULL, NULL, "calloc() failed");
+
+    context = calloc(1, sizeof(*context));
+    CHECK_ERROR(context != NULL, NULL, "calloc() failed");
+
+    context->lower = lower;
+    context->flash = flash;
+
+    bd->opaque = context;
+    bd->block_size = lower->block_size;
+    bd->block_count = lower->block_count;
+    bd->read = bd_flash_read;
+    bd->prog = bd_flash_prog;
+    bd->erase = bd_flash_erase;
+    bd->sync = bd_flash_sync;
+    bd->close = bd_flash_close;
+
+    result = bd;
+
+done:
+    if (result == NULL) {
+        free(context);
+        free(bd);
+    }
+    return result;
+}
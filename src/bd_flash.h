@@ -0,0 +1,51 @@
+// Copyright 2019 Sergey Tyultyaev
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#pragma once
+
+#include "bd.h"
+
+// Timing model of a flash part and the simulated time charged so far. All
+// times are in nanoseconds.
+struct bd_flash
+{
+    const char *name;
+    // charged per read command, or per read page touched when read_page is set
+    uint64_t read_setup;
+    uint64_t read_byte;
+    size_t read_page;
+    // charged per program page touched
+    uint64_t prog_page;
+    uint64_t prog_byte;
+    size_t page_size;
+    // charged per lfs block
+    uint64_t erase;
+
+    uint64_t read_time;
+    uint64_t prog_time;
+    uint64_t erase_time;
+};
+
+// Parses "<preset>[,<key>=<value>...]". Presets are nor (SPI NOR) and nand
+// (SPI NAND), keys are the model fields above.
+int bd_flash_parse(const char *str, struct bd_flash *flash);
+
+static inline uint64_t bd_flash_elapsed(const struct bd_flash *flash)
+{
+    return flash->read_time + flash->prog_time + flash->erase_time;
+}
+
+// Charges every operation on lower to flash, which must outlive the device.
+// Takes ownership of lower.
+struct bd *bd_flash_open(struct bd *lower, struct bd_flash *flash);
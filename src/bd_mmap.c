@@ -0,0 +1,200 @@
+/**
+ * Copyright 2019 Sergey Tyultyaev
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include "bd_mmap.h"
+
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+
+#include "macro.h"
+
+#ifndef _WIN32
+
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <sys/types.h>
+#include <fcntl.h>
+#include <unistd.h>
+
+struct bd_mmap
+{
+    int fd;
+    bool write;
+    uint8_t *map;
+    size_t size;
+};
+
+static int bd_mmap_read(struct bd *bd, uint32_t block, uint32_t off, void *buffer, size_t size)
+{
+    int result = 0;
+    struct bd_mmap *context = bd->opaque;
+
+    size_t offset = bd->block_size * block + off;
+    CHECK_ERROR(offset + size <= context->size, -1, "read past the end of image: off: %zu, size: %zu", offset, size);
+
+    memcpy(buffer, context->map + offset, size);
+
+done:
+    return result;
+}
+
+static int bd_mmap_prog(struct bd *bd, uint32_t block, uint32_t off, const void *buffer, size_t size)
+{
+    int result = 0;
+    struct bd_mmap *context = bd->opaque;
+
+    size_t offset = bd->block_size * block + off;
+    CHECK_ERROR(context->write, -1, "image is opened read-only");
+    CHECK_ERROR(offset + size <= context->size, -1, "prog past the end of image: off: %zu, size: %zu", offset, size);
+
+    memcpy(context->map + offset, buffer, size);
+
+done:
+    return result;
+}
+
+static int bd_mmap_erase(struct bd *bd, uint32_t block)
+{
+    int result = 0;
+    struct bd_mmap *context = bd->opaque;
+
+    size_t offset = bd->block_size * block;
+    CHECK_ERROR(context->write, -1, "image is opened read-only");
+    CHECK_ERROR(offset + bd->block_size <= context->size, -1, "erase past the end of image: block: %u", block);
+
+    memset(context->map + offset, 0xff, bd->block_size);
+
+done:
+    return result;
+}
+
+static int bd_mmap_sync(struct bd *bd)
+{
+    // the mapping is shared, the page cache is already up to date;
+    // msync() is deferred to close
+    return 0;
+}
+
+static int bd_mmap_close(struct bd *bd)
+{
+    int result = 0;
+
+    struct bd_mmap *context = NULL;
+
+    CHECK_ERROR(bd != NULL, -1, "bd == NULL");
+
+    context = bd->opaque;
+
+    if (context->write) {
+        int err = msync(context->map, context->size, MS_SYNC);
+        CHECK_ERROR(err == 0, -1, "msync() failed: %s", strerror(errno));
+    }
+
+done:
+    if (context != NULL) {
+        if (munmap(context->map, context->size) != 0) {
+            ERROR("munmap() failed: %s", strerror(errno));
+            result = -1;
+        }
+        if (close(context->fd) != 0) {
+            ERROR("close() failed: %s", strerror(errno));
+            result = -1;
+        }
+        free(context);
+        free(bd);
+    }
+    return result;
+}
+
+struct bd *bd_mmap_open(const char *image, bool write, size_t block_size, size_t block_count)
+{
+    struct bd *result = NULL;
+
+    struct bd *bd = NULL;
+    struct bd_mmap *context = NULL;
+
+    bd = calloc(1, sizeof(*bd));
+    CHECK_ERROR(bd != NULL, NULL, "calloc() failed");
+
+    context = calloc(1, sizeof(*context));
+    CHECK_ERROR(context != NULL, NULL, "calloc() failed");
+
+    context->fd = -1;
+    context->map = MAP_FAILED;
+    context->write = write;
+
+    context->fd = open(image, write ? O_RDWR | O_CREAT | O_TRUNC : O_RDONLY,
+                       S_IRUSR | S_IWUSR | S_IRGRP | S_IWGRP | S_IROTH | S_IWOTH);
+    CHECK_ERROR(context->fd >= 0, NULL, "open() failed: %s", strerror(errno));
+
+    struct stat st = {0};
+    int err = fstat(context->fd, &st);
+    CHECK_ERROR(err == 0, NULL, "fstat() failed: %s", strerror(errno));
+    CHECK_ERROR(S_ISREG(st.st_mode), NULL, "%s is not a regular file", image);
+
+    context->size = block_size * block_count;
+
+    if (write) {
+        // the image starts as one big hole, see bd_erased
+        err = ftruncate(context->fd, context->size);
+        CHECK_ERROR(err == 0, NULL, "ftruncate() failed: %s", strerror(errno));
+    } else if ((size_t)st.st_size < context->size) {
+        // short image, accesses past the end fail the same way fread() does
+        context->size = st.st_size;
+    }
+
+    CHECK_ERROR(context->size != 0, NULL, "%s is empty", image);
+
+    context->map = mmap(NULL, context->size, write ? PROT_READ | PROT_WRITE : PROT_READ, MAP_SHARED, context->fd, 0);
+    CHECK_ERROR(context->map != MAP_FAILED, NULL, "mmap() failed: %s", strerror(errno));
+
+    bd->opaque = context;
+    bd->block_size = block_size;
+    bd->block_count = block_count;
+    bd->read = bd_mmap_read;
+    bd->prog = bd_mmap_prog;
+    bd->erase = bd_mmap_erase;
+    bd->sync = bd_mmap_sync;
+    bd->close = bd_mmap_close;
+
+    result = bd;
+
+done:
+    if (result == NULL) {
+        if (context != NULL) {
+            if (context->map != MAP_FAILED) {
+                munmap(context->map, context->size);
+            }
+            if (context->fd >= 0) {
+                close(context->fd);
+            }
+        }
+        free(context);
+        free(bd);
+    }
+    return result;
+}
+
+#else
+
+struct bd *bd_mmap_open(const char *image, bool write, size_t block_size, size_t block_count)
+{
+    ERROR("mmap is not supported on this platform");
+    return NULL;
+}
+
+#endif //_WIN32
@@ -0,0 +1,189 @@
+/**
+ * Copyright 2019 Sergey Tyultyaev
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include "bd_pread.h"
+
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+
+#include "macro.h"
+
+#ifndef _WIN32
+
+#include <sys/stat.h>
+#include <sys/types.h>
+#include <fcntl.h>
+#include <unistd.h>
+
+struct bd_pread
+{
+    int fd;
+    // one block worth of 0xff, source for erases
+    uint8_t *ff;
+};
+
+static int bd_pread_read(struct bd *bd, uint32_t block, uint32_t off, void *buffer, size_t size)
+{
+    int result = 0;
+    struct bd_pread *context = bd->opaque;
+
+    uint8_t *data = buffer;
+    off_t offset = (off_t)bd->block_size * block + off;
+
+    while (size > 0) {
+        ssize_t bytes = pread(context->fd, data, size, offset);
+        if (bytes < 0 && errno == EINTR) {
+            continue;
+        }
+        CHECK_ERROR(bytes > 0, -1, "pread() failed: off: %lld, size: %zu: %s", (long long)offset, size,
+                    bytes == 0 ? "end of file" : strerror(errno));
+
+        data += bytes;
+        offset += bytes;
+        size -= bytes;
+    }
+
+done:
+    return result;
+}
+
+static int pwrite_all(int fd, const void *buffer, size_t size, off_t offset)
+{
+    int result = 0;
+
+    const uint8_t *data = buffer;
+
+    while (size > 0) {
+        ssize_t bytes = pwrite(fd, data, size, offset);
+        if (bytes < 0 && errno == EINTR) {
+            continue;
+        }
+        CHECK_ERROR(bytes > 0, -1, "pwrite() failed: off: %lld, size: %zu: %s", (long long)offset, size,
+                    strerror(errno));
+
+        data += bytes;
+        offset += bytes;
+        size -= bytes;
+    }
+
+done:
+    return result;
+}
+
+static int bd_pread_prog(struct bd *bd, uint32_t block, uint32_t off, const void *buffer, size_t size)
+{
+    struct bd_pread *context = bd->opaque;
+    return pwrite_all(context->fd, buffer, size, (off_t)bd->block_size * block + off);
+}
+
+static int bd_pread_erase(struct bd *bd, uint32_t block)
+{
+    struct bd_pread *context = bd->opaque;
+    return pwrite_all(context->fd, context->ff, bd->block_size, (off_t)bd->block_size * block);
+}
+
+static int bd_pread_sync(struct bd *bd)
+{
+    // nothing is buffered in user space
+    return 0;
+}
+
+static int bd_pread_close(struct bd *bd)
+{
+    int result = 0;
+
+    struct bd_pread *context = NULL;
+
+    CHECK_ERROR(bd != NULL, -1, "bd == NULL");
+
+    context = bd->opaque;
+
+    int err = close(context->fd);
+    CHECK_ERROR(err == 0, -1, "close() failed: %s", strerror(errno));
+
+done:
+    if (context != NULL) {
+        free(context->ff);
+        free(context);
+        free(bd);
+    }
+    return result;
+}
+
+struct bd *bd_pread_open(const char *image, bool write, size_t block_size, size_t block_count)
+{
+    struct bd *result = NULL;
+
+    struct bd *bd = NULL;
+    struct bd_pread *context = NULL;
+
+    bd = calloc(1, sizeof(*bd));
+    CHECK_ERROR(bd != NULL, NULL, "calloc() failed");
+
+    context = calloc(1, sizeof(*context));
+    CHECK_ERROR(context != NULL, NULL, "calloc() failed");
+
+    context->fd = -1;
+
+    context->ff = malloc(block_size);
+    CHECK_ERROR(context->ff != NULL, NULL, "malloc() failed");
+    memset(context->ff, 0xff, block_size);
+
+    context->fd = open(image, write ? O_RDWR | O_CREAT | O_TRUNC : O_RDONLY,
+                       S_IRUSR | S_IWUSR | S_IRGRP | S_IWGRP | S_IROTH | S_IWOTH);
+    CHECK_ERROR(context->fd >= 0, NULL, "open() failed: %s", strerror(errno));
+
+    if (write) {
+        // the image starts as one big hole, see bd_erased
+        int err = ftruncate(context->fd, (off_t)block_size * block_count);
+        CHECK_ERROR(err == 0, NULL, "ftruncate() failed: %s", strerror(errno));
+    }
+
+    bd->opaque = context;
+    bd->block_size = block_size;
+    bd->block_count = block_count;
+    bd->read = bd_pread_read;
+    bd->prog = bd_pread_prog;
+    bd->erase = bd_pread_erase;
+    bd->sync = bd_pread_sync;
+    bd->close = bd_pread_close;
+
+    result = bd;
+
+done:
+    if (result == NULL) {
+        if (context != NULL) {
+            if (context->fd >= 0) {
+                close(context->fd);
+            }
+            free(context->ff);
+        }
+        free(context);
+        free(bd);
+    }
+    return result;
+}
+
+#else
+
+struct bd *bd_pread_open(const char *image, bool write, size_t block_size, size_t block_count)
+{
+    ERROR("pread is not supported on this platform");
+    return NULL;
+}
+
+#endif //_WIN32
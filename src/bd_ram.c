@@ -0,0 +1,276 @@
+/**
+ * Copyright 2019 Sergey Tyultyaev
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+// MAP_ANONYMOUS, madvise()
+#define _GNU_SOURCE
+
+#include "bd_ram.h"
+
+#include <sys/types.h>
+#include <sys/stat.h>
+#include <fcntl.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <unistd.h>
+
+#ifndef _WIN32
+#include <sys/mman.h>
+#endif //_WIN32
+
+#include "macro.h"
+
+struct bd_ram
+{
+    const char *image;
+    bool write;
+    // seek over blocks never written by lfs instead of writing their zeroes
+    bool sparse;
+    uint8_t *buffer;
+    size_t size;
+    // bytes of an existing image, reads past it fail
+    size_t loaded;
+    // image or stdout, stdout is captured at open
+    int fd;
+};
+
+static uint8_t *ram_alloc(size_t size)
+{
+#ifndef _WIN32
+    void *buffer = mmap(NULL, size, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+    if (buffer == MAP_FAILED) {
+        return NULL;
+    }
+#ifdef MADV_HUGEPAGE
+    // fewer TLB misses on large images, best effort
+    madvise(buffer, size, MADV_HUGEPAGE);
+#endif
+    return buffer;
+#else
+    return malloc(size);
+#endif //_WIN32
+}
+
+static void ram_free(uint8_t *buffer, size_t size)
+{
+#ifndef _WIN32
+    munmap(buffer, size);
+#else
+    free(buffer);
+#endif //_WIN32
+}
+
+static int ram_write(int fd, const uint8_t *data, size_t size)
+{
+    while (size > 0) {
+        ssize_t bytes = write(fd, data, size);
+        if (bytes < 0 && errno == EINTR) {
+            continue;
+        }
+        if (bytes <= 0) {
+            return -1;
+        }
+
+        data += bytes;
+        size -= bytes;
+    }
+
+    return 0;
+}
+
+static bool ram_zero(const uint8_t *data, size_t size)
+{
+    return size == 0 || (data[0] == 0 && memcmp(data, data + 1, size - 1) == 0);
+}
+
+static int bd_ram_read(struct bd *bd, uint32_t block, uint32_t off, void *buffer, size_t size)
+{
+    int result = 0;
+    struct bd_ram *context = bd->opaque;
+
+    size_t offset = bd->block_size * block + off;
+    CHECK_ERROR(offset + size <= context->loaded, -1, "read past the end of image: off: %zu, size: %zu", offset, size);
+
+    memcpy(buffer, context->buffer + offset, size);
+
+done:
+    return result;
+}
+
+static int bd_ram_prog(struct bd *bd, uint32_t block, uint32_t off, const void *buffer, size_t size)
+{
+    int result = 0;
+    struct bd_ram *context = bd->opaque;
+
+    size_t offset = bd->block_size * block + off;
+    CHECK_ERROR(offset + size <= context->size, -1, "prog past the end of image: off: %zu, size: %zu", offset, size);
+
+    memcpy(context->buffer + offset, buffer, size);
+
+done:
+    return result;
+}
+
+static int bd_ram_erase(struct bd *bd, uint32_t block)
+{
+    int result = 0;
+    struct bd_ram *context = bd->opaque;
+
+    size_t offset = bd->block_size * block;
+    CHECK_ERROR(offset + bd->block_size <= context->size, -1, "erase past the end of image: block: %u", block);
+
+    memset(context->buffer + offset, 0xff, bd->block_size);
+
+done:
+    return result;
+}
+
+static int bd_ram_sync(struct bd *bd)
+{
+    // the image is written once, on close
+    return 0;
+}
+
+static int bd_ram_close(struct bd *bd)
+{
+    int result = 0;
+
+    struct bd_ram *context = NULL;
+
+    CHECK_ERROR(bd != NULL, -1, "bd == NULL");
+
+    context = bd->opaque;
+
+    if (context->write) {
+        // pristine blocks are still zero, see bd_erased; holes read back
+        // the same. Pipes cannot seek, they get the zeroes written
+        bool holes = context->sparse && lseek(context->fd, 0, SEEK_CUR) >= 0;
+
+        size_t start = 0;
+        for (size_t off = 0; off < context->size; off += bd->block_size) {
+            if (!holes || !ram_zero(context->buffer + off, bd->block_size)) {
+                continue;
+            }
+
+            int err = ram_write(context->fd, context->buffer + start, off - start);
+            CHECK_ERROR(err == 0, -1, "write() to %s failed: %s", context->image, strerror(errno));
+            CHECK_ERROR(lseek(context->fd, bd->block_size, SEEK_CUR) >= 0, -1, "lseek() failed: %s",
+                        strerror(errno));
+            start = off + bd->block_size;
+        }
+
+        int err = ram_write(context->fd, context->buffer + start, context->size - start);
+        CHECK_ERROR(err == 0, -1, "write() to %s failed: %s", context->image, strerror(errno));
+
+        if (holes) {
+            // a trailing hole is only there once the size is set
+            err = ftruncate(context->fd, context->size);
+            CHECK_ERROR(err == 0, -1, "ftruncate() failed: %s", strerror(errno));
+        }
+    }
+
+done:
+    if (context != NULL) {
+        if (context->fd >= 0 && close(context->fd) != 0) {
+            ERROR("close() failed: %s", strerror(errno));
+            result = -1;
+        }
+        if (context->buffer != NULL) {
+            ram_free(context->buffer, context->size);
+        }
+        free(context);
+        free(bd);
+    }
+    return result;
+}
+
+struct bd *bd_ram_open(const char *image, bool write, bool sparse, size_t block_size, size_t block_count)
+{
+    struct bd *result = NULL;
+
+    struct bd *bd = NULL;
+    struct bd_ram *context = NULL;
+
+    bd = calloc(1, sizeof(*bd));
+    CHECK_ERROR(bd != NULL, NULL, "calloc() failed");
+
+    context = calloc(1, sizeof(*context));
+    CHECK_ERROR(context != NULL, NULL, "calloc() failed");
+
+    context->fd = -1;
+    context->image = image;
+    context->write = write;
+    context->sparse = sparse;
+    context->size = block_size * block_count;
+
+    if (strcmp(image, "-") == 0) {
+        context->fd = dup(write ? STDOUT_FILENO : STDIN_FILENO);
+        CHECK_ERROR(context->fd >= 0, NULL, "dup() failed: %s", strerror(errno));
+    } else {
+        int flags = write ? O_WRONLY | O_CREAT | O_TRUNC : O_RDONLY;
+#ifdef _WIN32
+        flags |= O_BINARY;
+#endif //_WIN32
+        context->fd = open(image, flags, S_IRUSR | S_IWUSR | S_IRGRP | S_IWGRP | S_IROTH | S_IWOTH);
+        CHECK_ERROR(context->fd >= 0, NULL, "open() failed: %s", strerror(errno));
+    }
+
+    // anonymous memory is zeroed, bd_erased fills blocks on first use
+    context->buffer = ram_alloc(context->size);
+    CHECK_ERROR(context->buffer != NULL, NULL, "cannot allocate %zu bytes for the image", context->size);
+
+    if (write) {
+        context->loaded = context->size;
+    } else {
+        while (context->loaded < context->size) {
+            ssize_t bytes = read(context->fd, context->buffer + context->loaded, context->size - context->loaded);
+            if (bytes < 0 && errno == EINTR) {
+                continue;
+            }
+            CHECK_ERROR(bytes >= 0, NULL, "read() from %s failed: %s", image, strerror(errno));
+            if (bytes == 0) {
+                break;
+            }
+            context->loaded += bytes;
+        }
+    }
+
+    bd->opaque = context;
+    bd->block_size = block_size;
+    bd->block_count = block_count;
+    bd->read = bd_ram_read;
+    bd->prog = bd_ram_prog;
+    bd->erase = bd_ram_erase;
+    bd->sync = bd_ram_sync;
+    bd->close = bd_ram_close;
+
+    result = bd;
+
+done:
+    if (result == NULL) {
+        if (context != NULL) {
+            if (context->fd >= 0) {
+                close(context->fd);
+            }
+            if (context->buffer != NULL) {
+                ram_free(context->buffer, context->size);
+            }
+        }
+        free(context);
+        free(bd);
+    }
+    return result;
+}
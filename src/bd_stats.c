@@ -0,0 +1,294 @@
+/**
+ * Copyright 2019 Sergey Tyultyaev
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include "bd_stats.h"
+
+#include <inttypes.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "macro.h"
+#include "bd_cache.h"
+#include "util.h"
+
+// log2 buckets, bucket i counts values in [2^(i-1), 2^i)
+#define STATS_BUCKETS 40
+
+typedef enum {
+    STATS_READ = 0,
+    STATS_PROG,
+    STATS_ERASE,
+    STATS_SYNC,
+    STATS_OPS
+} stats_op_t;
+
+static const char *const m_op_names[STATS_OPS] = {"read", "prog", "erase", "sync"};
+
+struct stats_op
+{
+    uint64_t count;
+    uint64_t bytes;
+    uint64_t ns;
+    uint64_t max_ns;
+    uint64_t latency[STATS_BUCKETS];
+    uint64_t sizes[STATS_BUCKETS];
+};
+
+struct bd_stats
+{
+    struct bd *lower;
+    // bd_cache layer somewhere below, or NULL
+    struct bd *cache;
+    struct stats_op ops[STATS_OPS];
+};
+
+static size_t bucket(uint64_t value)
+{
+    size_t i = value == 0 ? 0 : 64 - __builtin_clzll(value);
+    return i < STATS_BUCKETS ? i : STATS_BUCKETS - 1;
+}
+
+static void stats_account(struct bd_stats *context, stats_op_t type, size_t size, uint64_t start)
+{
+    struct stats_op *op = &context->ops[type];
+    uint64_t ns = now_ns() - start;
+
+    op->count++;
+    op->bytes += size;
+    op->ns += ns;
+    if (ns > op->max_ns) {
+        op->max_ns = ns;
+    }
+    op->latency[bucket(ns)]++;
+    op->sizes[bucket(size)]++;
+}
+
+static int bd_stats_read(struct bd *bd, uint32_t block, uint32_t off, void *buffer, size_t size)
+{
+    struct bd_stats *context = bd->opaque;
+    uint64_t start = now_ns();
+    int err = context->lower->read(context->lower, block, off, buffer, size);
+    stats_account(context, STATS_READ, size, start);
+    return err;
+}
+
+static int bd_stats_prog(struct bd *bd, uint32_t block, uint32_t off, const void *buffer, size_t size)
+{
+    struct bd_stats *context = bd->opaque;
+    uint64_t start = now_ns();
+    int err = context->lower->prog(context->lower, block, off, buffer, size);
+    stats_account(context, STATS_PROG, size, start);
+    return err;
+}
+
+static int bd_stats_erase(struct bd *bd, uint32_t block)
+{
+    struct bd_stats *context = bd->opaque;
+    uint64_t start = now_ns();
+    int err = context->lower->erase(context->lower, block);
+    stats_account(context, STATS_ERASE, bd->block_size, start);
+    return err;
+}
+
+static int bd_stats_sync(struct bd *bd)
+{
+    struct bd_stats *context = bd->opaque;
+    uint64_t start = now_ns();
+    int err = context->lower->sync(context->lower);
+    stats_account(context, STATS_SYNC, 0, start);
+    return err;
+}
+
+static int bd_stats_close(struct bd *bd)
+{
+    int result = 0;
+
+    CHECK_ERROR(bd != NULL, -1, "bd == NULL");
+
+    struct bd_stats *context = bd->opaque;
+
+    result = context->lower->close(context->lower);
+
+    free(context);
+    free(bd);
+
+done:
+    return result;
+}
+
+// Upper bound of the bucket holding the given percentile.
+static uint64_t percentile(const uint64_t *buckets, uint64_t count, unsigned pct)
+{
+    uint64_t rank = (count * pct + 99) / 100;
+    uint64_t seen = 0;
+
+    for (size_t i = 0; i < STATS_BUCKETS; i++) {
+        seen += buckets[i];
+        if (seen >= rank && seen != 0) {
+            return i == 0 ? 0 : (uint64_t)1 << i;
+        }
+    }
+
+    return 0;
+}
+
+static double ratio(uint64_t a, uint64_t b)
+{
+    return b != 0 ? (double)a / b : 0.0;
+}
+
+static void report_text(struct bd_stats *context, uint64_t payload_written, uint64_t payload_read, FILE *out)
+{
+    fprintf(out, "block device statistics:\n");
+    fprintf(out, "  %-6s %10s %14s %10s %12s %12s %12s %12s\n", "op", "count", "bytes", "avg size", "avg, us",
+            "p50, us", "p99, us", "max, us");
+
+    for (size_t i = 0; i < STATS_OPS; i++) {
+        const struct stats_op *op = &context->ops[i];
+        fprintf(out, "  %-6s %10" PRIu64 " %14" PRIu64 " %10.0f %12.2f %12.2f %12.2f %12.2f\n", m_op_names[i],
+                op->count, op->bytes, ratio(op->bytes, op->count), ratio(op->ns, op->count) / 1000,
+                percentile(op->latency, op->count, 50) / 1000.0, percentile(op->latency, op->count, 99) / 1000.0,
+                op->max_ns / 1000.0);
+    }
+
+    for (size_t i = STATS_READ; i <= STATS_PROG; i++) {
+        const struct stats_op *op = &context->ops[i];
+        fprintf(out, "  %s sizes:", m_op_names[i]);
+        for (size_t b = 0; b < STATS_BUCKETS; b++) {
+            if (op->sizes[b] != 0) {
+                fprintf(out, " <%" PRIu64 ": %" PRIu64, (uint64_t)1 << b, op->sizes[b]);
+            }
+        }
+        fprintf(out, "\n");
+    }
+
+    fprintf(out, "  payload written: %" PRIu64 " bytes, write amplification: %.3f\n", payload_written,
+            ratio(context->ops[STATS_PROG].bytes, payload_written));
+    fprintf(out, "  payload read: %" PRIu64 " bytes, read amplification: %.3f\n", payload_read,
+            ratio(context->ops[STATS_READ].bytes, payload_read));
+
+    if (context->cache != NULL) {
+        struct bd_cache_stats cache;
+        bd_cache_get_stats(context->cache, &cache);
+        fprintf(out,
+                "  block cache: %" PRIu64 " hits, %" PRIu64 " misses, %.1f%% hit rate, %" PRIu64 " evictions, %" PRIu64
+                " writebacks\n",
+                cache.hits, cache.misses, 100.0 * ratio(cache.hits, cache.hits + cache.misses), cache.evictions,
+                cache.writebacks);
+    }
+}
+
+static void report_buckets(const uint64_t *buckets, FILE *out)
+{
+    fprintf(out, "[");
+    for (size_t b = 0; b < STATS_BUCKETS; b++) {
+        fprintf(out, "%s%" PRIu64, b == 0 ? "" : ", ", buckets[b]);
+    }
+    fprintf(out, "]");
+}
+
+static void report_json_fields(struct bd_stats *context, uint64_t payload_written, uint64_t payload_read, FILE *out)
+{
+    fprintf(out, "  \"ops\": {\n");
+
+    for (size_t i = 0; i < STATS_OPS; i++) {
+        const struct stats_op *op = &context->ops[i];
+        fprintf(out, "    \"%s\": {\"count\": %" PRIu64 ", \"bytes\": %" PRIu64 ", \"time_ns\": %" PRIu64
+                ", \"max_ns\": %" PRIu64 ",\n", m_op_names[i], op->count, op->bytes, op->ns, op->max_ns);
+        fprintf(out, "      \"latency_ns_log2\": ");
+        report_buckets(op->latency, out);
+        fprintf(out, ",\n      \"size_log2\": ");
+        report_buckets(op->sizes, out);
+        fprintf(out, "}%s\n", i + 1 < STATS_OPS ? "," : "");
+    }
+
+    fprintf(out, "  },\n");
+    fprintf(out, "  \"payload_written\": %" PRIu64 ",\n", payload_written);
+    fprintf(out, "  \"payload_read\": %" PRIu64 ",\n", payload_read);
+    fprintf(out, "  \"write_amplification\": %.6f,\n", ratio(context->ops[STATS_PROG].bytes, payload_written));
+    fprintf(out, "  \"read_amplification\": %.6f", ratio(context->ops[STATS_READ].bytes, payload_read));
+
+    if (context->cache != NULL) {
+        struct bd_cache_stats cache;
+        bd_cache_get_stats(context->cache, &cache);
+        fprintf(out,
+                ",\n  \"block_cache\": {\"hits\": %" PRIu64 ", \"misses\": %" PRIu64 ", \"evictions\": %" PRIu64
+                ", \"writebacks\": %" PRIu64 "}",
+                cache.hits, cache.misses, cache.evictions, cache.writebacks);
+    }
+}
+
+static void report_json(struct bd_stats *context, uint64_t payload_written, uint64_t payload_read, FILE *out)
+{
+    fprintf(out, "{\n");
+    report_json_fields(context, payload_written, payload_read, out);
+    fprintf(out, "\n}\n");
+}
+
+void bd_stats_report(struct bd *bd, uint64_t payload_written, uint64_t payload_read, FILE *text, FILE *json)
+{
+    struct bd_stats *context = bd->opaque;
+
+    if (text != NULL) {
+        report_text(context, payload_written, payload_read, text);
+    }
+
+    if (json != NULL) {
+        report_json(context, payload_written, payload_read, json);
+    }
+}
+
+void bd_stats_report_fields(struct bd *bd, uint64_t payload_written, uint64_t payload_read, FILE *json)
+{
+    report_json_fields(bd->opaque, payload_written, payload_read, json);
+}
+
+struct bd *bd_stats_open(struct bd *lower, struct bd *cache)
+{
+    struct bd *result = NULL;
+
+    struct bd *bd = NULL;
+    struct bd_stats *context = NULL;
+
+    CHECK_ERROR(lower != NULL, NULL, "lower == NULL");
+
+    bd = calloc(1, sizeof(*bd));
+    CHECK_ERROR(bd != NULL, NULL, "calloc() failed");
+
+    context = calloc(1, sizeof(*context));
+    CHECK_ERROR(context != NULL, NULL, "calloc() failed");
+
+    context->lower = lower;
+    context->cache = cache;
+
+    bd->opaque = context;
+    bd->block_size = lower->block_size;
+    bd->block_count = lower->block_count;
+    bd->read = bd_stats_read;
+    bd->prog = bd_stats_prog;
+    bd->erase = bd_stats_erase;
+    bd->sync = bd_stats_sync;
+    bd->close = bd_stats_close;
+
+    result = bd;
+
+done:
+    if (result == NULL) {
+        free(context);
+        free(bd);
+    }
+    return result;
+}
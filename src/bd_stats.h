@@ -0,0 +1,33 @@
+// Copyright 2019 Sergey Tyultyaev
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#pragma once
+
+#include <stdio.h>
+
+#include "bd.h"
+
+// Counts operations on lower with their sizes and latencies. cache, when not
+// NULL, is the bd_cache layer of the stack whose counters are reported too.
+// Takes ownership of lower.
+struct bd *bd_stats_open(struct bd *lower, struct bd *cache);
+
+// Prints the summary to text and, when not NULL, the same data as JSON to
+// json. payload_written and payload_read are the file bytes that went through
+// the filesystem, they give the write and read amplification.
+void bd_stats_report(struct bd *bd, uint64_t payload_written, uint64_t payload_read, FILE *text, FILE *json);
+
+// Writes the members of the JSON object of bd_stats_report() without the
+// braces, for callers that add members of their own.
+void bd_stats_report_fields(struct bd *bd, uint64_t payload_written, uint64_t payload_read, FILE *json);
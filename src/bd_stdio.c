@@ -0,0 +1,178 @@
+/**
+ * Copyright 2019 Sergey Tyultyaev
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include "bd_stdio.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+
+#include "macro.h"
+
+#ifdef _WIN32
+#include <io.h>
+#else
+#include <unistd.h>
+#endif //_WIN32
+
+struct bd_stdio
+{
+    FILE *file;
+    // one block worth of 0xff, source for erases
+    uint8_t *ff;
+};
+
+static int stdio_truncate(FILE *file, size_t size)
+{
+#ifdef _WIN32
+    return _chsize(_fileno(file), size);
+#else
+    return ftruncate(fileno(file), size);
+#endif //_WIN32
+}
+
+static int bd_stdio_read(struct bd *bd, uint32_t block, uint32_t off, void *buffer, size_t size)
+{
+    int result = 0;
+    struct bd_stdio *context = bd->opaque;
+
+    size_t offset = bd->block_size * block + off;
+
+    int err = fseek(context->file, offset, SEEK_SET);
+    CHECK_ERROR(err == 0, -1, "fseek() failed: %d", err);
+
+    size_t bytes = fread(buffer, 1, size, context->file);
+    CHECK_ERROR(bytes == size, -1, "fread() failed: off: %u, size: %zu, bytes: %zu", off, size, bytes);
+
+done:
+    return result;
+}
+
+static int bd_stdio_prog(struct bd *bd, uint32_t block, uint32_t off, const void *buffer, size_t size)
+{
+    int result = 0;
+    struct bd_stdio *context = bd->opaque;
+
+    size_t offset = bd->block_size * block + off;
+
+    int err = fseek(context->file, offset, SEEK_SET);
+    CHECK_ERROR(err == 0, -1, "fseek() failed: %d", err);
+
+    size_t bytes = fwrite(buffer, 1, size, context->file);
+    CHECK_ERROR(bytes == size, -1, "fwrite() failed");
+
+done:
+    return result;
+}
+
+static int bd_stdio_erase(struct bd *bd, uint32_t block)
+{
+    int result = 0;
+    struct bd_stdio *context = bd->opaque;
+
+    size_t offset = bd->block_size * block;
+
+    int err = fseek(context->file, offset, SEEK_SET);
+    CHECK_ERROR(err == 0, -1, "fseek() failed: %d", err);
+
+    size_t bytes = fwrite(context->ff, 1, bd->block_size, context->file);
+    CHECK_ERROR(bytes == bd->block_size, -1, "fwrite() failed");
+
+done:
+    return result;
+}
+
+static int bd_stdio_sync(struct bd *bd)
+{
+    struct bd_stdio *context = bd->opaque;
+    return fflush(context->file) != EOF ? 0 : -1;
+}
+
+static int bd_stdio_close(struct bd *bd)
+{
+    int result = 0;
+
+    struct bd_stdio *context = NULL;
+
+    CHECK_ERROR(bd != NULL, -1, "bd == NULL");
+
+    context = bd->opaque;
+
+    int err = fclose(context->file);
+    CHECK_ERROR(err == 0, -1, "fclose() failed: %s", strerror(errno));
+
+done:
+    if (context != NULL) {
+        free(context->ff);
+        free(context);
+        free(bd);
+    }
+    return result;
+}
+
+struct bd *bd_stdio_open(const char *image, bool write, size_t block_size, size_t block_count)
+{
+    struct bd *result = NULL;
+
+    struct bd *bd = NULL;
+    struct bd_stdio *context = NULL;
+
+    bd = calloc(1, sizeof(*bd));
+    CHECK_ERROR(bd != NULL, NULL, "calloc() failed");
+
+    context = calloc(1, sizeof(*context));
+    CHECK_ERROR(context != NULL, NULL, "calloc() failed");
+
+    context->ff = malloc(block_size);
+    CHECK_ERROR(context->ff != NULL, NULL, "malloc() failed");
+    memset(context->ff, 0xff, block_size);
+
+    context->file = fopen(image, write ? "w+b" : "rb");
+    CHECK_ERROR(context->file != NULL, NULL, "fopen() failed: %s", strerror(errno));
+
+    if (write && stdio_truncate(context->file, block_count * block_size) != 0) {
+        // cannot be extended with holes, fill it with erased blocks
+        for (size_t i = 0; i < block_count; i++) {
+            size_t bytes = fwrite(context->ff, 1, block_size, context->file);
+            CHECK_ERROR(bytes == block_size, NULL, "fwrite() failed: %s", strerror(errno));
+        }
+    }
+
+    bd->opaque = context;
+    bd->block_size = block_size;
+    bd->block_count = block_count;
+    bd->read = bd_stdio_read;
+    bd->prog = bd_stdio_prog;
+    bd->erase = bd_stdio_erase;
+    bd->sync = bd_stdio_sync;
+    bd->close = bd_stdio_close;
+
+    result = bd;
+
+done:
+    if (result == NULL) {
+        if (context != NULL) {
+            if (context->file != NULL) {
+                fclose(context->file);
+            }
+            free(context->ff);
+        }
+        free(context);
+        free(bd);
+    }
+    return result;
+}
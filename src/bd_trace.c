@@ -0,0 +1,344 @@
+/**
+ * Copyright 2019 Sergey Tyultyaev
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include "bd_trace.h"
+
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+
+#include "macro.h"
+#include "bd_stats.h"
+#include "util.h"
+
+// File layout, all fields little-endian:
+//   header: magic[8], version u32, block_size u32, block_count u32
+//   record: op u8, block u32, off u32, size u32, time u64 (ns since open)
+#define TRACE_MAGIC "LFSTRACE"
+#define TRACE_VERSION 1
+#define TRACE_HEADER_SIZE 20
+#define TRACE_RECORD_SIZE 21
+
+typedef enum {
+    TRACE_READ = 0,
+    TRACE_PROG,
+    TRACE_ERASE,
+    TRACE_SYNC,
+} trace_op_t;
+
+struct trace_record
+{
+    uint8_t op;
+    uint32_t block;
+    uint32_t off;
+    uint32_t size;
+    uint64_t time;
+};
+
+struct bd_trace
+{
+    struct bd *lower;
+    FILE *file;
+    uint64_t start;
+    // first write error, reported on close
+    bool error;
+};
+
+static void put_le(uint8_t *p, uint64_t value, size_t size)
+{
+    for (size_t i = 0; i < size; i++) {
+        p[i] = (uint8_t)(value >> (8 * i));
+    }
+}
+
+static uint64_t get_le(const uint8_t *p, size_t size)
+{
+    uint64_t value = 0;
+    for (size_t i = 0; i < size; i++) {
+        value |= (uint64_t)p[i] << (8 * i);
+    }
+    return value;
+}
+
+static void trace_record(struct bd_trace *context, trace_op_t op, uint32_t block, uint32_t off, size_t size)
+{
+    uint8_t record[TRACE_RECORD_SIZE];
+
+    record[0] = op;
+    put_le(record + 1, block, 4);
+    put_le(record + 5, off, 4);
+    put_le(record + 9, size, 4);
+    put_le(record + 13, now_ns() - context->start, 8);
+
+    if (!context->error && fwrite(record, sizeof(record), 1, context->file) != 1) {
+        ERROR("fwrite() failed: %s", strerror(errno));
+        context->error = true;
+    }
+}
+
+static int bd_trace_read(struct bd *bd, uint32_t block, uint32_t off, void *buffer, size_t size)
+{
+    struct bd_trace *context = bd->opaque;
+    trace_record(context, TRACE_READ, block, off, size);
+    return context->lower->read(context->lower, block, off, buffer, size);
+}
+
+static int bd_trace_prog(struct bd *bd, uint32_t block, uint32_t off, const void *buffer, size_t size)
+{
+    struct bd_trace *context = bd->opaque;
+    trace_record(context, TRACE_PROG, block, off, size);
+    return context->lower->prog(context->lower, block, off, buffer, size);
+}
+
+static int bd_trace_erase(struct bd *bd, uint32_t block)
+{
+    struct bd_trace *context = bd->opaque;
+    trace_record(context, TRACE_ERASE, block, 0, bd->block_size);
+    return context->lower->erase(context->lower, block);
+}
+
+static int bd_trace_sync(struct bd *bd)
+{
+    struct bd_trace *context = bd->opaque;
+    trace_record(context, TRACE_SYNC, 0, 0, 0);
+    return context->lower->sync(context->lower);
+}
+
+static int bd_trace_close(struct bd *bd)
+{
+    int result = 0;
+
+    CHECK_ERROR(bd != NULL, -1, "bd == NULL");
+
+    struct bd_trace *context = bd->opaque;
+
+    if (context->error) {
+        ERROR("trace is incomplete");
+        result = -1;
+    }
+
+    if (fclose(context->file) != 0) {
+        ERROR("fclose() failed: %s", strerror(errno));
+        result = -1;
+    }
+
+    if (context->lower->close(context->lower) != 0) {
+        result = -1;
+    }
+
+    free(context);
+    free(bd);
+
+done:
+    return result;
+}
+
+struct bd *bd_trace_open(struct bd *lower, const char *trace)
+{
+    struct bd *result = NULL;
+
+    struct bd *bd = NULL;
+    struct bd_trace *context = NULL;
+
+    CHECK_ERROR(lower != NULL, NULL, "lower == NULL");
+    CHECK_ERROR(trace != NULL, NULL, "trace == NULL");
+
+    bd = calloc(1, sizeof(*bd));
+    CHECK_ERROR(bd != NULL, NULL, "calloc() failed");
+
+    context = calloc(1, sizeof(*context));
+    CHECK_ERROR(context != NULL, NULL, "calloc() failed");
+
+    context->file = fopen(trace, "wb");
+    CHECK_ERROR(context->file != NULL, NULL, "fopen(%s) failed: %s", trace, strerror(errno));
+
+    uint8_t header[TRACE_HEADER_SIZE];
+    memcpy(header, TRACE_MAGIC, 8);
+    put_le(header + 8, TRACE_VERSION, 4);
+    put_le(header + 12, lower->block_size, 4);
+    put_le(header + 16, lower->block_count, 4);
+
+    size_t count = fwrite(header, sizeof(header), 1, context->file);
+    CHECK_ERROR(count == 1, NULL, "fwrite() failed: %s", strerror(errno));
+
+    context->lower = lower;
+    context->start = now_ns();
+
+    bd->opaque = context;
+    bd->block_size = lower->block_size;
+    bd->block_count = lower->block_count;
+    bd->read = bd_trace_read;
+    bd->prog = bd_trace_prog;
+    bd->erase = bd_trace_erase;
+    bd->sync = bd_trace_sync;
+    bd->close = bd_trace_close;
+
+    result = bd;
+
+done:
+    if (result == NULL) {
+        if (context != NULL && context->file != NULL) {
+            fclose(context->file);
+        }
+        free(context);
+        free(bd);
+    }
+    return result;
+}
+
+// Loads the whole trace, it is replayed from memory so file IO on the trace
+// does not show up in the measurement.
+static int trace_load(const char *trace, size_t *block_size, size_t *block_count, struct trace_record **records,
+                      size_t *count)
+{
+    int result = 0;
+
+    FILE *file = NULL;
+    struct trace_record *buffer = NULL;
+    size_t capacity = 0;
+    size_t n = 0;
+
+    file = fopen(trace, "rb");
+    CHECK_ERROR(file != NULL, -1, "fopen(%s) failed: %s", trace, strerror(errno));
+
+    uint8_t header[TRACE_HEADER_SIZE];
+    CHECK_ERROR(fread(header, sizeof(header), 1, file) == 1, -1, "%s: no header", trace);
+    CHECK_ERROR(memcmp(header, TRACE_MAGIC, 8) == 0, -1, "%s is not a trace", trace);
+    CHECK_ERROR(get_le(header + 8, 4) == TRACE_VERSION, -1, "%s: unsupported version", trace);
+
+    *block_size = get_le(header + 12, 4);
+    *block_count = get_le(header + 16, 4);
+
+    uint8_t record[TRACE_RECORD_SIZE];
+    size_t bytes = 0;
+    while ((bytes = fread(record, 1, sizeof(record), file)) == sizeof(record)) {
+        if (n == capacity) {
+            capacity = capacity != 0 ? capacity * 2 : 4096;
+            struct trace_record *grown = realloc(buffer, capacity * sizeof(*buffer));
+            CHECK_ERROR(grown != NULL, -1, "realloc() failed");
+            buffer = grown;
+        }
+
+        struct trace_record *r = &buffer[n++];
+        r->op = record[0];
+        r->block = get_le(record + 1, 4);
+        r->off = get_le(record + 5, 4);
+        r->size = get_le(record + 9, 4);
+        r->time = get_le(record + 13, 8);
+
+        CHECK_ERROR(r->op <= TRACE_SYNC, -1, "%s: bad record %zu", trace, n - 1);
+        CHECK_ERROR(r->block < *block_count && r->off + (uint64_t)r->size <= *block_size, -1,
+                    "%s: record %zu is out of range", trace, n - 1);
+    }
+
+    CHECK_ERROR(ferror(file) == 0, -1, "fread() failed: %s", strerror(errno));
+    if (bytes != 0) {
+        ERROR("%s: trailing %zu bytes ignored", trace, bytes);
+    }
+
+    *records = buffer;
+    *count = n;
+    buffer = NULL;
+
+done:
+    free(buffer);
+    if (file != NULL) {
+        fclose(file);
+    }
+    return result;
+}
+
+int bd_trace_replay(const char *trace, const struct bd_config *config, const char *image, FILE *stats_text,
+                    FILE *stats_json)
+{
+    int result = 0;
+
+    struct trace_record *records = NULL;
+    size_t count = 0;
+    size_t block_size = 0;
+    size_t block_count = 0;
+    struct bd *bd = NULL;
+    uint8_t *buffer = NULL;
+
+    CHECK_ERROR(trace != NULL, -1, "trace == NULL");
+    CHECK_ERROR(config != NULL, -1, "config == NULL");
+    CHECK_ERROR(image != NULL, -1, "image == NULL");
+
+    int err = trace_load(trace, &block_size, &block_count, &records, &count);
+    CHECK_ERROR(err == 0, -1, "trace_load() failed: %d", err);
+
+    bool write = false;
+    for (size_t i = 0; i < count; i++) {
+        if (records[i].op == TRACE_PROG || records[i].op == TRACE_ERASE) {
+            write = true;
+            break;
+        }
+    }
+
+    // progs write a fixed pattern, the content does not matter to the backend
+    buffer = malloc(block_size);
+    CHECK_ERROR(buffer != NULL, -1, "malloc() failed");
+    memset(buffer, 0x5a, block_size);
+
+    bd = bd_open(config, image, write, block_size, block_count);
+    CHECK_ERROR(bd != NULL, -1, "bd_open() failed");
+
+    uint64_t start = now_ns();
+
+    for (size_t i = 0; i < count; i++) {
+        const struct trace_record *r = &records[i];
+
+        switch (r->op) {
+            case TRACE_READ:
+                err = bd->read(bd, r->block, r->off, buffer, r->size);
+                break;
+            case TRACE_PROG:
+                err = bd->prog(bd, r->block, r->off, buffer, r->size);
+                break;
+            case TRACE_ERASE:
+                err = bd->erase(bd, r->block);
+                break;
+            case TRACE_SYNC:
+            default:
+                err = bd->sync(bd);
+                break;
+        }
+
+        CHECK_ERROR(err == 0, -1, "record %zu (op %u, block %u) failed: %d", i, r->op, r->block, err);
+    }
+
+    if (config->stats) {
+        bd_stats_report(bd, 0, 0, stats_text, stats_json);
+    }
+
+    // the final write-out of cached and RAM images is part of the run
+    err = bd->close(bd);
+    bd = NULL;
+    CHECK_ERROR(err == 0, -1, "bd->close() failed: %d", err);
+
+    uint64_t elapsed = now_ns() - start;
+    uint64_t recorded = count != 0 ? records[count - 1].time : 0;
+
+    INFO("replayed %zu operations in %.3f ms, recorded run took %.3f ms", count, elapsed / 1e6, recorded / 1e6);
+
+done:
+    if (bd != NULL) {
+        bd->close(bd);
+    }
+    free(buffer);
+    free(records);
+    return result;
+}
@@ -0,0 +1,30 @@
+// Copyright 2019 Sergey Tyultyaev
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#pragma once
+
+#include <stdio.h>
+
+#include "bd.h"
+
+// Records every operation on lower (op, block, off, size, timestamp) to the
+// trace file, data is not recorded. Takes ownership of lower.
+struct bd *bd_trace_open(struct bd *lower, const char *trace);
+
+// Re-issues the operations of trace against image opened with config, as
+// fast as possible. The image is created when the trace has progs or erases
+// and opened read-only otherwise. Statistics are printed to stats_text and
+// stats_json when config->stats is set.
+int bd_trace_replay(const char *trace, const struct bd_config *config, const char *image, FILE *stats_text,
+                    FILE *stats_json);
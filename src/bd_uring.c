@@ -0,0 +1,566 @@
+/**
+ * Copyright 2019 Sergey Tyultyaev
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+// syscall()
+#define _GNU_SOURCE
+
+#include "bd_uring.h"
+
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+
+#include "macro.h"
+
+#if defined(__linux__) && __has_include(<linux/io_uring.h>)
+
+#include <linux/io_uring.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <sys/syscall.h>
+#include <sys/types.h>
+#include <sys/uio.h>
+#include <fcntl.h>
+#include <unistd.h>
+
+// number of operations in flight, a power of two
+#define URING_DEPTH 64
+// queued progs are submitted in batches of this size
+#define URING_BATCH 32
+// number of blocks read ahead
+#define URING_READAHEAD 4
+
+struct uring_slot
+{
+    bool busy;
+    bool done;
+    bool write;
+    uint32_t block;
+    uint32_t off;
+    size_t size;
+    int res;
+    // block sized, holds prog data or read-ahead data
+    uint8_t *buffer;
+    struct iovec iov;
+};
+
+struct uring_readahead
+{
+    int slot;
+    uint32_t block;
+    uint32_t off;
+};
+
+struct bd_uring
+{
+    int fd;
+    int ring_fd;
+
+    void *sq_ring;
+    size_t sq_ring_size;
+    void *cq_ring;
+    size_t cq_ring_size;
+    struct io_uring_sqe *sqes;
+    size_t sqes_size;
+
+    unsigned *sq_tail;
+    unsigned *sq_mask;
+    unsigned *sq_array;
+    unsigned *cq_head;
+    unsigned *cq_tail;
+    unsigned *cq_mask;
+    struct io_uring_cqe *cqes;
+
+    // sqes written but not yet passed to the kernel
+    unsigned queued;
+    // first failure of an asynchronous prog, reported on the next call
+    int error;
+
+    struct uring_slot slots[URING_DEPTH];
+    struct uring_readahead readahead[URING_READAHEAD];
+    unsigned readahead_next;
+
+    // one block worth of 0xff, source for erases
+    uint8_t *ff;
+};
+
+static int uring_enter(struct bd_uring *context, unsigned wait_nr)
+{
+    int result = 0;
+
+    int ret;
+    do {
+        ret = syscall(__NR_io_uring_enter, context->ring_fd, context->queued, wait_nr,
+                      wait_nr != 0 ? IORING_ENTER_GETEVENTS : 0, NULL, 0);
+    } while (ret < 0 && errno == EINTR);
+    CHECK_ERROR(ret >= 0, -1, "io_uring_enter() failed: %s", strerror(errno));
+
+    context->queued -= ret;
+
+done:
+    return result;
+}
+
+static void uring_reap(struct bd_uring *context)
+{
+    unsigned head = *context->cq_head;
+
+    while (head != __atomic_load_n(context->cq_tail, __ATOMIC_ACQUIRE)) {
+        struct io_uring_cqe *cqe = &context->cqes[head & *context->cq_mask];
+        struct uring_slot *slot = &context->slots[cqe->user_data];
+
+        slot->res = cqe->res;
+        slot->done = true;
+
+        if (slot->write) {
+            if (slot->res != (int)slot->size && context->error == 0) {
+                ERROR("write to block %u failed: %d", slot->block, slot->res);
+                context->error = -1;
+            }
+            slot->busy = false;
+        }
+
+        head++;
+    }
+
+    __atomic_store_n(context->cq_head, head, __ATOMIC_RELEASE);
+}
+
+static int uring_wait(struct bd_uring *context, struct uring_slot *slot)
+{
+    int result = 0;
+
+    while (slot->busy && !slot->done) {
+        int err = uring_enter(context, 1);
+        CHECK_ERROR(err == 0, -1, "uring_enter() failed: %d", err);
+        uring_reap(context);
+    }
+
+done:
+    return result;
+}
+
+static int uring_wait_all(struct bd_uring *context, bool writes_only)
+{
+    int result = 0;
+
+    for (size_t i = 0; i < URING_DEPTH; i++) {
+        struct uring_slot *slot = &context->slots[i];
+        if (slot->busy && (slot->write || !writes_only)) {
+            int err = uring_wait(context, slot);
+            CHECK_ERROR(err == 0, -1, "uring_wait() failed: %d", err);
+        }
+    }
+
+done:
+    return result;
+}
+
+static struct uring_slot *uring_slot_get(struct bd_uring *context)
+{
+    while (true) {
+        for (size_t i = 0; i < URING_DEPTH; i++) {
+            if (!context->slots[i].busy) {
+                struct uring_slot *slot = &context->slots[i];
+                slot->busy = true;
+                slot->done = false;
+                return slot;
+            }
+        }
+
+        // ring is full of progs, wait for any of them
+        if (uring_enter(context, 1) != 0) {
+            return NULL;
+        }
+        uring_reap(context);
+    }
+}
+
+static void uring_queue(struct bd_uring *context, struct uring_slot *slot, bool write, void *buffer,
+                        uint32_t block, uint32_t off, size_t size, off_t offset)
+{
+    unsigned tail = *context->sq_tail;
+    unsigned index = tail & *context->sq_mask;
+    struct io_uring_sqe *sqe = &context->sqes[index];
+
+    slot->write = write;
+    slot->block = block;
+    slot->off = off;
+    slot->size = size;
+    slot->iov.iov_base = buffer;
+    slot->iov.iov_len = size;
+
+    memset(sqe, 0, sizeof(*sqe));
+    sqe->opcode = write ? IORING_OP_WRITEV : IORING_OP_READV;
+    sqe->fd = context->fd;
+    sqe->addr = (uintptr_t)&slot->iov;
+    sqe->len = 1;
+    sqe->off = offset;
+    sqe->user_data = slot - context->slots;
+
+    context->sq_array[index] = index;
+    __atomic_store_n(context->sq_tail, tail + 1, __ATOMIC_RELEASE);
+    context->queued++;
+}
+
+static void uring_readahead_drop(struct bd_uring *context, struct uring_readahead *readahead)
+{
+    if (readahead->slot >= 0) {
+        struct uring_slot *slot = &context->slots[readahead->slot];
+        // the kernel may still be writing into the buffer
+        uring_wait(context, slot);
+        slot->busy = false;
+        readahead->slot = -1;
+    }
+}
+
+static bool uring_write_overlaps(const struct uring_slot *slot, uint32_t block, uint32_t off, size_t size)
+{
+    return slot->busy && slot->write && slot->block == block && off < slot->off + slot->size && slot->off < off + size;
+}
+
+static bool uring_busy_overlap(struct bd_uring *context, uint32_t block, uint32_t off, size_t size)
+{
+    for (size_t i = 0; i < URING_DEPTH; i++) {
+        if (uring_write_overlaps(&context->slots[i], block, off, size)) {
+            return true;
+        }
+    }
+
+    return false;
+}
+
+// The kernel does not order requests, wait for writes touching the range.
+static int uring_wait_overlap(struct bd_uring *context, uint32_t block, uint32_t off, size_t size)
+{
+    int result = 0;
+
+    for (size_t i = 0; i < URING_DEPTH; i++) {
+        struct uring_slot *slot = &context->slots[i];
+        if (uring_write_overlaps(slot, block, off, size)) {
+            int err = uring_wait(context, slot);
+            CHECK_ERROR(err == 0, -1, "uring_wait() failed: %d", err);
+        }
+    }
+
+done:
+    return result;
+}
+
+static int bd_uring_read(struct bd *bd, uint32_t block, uint32_t off, void *buffer, size_t size)
+{
+    int result = 0;
+    struct bd_uring *context = bd->opaque;
+
+    CHECK_ERROR(context->error == 0, context->error, "previous prog failed");
+
+    int err = uring_wait_overlap(context, block, off, size);
+    CHECK_ERROR(err == 0, -1, "uring_wait_overlap() failed: %d", err);
+
+    for (size_t i = 0; i < URING_READAHEAD; i++) {
+        struct uring_readahead *readahead = &context->readahead[i];
+        if (readahead->slot < 0 || readahead->block != block || off < readahead->off) {
+            continue;
+        }
+
+        struct uring_slot *slot = &context->slots[readahead->slot];
+        if (off + size > readahead->off + slot->size) {
+            continue;
+        }
+
+        err = uring_wait(context, slot);
+        CHECK_ERROR(err == 0, -1, "uring_wait() failed: %d", err);
+
+        if (slot->res == (int)slot->size) {
+            memcpy(buffer, slot->buffer + (off - readahead->off), size);
+            goto done;
+        }
+
+        // short or failed, read it again below
+        uring_readahead_drop(context, readahead);
+    }
+
+    struct uring_slot *slot = uring_slot_get(context);
+    CHECK_ERROR(slot != NULL, -1, "uring_slot_get() failed");
+
+    uring_queue(context, slot, false, buffer, block, off, size, (off_t)bd->block_size * block + off);
+
+    // the rest of the block is likely to be read next (log scans, file data);
+    // not while writes to it are in flight, the snapshot could miss them
+    if (off + size < bd->block_size &&
+        !uring_busy_overlap(context, block, off + size, bd->block_size - off - size)) {
+        struct uring_readahead *readahead = &context->readahead[context->readahead_next];
+        context->readahead_next = (context->readahead_next + 1) % URING_READAHEAD;
+
+        uring_readahead_drop(context, readahead);
+
+        struct uring_slot *ahead = uring_slot_get(context);
+        if (ahead != NULL) {
+            readahead->slot = ahead - context->slots;
+            readahead->block = block;
+            readahead->off = off + size;
+            uring_queue(context, ahead, false, ahead->buffer, block, readahead->off,
+                        bd->block_size - readahead->off, (off_t)bd->block_size * block + readahead->off);
+        }
+    }
+
+    err = uring_wait(context, slot);
+    slot->busy = false;
+    CHECK_ERROR(err == 0, -1, "uring_wait() failed: %d", err);
+    CHECK_ERROR(slot->res == (int)size, -1, "read failed: block: %u, off: %u, size: %zu: %d", block, off, size,
+                slot->res);
+
+done:
+    return result;
+}
+
+static void uring_readahead_invalidate(struct bd_uring *context, uint32_t block)
+{
+    for (size_t i = 0; i < URING_READAHEAD; i++) {
+        if (context->readahead[i].slot >= 0 && context->readahead[i].block == block) {
+            uring_readahead_drop(context, &context->readahead[i]);
+        }
+    }
+}
+
+static int uring_write(struct bd *bd, uint32_t block, uint32_t off, const void *buffer, size_t size, bool copy)
+{
+    int result = 0;
+    struct bd_uring *context = bd->opaque;
+
+    CHECK_ERROR(context->error == 0, context->error, "previous prog failed");
+
+    uring_readahead_invalidate(context, block);
+
+    // erases overlap whole blocks, progs never overlap each other
+    int err = uring_wait_overlap(context, block, off, size);
+    CHECK_ERROR(err == 0, -1, "uring_wait_overlap() failed: %d", err);
+
+    struct uring_slot *slot = uring_slot_get(context);
+    CHECK_ERROR(slot != NULL, -1, "uring_slot_get() failed");
+
+    // lfs reuses its buffer as soon as we return
+    void *data = (void *)(uintptr_t)buffer;
+    if (copy) {
+        memcpy(slot->buffer, buffer, size);
+        data = slot->buffer;
+    }
+
+    uring_queue(context, slot, true, data, block, off, size, (off_t)bd->block_size * block + off);
+
+    if (context->queued >= URING_BATCH) {
+        err = uring_enter(context, 0);
+        CHECK_ERROR(err == 0, -1, "uring_enter() failed: %d", err);
+    }
+
+done:
+    return result;
+}
+
+static int bd_uring_prog(struct bd *bd, uint32_t block, uint32_t off, const void *buffer, size_t size)
+{
+    return uring_write(bd, block, off, buffer, size, true);
+}
+
+static int bd_uring_erase(struct bd *bd, uint32_t block)
+{
+    struct bd_uring *context = bd->opaque;
+    return uring_write(bd, block, 0, context->ff, bd->block_size, false);
+}
+
+static int bd_uring_sync(struct bd *bd)
+{
+    int result = 0;
+    struct bd_uring *context = bd->opaque;
+
+    int err = uring_wait_all(context, true);
+    CHECK_ERROR(err == 0, -1, "uring_wait_all() failed: %d", err);
+
+    result = context->error;
+
+done:
+    return result;
+}
+
+static void uring_release(struct bd_uring *context)
+{
+    if (context->sqes != NULL && context->sqes != MAP_FAILED) {
+        munmap(context->sqes, context->sqes_size);
+    }
+    if (context->cq_ring != NULL && context->cq_ring != MAP_FAILED && context->cq_ring != context->sq_ring) {
+        munmap(context->cq_ring, context->cq_ring_size);
+    }
+    if (context->sq_ring != NULL && context->sq_ring != MAP_FAILED) {
+        munmap(context->sq_ring, context->sq_ring_size);
+    }
+    if (context->ring_fd >= 0) {
+        close(context->ring_fd);
+    }
+    if (context->fd >= 0) {
+        close(context->fd);
+    }
+    for (size_t i = 0; i < URING_DEPTH; i++) {
+        free(context->slots[i].buffer);
+    }
+    free(context->ff);
+    free(context);
+}
+
+static int bd_uring_close(struct bd *bd)
+{
+    int result = 0;
+
+    struct bd_uring *context = NULL;
+
+    CHECK_ERROR(bd != NULL, -1, "bd == NULL");
+
+    context = bd->opaque;
+
+    // read-ahead buffers must not be freed under the kernel
+    int err = uring_wait_all(context, false);
+    CHECK_ERROR(err == 0, -1, "uring_wait_all() failed: %d", err);
+
+    result = context->error;
+
+done:
+    if (context != NULL) {
+        uring_release(context);
+        free(bd);
+    }
+    return result;
+}
+
+static int uring_setup(struct bd_uring *context)
+{
+    int result = 0;
+
+    struct io_uring_params params = {0};
+
+    context->ring_fd = syscall(__NR_io_uring_setup, URING_DEPTH, &params);
+    CHECK_ERROR(context->ring_fd >= 0, -1, "io_uring_setup() failed: %s", strerror(errno));
+    CHECK_ERROR(params.sq_entries == URING_DEPTH, -1, "unexpected ring size: %u", params.sq_entries);
+
+    context->sq_ring_size = params.sq_off.array + params.sq_entries * sizeof(unsigned);
+    context->cq_ring_size = params.cq_off.cqes + params.cq_entries * sizeof(struct io_uring_cqe);
+    if (params.features & IORING_FEAT_SINGLE_MMAP) {
+        if (context->cq_ring_size > context->sq_ring_size) {
+            context->sq_ring_size = context->cq_ring_size;
+        }
+        context->cq_ring_size = context->sq_ring_size;
+    }
+
+    context->sq_ring = mmap(NULL, context->sq_ring_size, PROT_READ | PROT_WRITE, MAP_SHARED, context->ring_fd,
+                            IORING_OFF_SQ_RING);
+    CHECK_ERROR(context->sq_ring != MAP_FAILED, -1, "mmap() failed: %s", strerror(errno));
+
+    if (params.features & IORING_FEAT_SINGLE_MMAP) {
+        context->cq_ring = context->sq_ring;
+    } else {
+        context->cq_ring = mmap(NULL, context->cq_ring_size, PROT_READ | PROT_WRITE, MAP_SHARED, context->ring_fd,
+                                IORING_OFF_CQ_RING);
+        CHECK_ERROR(context->cq_ring != MAP_FAILED, -1, "mmap() failed: %s", strerror(errno));
+    }
+
+    context->sqes_size = params.sq_entries * sizeof(struct io_uring_sqe);
+    context->sqes = mmap(NULL, context->sqes_size, PROT_READ | PROT_WRITE, MAP_SHARED, context->ring_fd,
+                         IORING_OFF_SQES);
+    CHECK_ERROR(context->sqes != MAP_FAILED, -1, "mmap() failed: %s", strerror(errno));
+
+    uint8_t *sq = context->sq_ring;
+    uint8_t *cq = context->cq_ring;
+    context->sq_tail = (unsigned *)(void *)(sq + params.sq_off.tail);
+    context->sq_mask = (unsigned *)(void *)(sq + params.sq_off.ring_mask);
+    context->sq_array = (unsigned *)(void *)(sq + params.sq_off.array);
+    context->cq_head = (unsigned *)(void *)(cq + params.cq_off.head);
+    context->cq_tail = (unsigned *)(void *)(cq + params.cq_off.tail);
+    context->cq_mask = (unsigned *)(void *)(cq + params.cq_off.ring_mask);
+    context->cqes = (struct io_uring_cqe *)(void *)(cq + params.cq_off.cqes);
+
+done:
+    return result;
+}
+
+struct bd *bd_uring_open(const char *image, bool write, size_t block_size, size_t block_count)
+{
+    struct bd *result = NULL;
+
+    struct bd *bd = NULL;
+    struct bd_uring *context = NULL;
+
+    bd = calloc(1, sizeof(*bd));
+    CHECK_ERROR(bd != NULL, NULL, "calloc() failed");
+
+    context = calloc(1, sizeof(*context));
+    CHECK_ERROR(context != NULL, NULL, "calloc() failed");
+
+    context->fd = -1;
+    context->ring_fd = -1;
+    for (size_t i = 0; i < URING_READAHEAD; i++) {
+        context->readahead[i].slot = -1;
+    }
+
+    int err = uring_setup(context);
+    CHECK_ERROR(err == 0, NULL, "uring_setup() failed: %d", err);
+
+    context->ff = malloc(block_size);
+    CHECK_ERROR(context->ff != NULL, NULL, "malloc() failed");
+    memset(context->ff, 0xff, block_size);
+
+    for (size_t i = 0; i < URING_DEPTH; i++) {
+        context->slots[i].buffer = malloc(block_size);
+        CHECK_ERROR(context->slots[i].buffer != NULL, NULL, "malloc() failed");
+    }
+
+    context->fd = open(image, write ? O_RDWR | O_CREAT | O_TRUNC : O_RDONLY,
+                       S_IRUSR | S_IWUSR | S_IRGRP | S_IWGRP | S_IROTH | S_IWOTH);
+    CHECK_ERROR(context->fd >= 0, NULL, "open() failed: %s", strerror(errno));
+
+    if (write) {
+        // the image starts as one big hole, see bd_erased
+        err = ftruncate(context->fd, (off_t)block_size * block_count);
+        CHECK_ERROR(err == 0, NULL, "ftruncate() failed: %s", strerror(errno));
+    }
+
+    bd->opaque = context;
+    bd->block_size = block_size;
+    bd->block_count = block_count;
+    bd->read = bd_uring_read;
+    bd->prog = bd_uring_prog;
+    bd->erase = bd_uring_erase;
+    bd->sync = bd_uring_sync;
+    bd->close = bd_uring_close;
+
+    result = bd;
+
+done:
+    if (result == NULL) {
+        if (context != NULL) {
+            uring_release(context);
+        }
+        free(bd);
+    }
+    return result;
+}
+
+#else
+
+struct bd *bd_uring_open(const char *image, bool write, size_t block_size, size_t block_count)
+{
+    ERROR("io_uring is not supported on this platform");
+    return NULL;
+}
+
+#endif
@@ -0,0 +1,198 @@
+/**
+ * Copyright 2019 Sergey Tyultyaev
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include "bd_wear.h"
+
+#include <errno.h>
+#include <inttypes.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "macro.h"
+
+struct bd_wear
+{
+    struct bd *lower;
+    const char *path;
+    uint32_t *erases;
+    uint32_t *progs;
+};
+
+static int bd_wear_read(struct bd *bd, uint32_t block, uint32_t off, void *buffer, size_t size)
+{
+    struct bd_wear *context = bd->opaque;
+    return context->lower->read(context->lower, block, off, buffer, size);
+}
+
+static int bd_wear_prog(struct bd *bd, uint32_t block, uint32_t off, const void *buffer, size_t size)
+{
+    struct bd_wear *context = bd->opaque;
+    if (block < bd->block_count) {
+        context->progs[block]++;
+    }
+    return context->lower->prog(context->lower, block, off, buffer, size);
+}
+
+static int bd_wear_erase(struct bd *bd, uint32_t block)
+{
+    struct bd_wear *context = bd->opaque;
+    if (block < bd->block_count) {
+        context->erases[block]++;
+    }
+    return context->lower->erase(context->lower, block);
+}
+
+static int bd_wear_sync(struct bd *bd)
+{
+    struct bd_wear *context = bd->opaque;
+    return context->lower->sync(context->lower);
+}
+
+static bool is_json(const char *path)
+{
+    size_t len = strlen(path);
+    return len >= 5 && strcmp(path + len - 5, ".json") == 0;
+}
+
+static void wear_write_array(FILE *file, const uint32_t *counters, size_t count)
+{
+    fprintf(file, "[");
+    for (size_t i = 0; i < count; i++) {
+        fprintf(file, "%s%" PRIu32, i == 0 ? "" : ",", counters[i]);
+    }
+    fprintf(file, "]");
+}
+
+static int wear_write(struct bd *bd)
+{
+    int result = 0;
+
+    struct bd_wear *context = bd->opaque;
+    FILE *file = NULL;
+
+    uint64_t erases = 0;
+    uint32_t max = 0;
+    size_t used = 0;
+    for (size_t i = 0; i < bd->block_count; i++) {
+        erases += context->erases[i];
+        if (context->erases[i] > max) {
+            max = context->erases[i];
+        }
+        if (context->erases[i] != 0) {
+            used++;
+        }
+    }
+
+    INFO("wear: erases: %" PRIu64 ", blocks erased: %zu of %zu, max erases per block: %" PRIu32, erases, used,
+         bd->block_count, max);
+
+    file = fopen(context->path, "w");
+    CHECK_ERROR(file != NULL, -1, "fopen(%s) failed: %s", context->path, strerror(errno));
+
+    if (is_json(context->path)) {
+        fprintf(file, "{\"block_size\": %zu, \"block_count\": %zu,\n \"erases\": ", bd->block_size, bd->block_count);
+        wear_write_array(file, context->erases, bd->block_count);
+        fprintf(file, ",\n \"progs\": ");
+        wear_write_array(file, context->progs, bd->block_count);
+        fprintf(file, "}\n");
+    } else {
+        fprintf(file, "block,erases,progs\n");
+        for (size_t i = 0; i < bd->block_count; i++) {
+            fprintf(file, "%zu,%" PRIu32 ",%" PRIu32 "\n", i, context->erases[i], context->progs[i]);
+        }
+    }
+
+    CHECK_ERROR(ferror(file) == 0, -1, "fprintf() failed: %s", strerror(errno));
+
+done:
+    if (file != NULL && fclose(file) != 0) {
+        ERROR("fclose() failed: %s", strerror(errno));
+        result = -1;
+    }
+    return result;
+}
+
+static int bd_wear_close(struct bd *bd)
+{
+    int result = 0;
+
+    CHECK_ERROR(bd != NULL, -1, "bd == NULL");
+
+    struct bd_wear *context = bd->opaque;
+
+    if (wear_write(bd) != 0) {
+        result = -1;
+    }
+
+    if (context->lower->close(context->lower) != 0) {
+        result = -1;
+    }
+
+    free(context->erases);
+    free(context->progs);
+    free(context);
+    free(bd);
+
+done:
+    return result;
+}
+
+struct bd *bd_wear_open(struct bd *lower, const char *path)
+{
+    struct bd *result = NULL;
+
+    struct bd *bd = NULL;
+    struct bd_wear *context = NULL;
+
+    CHECK_ERROR(lower != NULL, NULL, "lower == NULL");
+    CHECK_ERROR(path != NULL, NULL, "path == NULL");
+
+    bd = calloc(1, sizeof(*bd));
+    CHECK_ERROR(bd != NULL, NULL, "calloc() failed");
+
+    context = calloc(1, sizeof(*context));
+    CHECK_ERROR(context != NULL, NULL, "calloc() failed");
+
+    context->erases = calloc(lower->block_count, sizeof(*context->erases));
+    context->progs = calloc(lower->block_count, sizeof(*context->progs));
+    CHECK_ERROR(context->erases != NULL && context->progs != NULL, NULL, "calloc() failed");
+
+    context->lower = lower;
+    context->path = path;
+
+    bd->opaque = context;
+    bd->block_size = lower->block_size;
+    bd->block_count = lower->block_count;
+    bd->read = bd_wear_read;
+    bd->prog = bd_wear_prog;
+    bd->erase = bd_wear_erase;
+    bd->sync = bd_wear_sync;
+    bd->close = bd_wear_close;
+
+    result = bd;
+
+done:
+    if (result == NULL) {
+        if (context != NULL) {
+            free(context->erases);
+            free(context->progs);
+        }
+        free(context);
+        free(bd);
+    }
+    return result;
+}
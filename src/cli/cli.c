@@ -16,6 +16,9 @@ static cli_cmd_t g_cmds[CLI_CMD_MAX];
 
 static pthread_mutex_t mutex;
 
+// argument of cli_main(), the filesystem commands work on
+static void *g_arg;
+
 static void register_cmds(void);
 
 int cli_register_cmds(cli_cmd_t *cmds, int cnt)
@@ -58,8 +61,14 @@ int cli_unregister_cmds(cli_cmd_t *cmds, int cnt)
 }
 
 
+void *cli_arg(void)
+{
+    return g_arg;
+}
+
 int cli_main(void *arg)
 {
+    g_arg = arg;
 
     pthread_mutex_init(&mutex, NULL);
 
@@ -73,7 +82,7 @@ int cli_main(void *arg)
     char cmd_buf[CMD_SIZE+1];
     int cmd_buf_index = 0;
     memset(cmd_buf, 0, sizeof(cmd_buf));
-    while (scanf("%c", &c)) {
+    while (scanf("%c", &c) == 1) {
         if (c != '\n') {
             cmd_buf[cmd_buf_index++] = c;
             if (cmd_buf_index < CMD_SIZE) {
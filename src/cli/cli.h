@@ -13,6 +13,9 @@ int cli_register_cmds(cli_cmd_t *cmds, int cnt);
 
 int cli_unregister_cmds(cli_cmd_t *cmds, int cnt);
 
+// The argument cli_main() was started with, the vfs commands operate on.
+void *cli_arg(void);
+
 
 #endif // CLI_H
 
@@ -55,10 +55,11 @@ static int func_ls(int argc, char **argv)
 	}
 #endif
 
+	struct vfs *vfs = cli_arg();
 	struct stat s;
 	int ret;
 	char *path = str_cwd;
-	if (ret = vfs_stat(NULL, path, &s)) {
+	if (ret = vfs_stat(vfs, path, &s)) {
 		printf("stat %s error, errno %d\r\n", path, ret);
 	}
 
@@ -67,13 +68,13 @@ static int func_ls(int argc, char **argv)
 	} else {
 		void *dir;
 		struct vfs_dirent *dirent = NULL;
-		dir = vfs_opendir(NULL, path);
+		dir = vfs_opendir(vfs, path);
 		if (!dir) {
 			printf("opendir %s failed\r\n", path);
 			return -1;
 		}
 
-    	while ((dirent = vfs_readdir(NULL, dir)) != NULL) {
+    	while ((dirent = vfs_readdir(vfs, dir)) != NULL) {
 			if (dirent->type == VFS_TYPE_END) {
 				break;
 			}
@@ -82,12 +83,14 @@ static int func_ls(int argc, char **argv)
 			memset(temp_path, 0, sizeof(temp_path));
 			strncpy(temp_path, path, len);
 			strcat(temp_path, dirent->name);
-			if (ret = vfs_stat(NULL, temp_path, &s)) {
+			if (ret = vfs_stat(vfs, temp_path, &s)) {
 				printf("stat %s error, errno %d\r\n", temp_path, ret);
 			} else {
 				print_file(dirent->name, 0, &s);
 			}
 		}
+
+		vfs_closedir(vfs, dir);
 	}
 
 	return 0;
@@ -24,51 +24,148 @@ static inline void lfs_cache_zero(lfs_t *lfs, lfs_cache_t *pcache) {
     pcache->block = LFS_BLOCK_NULL;
 }
 
-static int lfs_bd_read(lfs_t *lfs,
-        const lfs_cache_t *pcache, lfs_cache_t *rcache, lfs_size_t hint,
-        lfs_block_t block, lfs_off_t off,
-        void *buffer, lfs_size_t size) {
-    uint8_t *data = buffer;
-    LFS_ASSERT(block != LFS_BLOCK_NULL);
-    if (off+size > lfs->cfg->block_size) {
-        return LFS_ERR_CORRUPT;
+// Set of ways holding the line at off in block, lines of a block go to
+// consecutive sets and blocks are spread over the rest
+static struct lfs_lcache_line *lfs_lcache_set(lfs_t *lfs,
+        lfs_block_t block, lfs_off_t off) {
+    uint32_t set = (block*0x9e3779b1 + off/lfs->lcache.size)
+            % lfs->cfg->read_cache_sets;
+    return &lfs->lcache.lines[set*lfs->cfg->read_cache_ways];
+}
+
+// Forgets lines overlapping a region that was programmed or erased
+static void lfs_lcache_drop(lfs_t *lfs,
+        lfs_block_t block, lfs_off_t off, lfs_size_t size) {
+    if (!lfs->lcache.lines) {
+        return;
     }
 
-    while (size > 0) {
-        lfs_size_t diff = size;
+    for (lfs_off_t loff = lfs_aligndown(off, lfs->lcache.size);
+            loff < off+size; loff += lfs->lcache.size) {
+        struct lfs_lcache_line *set = lfs_lcache_set(lfs, block, loff);
+        for (lfs_size_t i = 0; i < lfs->cfg->read_cache_ways; i++) {
+            if (set[i].block == block && set[i].off == loff) {
+                set[i].block = LFS_BLOCK_NULL;
+                set[i].used = 0;
+            }
+        }
+    }
+}
+
+// Makes fetched metadata pairs that include a programmed or erased block
+// stale, and has the name index of its directory recheck it
+static void lfs_mcache_drop(lfs_t *lfs, lfs_block_t block) {
+    if (lfs->mcache.writes) {
+        lfs->mcache.writes[block] += 1;
+    }
+
+    if (lfs->nindex.owners && lfs->nindex.owners[block]) {
+        struct lfs_ndir *ndir = &lfs->nindex.dirs[lfs->nindex.owners[block]-1];
+        lfs_size_t pos = lfs->nindex.positions[block];
+        for (lfs_size_t i = 0; i < ndir->dirtycount; i++) {
+            if (i == LFS_NINDEX_DIRTY || ndir->dirty[i] == pos) {
+                return;
+            }
+        }
+
+        if (ndir->dirtycount < LFS_NINDEX_DIRTY) {
+            ndir->dirty[ndir->dirtycount] = pos;
+        }
+        ndir->dirtycount += 1;
+    }
+}
+
+// Points view at off in the line cache, reading the line into the least
+// recently used way of its set if needed
+static int lfs_lcache_view(lfs_t *lfs,
+        lfs_block_t block, lfs_off_t off, lfs_size_t size,
+        const uint8_t **view, lfs_size_t *diff) {
+    lfs_off_t loff = lfs_aligndown(off, lfs->lcache.size);
+    struct lfs_lcache_line *set = lfs_lcache_set(lfs, block, loff);
+    struct lfs_lcache_line *line = NULL;
+
+    for (lfs_size_t i = 0; i < lfs->cfg->read_cache_ways; i++) {
+        if (set[i].block == block && set[i].off == loff) {
+            line = &set[i];
+            lfs->lcache.hits += 1;
+            break;
+        }
+
+        if (!line || set[i].used < line->used) {
+            line = &set[i];
+        }
+    }
+
+    uint8_t *buffer = &lfs->lcache.buffer[
+            (line - lfs->lcache.lines) * lfs->lcache.size];
+
+    if (line->block != block || line->off != loff) {
+        LFS_ASSERT(block < lfs->cfg->block_count);
+        line->block = LFS_BLOCK_NULL;
+        line->used = 0;
+        int err = lfs->cfg->read(lfs->cfg, block,
+                loff, buffer, lfs->lcache.size);
+        LFS_ASSERT(err <= 0);
+        if (err) {
+            return err;
+        }
+
+        lfs->lcache.misses += 1;
+        line->block = block;
+        line->off = loff;
+    }
+
+    lfs->lcache.clock += 1;
+    line->used = lfs->lcache.clock;
+
+    *view = &buffer[off-loff];
+    *diff = lfs_min(size, lfs->lcache.size - (off-loff));
+    return 0;
+}
+
+// Finds off in pcache or rcache, loading rcache if needed, and points
+// view at the bytes cached there, at most size of them
+static int lfs_bd_view(lfs_t *lfs,
+        const lfs_cache_t *pcache, lfs_cache_t *rcache, lfs_size_t hint,
+        lfs_block_t block, lfs_off_t off, lfs_size_t size,
+        const uint8_t **view, lfs_size_t *diff) {
+    bool loaded = false;
+    while (true) {
+        lfs_size_t avail = size;
 
         if (pcache && block == pcache->block &&
                 off < pcache->off + pcache->size) {
             if (off >= pcache->off) {
                 // is already in pcache?
-                diff = lfs_min(diff, pcache->size - (off-pcache->off));
-                memcpy(data, &pcache->buffer[off-pcache->off], diff);
-
-                data += diff;
-                off += diff;
-                size -= diff;
-                continue;
+                lfs->lcache.hits += 1;
+                *view = &pcache->buffer[off-pcache->off];
+                *diff = lfs_min(avail, pcache->size - (off-pcache->off));
+                return 0;
             }
 
             // pcache takes priority
-            diff = lfs_min(diff, pcache->off-off);
+            avail = lfs_min(avail, pcache->off-off);
         }
 
         if (block == rcache->block &&
                 off < rcache->off + rcache->size) {
             if (off >= rcache->off) {
                 // is already in rcache?
-                diff = lfs_min(diff, rcache->size - (off-rcache->off));
-                memcpy(data, &rcache->buffer[off-rcache->off], diff);
-
-                data += diff;
-                off += diff;
-                size -= diff;
-                continue;
+                if (!loaded) {
+                    lfs->lcache.hits += 1;
+                }
+                *view = &rcache->buffer[off-rcache->off];
+                *diff = lfs_min(avail, rcache->size - (off-rcache->off));
+                return 0;
             }
 
             // rcache takes priority
-            diff = lfs_min(diff, rcache->off-off);
+            avail = lfs_min(avail, rcache->off-off);
+        }
+
+        if (lfs->lcache.lines) {
+            // the line cache takes the place of reloading rcache
+            return lfs_lcache_view(lfs, block, off, avail, view, diff);
         }
 
         // load to cache, first condition can no longer fail
@@ -87,6 +184,36 @@ static int lfs_bd_read(lfs_t *lfs,
         if (err) {
             return err;
         }
+
+        lfs->lcache.misses += 1;
+        loaded = true;
+    }
+}
+
+static int lfs_bd_read(lfs_t *lfs,
+        const lfs_cache_t *pcache, lfs_cache_t *rcache, lfs_size_t hint,
+        lfs_block_t block, lfs_off_t off,
+        void *buffer, lfs_size_t size) {
+    uint8_t *data = buffer;
+    LFS_ASSERT(block != LFS_BLOCK_NULL);
+    if (off+size > lfs->cfg->block_size) {
+        return LFS_ERR_CORRUPT;
+    }
+
+    while (size > 0) {
+        const uint8_t *view;
+        lfs_size_t diff;
+        int err = lfs_bd_view(lfs, pcache, rcache, hint,
+                block, off, size, &view, &diff);
+        if (err) {
+            return err;
+        }
+
+        memcpy(data, view, diff);
+
+        data += diff;
+        off += diff;
+        size -= diff;
     }
 
     return 0;
@@ -103,19 +230,27 @@ static int lfs_bd_cmp(lfs_t *lfs,
         lfs_block_t block, lfs_off_t off,
         const void *buffer, lfs_size_t size) {
     const uint8_t *data = buffer;
+    LFS_ASSERT(block != LFS_BLOCK_NULL);
+    if (off+size > lfs->cfg->block_size) {
+        return LFS_ERR_CORRUPT;
+    }
 
-    for (lfs_off_t i = 0; i < size; i++) {
-        uint8_t dat;
-        int err = lfs_bd_read(lfs,
-                pcache, rcache, hint-i,
-                block, off+i, &dat, 1);
+    // compare whatever is cached in one go instead of reading byte by byte
+    for (lfs_off_t i = 0; i < size;) {
+        const uint8_t *view;
+        lfs_size_t diff;
+        int err = lfs_bd_view(lfs, pcache, rcache, hint-i,
+                block, off+i, size-i, &view, &diff);
         if (err) {
             return err;
         }
 
-        if (dat != data[i]) {
-            return (dat < data[i]) ? LFS_CMP_LT : LFS_CMP_GT;
+        int res = memcmp(view, &data[i], diff);
+        if (res != 0) {
+            return (res < 0) ? LFS_CMP_LT : LFS_CMP_GT;
         }
+
+        i += diff;
     }
 
     return LFS_CMP_EQ;
@@ -133,6 +268,9 @@ static int lfs_bd_flush(lfs_t *lfs,
             return err;
         }
 
+        lfs_lcache_drop(lfs, pcache->block, pcache->off, diff);
+        lfs_mcache_drop(lfs, pcache->block);
+
         if (validate) {
             // check data on disk
             lfs_cache_drop(lfs, rcache);
@@ -216,6 +354,8 @@ static int lfs_bd_prog(lfs_t *lfs,
 
 static int lfs_bd_erase(lfs_t *lfs, lfs_block_t block) {
     LFS_ASSERT(block < lfs->cfg->block_count);
+    lfs_lcache_drop(lfs, block, 0, lfs->cfg->block_size);
+    lfs_mcache_drop(lfs, block);
     int err = lfs->cfg->erase(lfs->cfg, block);
     LFS_ASSERT(err <= 0);
     return err;
@@ -430,10 +570,21 @@ static int lfs1_traverse(lfs_t *lfs,
 #endif
 
 /// Block allocator ///
+// Whole-image mode, the lookahead covers every block. The window never
+// slides: one traversal fills it, blocks are marked as they are handed out,
+// and the tree is traversed again only after every block has been scanned,
+// which is also when blocks freed in the meantime are picked up (there is no
+// hook for frees). Filling an image takes a single traversal instead of one
+// per 8*lookahead_size blocks.
+static inline bool lfs_alloc_full(lfs_t *lfs) {
+    return 8*lfs->cfg->lookahead_size >= lfs->cfg->block_count;
+}
+
 static int lfs_alloc_lookahead(void *p, lfs_block_t block) {
     lfs_t *lfs = (lfs_t*)p;
-    lfs_block_t off = ((block - lfs->free.off)
-            + lfs->cfg->block_count) % lfs->cfg->block_count;
+    lfs_block_t off = (block >= lfs->free.off)
+            ? block - lfs->free.off
+            : block + lfs->cfg->block_count - lfs->free.off;
 
     if (off < lfs->free.size) {
         lfs->free.buffer[off / 32] |= 1U << (off % 32);
@@ -442,28 +593,52 @@ static int lfs_alloc_lookahead(void *p, lfs_block_t block) {
     return 0;
 }
 
+// Returns the first clear bit of the lookahead at or after off, or
+// free.size. Whole words of used blocks are skipped at once.
+static lfs_block_t lfs_alloc_scan(lfs_t *lfs, lfs_block_t off) {
+    while (off < lfs->free.size) {
+        uint32_t mask = ~lfs->free.buffer[off / 32] & (0xffffffff << (off % 32));
+        if (mask) {
+            return lfs_min((off & ~(lfs_block_t)31) + lfs_ctz(mask),
+                    lfs->free.size);
+        }
+
+        off = (off & ~(lfs_block_t)31) + 32;
+    }
+
+    return lfs->free.size;
+}
+
+// Moves free.i to off, every block passed over counts against the ack.
+static void lfs_alloc_skip(lfs_t *lfs, lfs_block_t off) {
+    lfs->free.ack -= off - lfs->free.i;
+    lfs->free.i = off;
+}
+
 static int lfs_alloc(lfs_t *lfs, lfs_block_t *block) {
     while (true) {
-        while (lfs->free.i != lfs->free.size) {
+        lfs_alloc_skip(lfs, lfs_alloc_scan(lfs, lfs->free.i));
+
+        if (lfs->free.i != lfs->free.size) {
             lfs_block_t off = lfs->free.i;
-            lfs->free.i += 1;
-            lfs->free.ack -= 1;
-
-            if (!(lfs->free.buffer[off / 32] & (1U << (off % 32)))) {
-                // found a free block
-                *block = (lfs->free.off + off) % lfs->cfg->block_count;
-
-                // eagerly find next off so an alloc ack can
-                // discredit old lookahead blocks
-                while (lfs->free.i != lfs->free.size &&
-                        (lfs->free.buffer[lfs->free.i / 32]
-                            & (1U << (lfs->free.i % 32)))) {
-                    lfs->free.i += 1;
-                    lfs->free.ack -= 1;
-                }
+            lfs_alloc_skip(lfs, off + 1);
 
-                return 0;
+            // found a free block, free.off and off are both below
+            // block_count so a subtraction replaces the modulo
+            *block = lfs->free.off + off;
+            if (*block >= lfs->cfg->block_count) {
+                *block -= lfs->cfg->block_count;
+            }
+
+            if (lfs_alloc_full(lfs)) {
+                lfs->free.buffer[off / 32] |= 1U << (off % 32);
             }
+
+            // eagerly find next off so an alloc ack can
+            // discredit old lookahead blocks
+            lfs_alloc_skip(lfs, lfs_alloc_scan(lfs, lfs->free.i));
+
+            return 0;
         }
 
         // check if we have looked at all blocks since last ack
@@ -493,6 +668,259 @@ static void lfs_alloc_ack(lfs_t *lfs) {
 
 
 /// Metadata pair and directory operations ///
+// Set of ways that may hold pair, found by its lower block
+static struct lfs_mcache_entry *lfs_mcache_set(lfs_t *lfs,
+        const lfs_block_t pair[2]) {
+    // Fibonacci hashing, the high bits pick the set as pairs are
+    // often allocated at neighbouring blocks
+    uint32_t hash = lfs_min(pair[0], pair[1])*0x9e3779b1;
+    uint32_t set = ((uint64_t)hash*lfs->mcache.sets) >> 32;
+    return &lfs->mcache.entries[set*LFS_MCACHE_WAYS];
+}
+
+static bool lfs_mcache_fresh(lfs_t *lfs,
+        const struct lfs_mcache_entry *entry) {
+    return entry->writes[0] == lfs->mcache.writes[entry->m.pair[0]] &&
+            entry->writes[1] == lfs->mcache.writes[entry->m.pair[1]];
+}
+
+// Empties an mdir cache entry along with its tag index
+static void lfs_mcache_clear(struct lfs_mcache_entry *entry) {
+    lfs_free(entry->tags);
+    entry->tags = NULL;
+    entry->ids = NULL;
+    entry->unindexed = false;
+    entry->used = 0;
+}
+
+// Fetched pair in the mdir cache, in either order, or NULL
+static struct lfs_mcache_entry *lfs_mcache_find(lfs_t *lfs,
+        const lfs_block_t pair[2]) {
+    if (!lfs->mcache.entries ||
+            pair[0] >= lfs->cfg->block_count ||
+            pair[1] >= lfs->cfg->block_count) {
+        return NULL;
+    }
+
+    struct lfs_mcache_entry *set = lfs_mcache_set(lfs, pair);
+    for (int i = 0; i < LFS_MCACHE_WAYS; i++) {
+        if (set[i].used && lfs_pair_sync(set[i].m.pair, pair)) {
+            if (!lfs_mcache_fresh(lfs, &set[i])) {
+                lfs_mcache_clear(&set[i]);
+                return NULL;
+            }
+
+            return &set[i];
+        }
+    }
+
+    return NULL;
+}
+
+// Keeps a fetched pair in place of an older copy of it or of the least
+// recently used pair of its set
+static void lfs_mcache_insert(lfs_t *lfs,
+        const lfs_mdir_t *dir, uint32_t seed, lfs_size_t tagcount) {
+    if (!lfs->mcache.entries) {
+        return;
+    }
+
+    struct lfs_mcache_entry *set = lfs_mcache_set(lfs, dir->pair);
+    struct lfs_mcache_entry *victim = &set[0];
+    for (int i = 0; i < LFS_MCACHE_WAYS; i++) {
+        if (set[i].used && lfs_pair_sync(set[i].m.pair, dir->pair)) {
+            victim = &set[i];
+            break;
+        }
+
+        if (set[i].used < victim->used) {
+            victim = &set[i];
+        }
+    }
+
+    lfs_mcache_clear(victim);
+    lfs->mcache.clock += 1;
+    victim->m = *dir;
+    victim->seed = seed;
+    victim->writes[0] = lfs->mcache.writes[dir->pair[0]];
+    victim->writes[1] = lfs->mcache.writes[dir->pair[1]];
+    victim->used = lfs->mcache.clock;
+    victim->tagcount = tagcount;
+}
+
+#define LFS_MTAG_NULL 0xffff
+
+// Indexes the tags of a cached pair. Ids are tracked as slots that splices
+// insert into and remove from the list of ids, so every tag ends up on the
+// list of the id it has after the last commit, and tags of deleted ids on
+// none.
+static int lfs_mcache_build(lfs_t *lfs, struct lfs_mcache_entry *entry) {
+    const lfs_size_t idlimit = 0x3ff;
+    if (entry->tagcount + 2*idlimit >= LFS_MTAG_NULL) {
+        return LFS_ERR_NOSPC;
+    }
+
+    entry->tags = lfs_malloc(entry->tagcount*sizeof(struct lfs_mtag)
+            + idlimit*sizeof(uint16_t));
+    // slot of each id, then id of each slot
+    uint16_t *slots = lfs_malloc(
+            (idlimit + entry->tagcount + idlimit)*sizeof(uint16_t));
+    if (!entry->tags || !slots) {
+        lfs_free(slots);
+        return LFS_ERR_NOMEM;
+    }
+    entry->ids = (uint16_t*)&entry->tags[entry->tagcount];
+
+    lfs_size_t count = 0;
+    uint16_t nslots = 0;
+    lfs_size_t idcount = 0;
+    lfs_off_t off = 0;
+    lfs_tag_t ptag = LFS_BLOCK_NULL;
+    for (lfs_size_t i = 0; i < entry->tagcount; i++) {
+        off += lfs_tag_dsize(ptag);
+        lfs_tag_t tag;
+        int err = lfs_bd_read(lfs,
+                NULL, &lfs->rcache, lfs->cfg->block_size,
+                entry->m.pair[0], off, &tag, sizeof(tag));
+        if (err) {
+            lfs_free(slots);
+            return err;
+        }
+
+        tag = lfs_frombe32(tag) ^ ptag;
+        ptag = tag;
+        if (lfs_tag_type1(tag) == LFS_TYPE_CRC) {
+            // reset the next bit if we need to
+            ptag ^= (lfs_tag_t)(lfs_tag_chunk(tag) & 1U) << 31;
+        }
+
+        uint16_t id = lfs_tag_id(tag);
+        uint16_t slot = LFS_MTAG_NULL;
+        if (id != 0x3ff) {
+            // ids past the end are implied
+            lfs_size_t end = id + (lfs_tag_type1(tag) != LFS_TYPE_SPLICE ||
+                    lfs_tag_splice(tag) < 0);
+            if (end >= idlimit) {
+                lfs_free(slots);
+                return LFS_ERR_NOSPC;
+            }
+
+            for (; idcount < end; idcount++) {
+                slots[idcount] = nslots++;
+            }
+            entry->idmax = lfs_max(entry->idmax, idcount);
+
+            if (lfs_tag_type1(tag) != LFS_TYPE_SPLICE) {
+                slot = slots[id];
+            } else if (lfs_tag_splice(tag) > 0) {
+                if (idcount + 1 >= idlimit) {
+                    lfs_free(slots);
+                    return LFS_ERR_NOSPC;
+                }
+
+                memmove(&slots[id+1], &slots[id],
+                        (idcount-id)*sizeof(uint16_t));
+                slots[id] = nslots++;
+                idcount += 1;
+                entry->idmax = lfs_max(entry->idmax, idcount);
+            } else if (lfs_tag_splice(tag) < 0) {
+                memmove(&slots[id], &slots[id+1],
+                        (idcount-id-1)*sizeof(uint16_t));
+                idcount -= 1;
+            }
+        }
+
+        entry->tags[count].tag = tag;
+        entry->tags[count].off = off;
+        entry->tags[count].next = slot;
+        count += 1;
+
+        if (off + lfs_tag_dsize(tag) >= entry->m.off) {
+            break;
+        }
+    }
+
+    // map slots back to the ids they ended up with
+    uint16_t *ids = &slots[idlimit];
+    memset(ids, 0xff, nslots*sizeof(uint16_t));
+    for (lfs_size_t id = 0; id < idcount; id++) {
+        ids[slots[id]] = id;
+    }
+
+    memset(entry->ids, 0xff, idcount*sizeof(uint16_t));
+    for (lfs_size_t i = 0; i < count; i++) {
+        uint16_t slot = entry->tags[i].next;
+        entry->tags[i].next = LFS_MTAG_NULL;
+        if (slot != LFS_MTAG_NULL && ids[slot] != LFS_MTAG_NULL) {
+            entry->tags[i].next = entry->ids[ids[slot]];
+            entry->ids[ids[slot]] = i;
+        }
+    }
+
+    entry->tagcount = count;
+    entry->idcount = idcount;
+    lfs_free(slots);
+    return 0;
+}
+
+// Tag index of a cached pair with the same log as dir, or NULL
+static const struct lfs_mcache_entry *lfs_mcache_index(lfs_t *lfs,
+        const lfs_mdir_t *dir) {
+    struct lfs_mcache_entry *entry = lfs_mcache_find(lfs, dir->pair);
+    if (!entry || entry->m.pair[0] != dir->pair[0] ||
+            entry->m.off != dir->off || entry->m.etag != dir->etag) {
+        return NULL;
+    }
+
+    if (!entry->tags && !entry->unindexed) {
+        entry->idmax = 0;
+        int err = lfs_mcache_build(lfs, entry);
+        if (err) {
+            // leave it to the scan
+            lfs_free(entry->tags);
+            entry->tags = NULL;
+            entry->ids = NULL;
+            entry->unindexed = true;
+        }
+    }
+
+    return entry->tags ? entry : NULL;
+}
+
+// Newest tag matching gtag the way the scan in lfs_dir_getslice matches
+// it, LFS_ERR_NOENT if there is none, LFS_ERR_INVAL if the index cannot
+// tell
+static int lfs_mcache_get(const struct lfs_mcache_entry *entry,
+        lfs_tag_t gmask, lfs_tag_t gtag) {
+    uint16_t idmask = lfs_tag_id(gmask);
+    if (idmask == 0) {
+        // ids are neither compared nor moved around splices
+        for (lfs_size_t i = entry->tagcount; i-- > 0;) {
+            if ((gmask & entry->tags[i].tag) == (gmask & gtag)) {
+                return i;
+            }
+        }
+
+        return LFS_ERR_NOENT;
+    }
+
+    uint16_t id = lfs_tag_id(gtag);
+    if ((idmask & (idmask+1)) != 0 || entry->idmax > idmask ||
+            id >= entry->idcount) {
+        return LFS_ERR_INVAL;
+    }
+
+    gmask &= ~LFS_MKTAG(0, 0x3ff, 0);
+    for (uint16_t i = entry->ids[id]; i != LFS_MTAG_NULL;
+            i = entry->tags[i].next) {
+        if ((gmask & entry->tags[i].tag) == (gmask & gtag)) {
+            return i;
+        }
+    }
+
+    return LFS_ERR_NOENT;
+}
+
 static lfs_stag_t lfs_dir_getslice(lfs_t *lfs, const lfs_mdir_t *dir,
         lfs_tag_t gmask, lfs_tag_t gtag,
         lfs_off_t goff, void *gbuffer, lfs_size_t gsize) {
@@ -506,6 +934,41 @@ static lfs_stag_t lfs_dir_getslice(lfs_t *lfs, const lfs_mdir_t *dir,
         gdiff -= LFS_MKTAG(0, 1, 0);
     }
 
+    // a pair fetched into the mdir cache has its tags indexed
+    const struct lfs_mcache_entry *entry = lfs_mcache_index(lfs, dir);
+    int i = entry ? lfs_mcache_get(entry, gmask, gtag - gdiff)
+                  : LFS_ERR_INVAL;
+    if (i != LFS_ERR_INVAL) {
+        lfs->mcache.indexed += 1;
+        if (i < 0) {
+            return i;
+        }
+
+        lfs_tag_t tag = entry->tags[i].tag;
+        if (lfs_tag_isdelete(tag)) {
+            return LFS_ERR_NOENT;
+        }
+
+        lfs_size_t diff = lfs_min(lfs_tag_size(tag), gsize);
+        int err = lfs_bd_read(lfs,
+                NULL, &lfs->rcache, diff,
+                dir->pair[0], entry->tags[i].off+sizeof(tag)+goff,
+                gbuffer, diff);
+        if (err) {
+            return err;
+        }
+
+        memset((uint8_t*)gbuffer + diff, 0, gsize - diff);
+
+        if (lfs_tag_id(gmask) == 0) {
+            return tag + gdiff;
+        }
+
+        // the id gtag asked for, whatever the tag had when written
+        return (tag & ~LFS_MKTAG(0, 0x3ff, 0)) |
+                (gtag & LFS_MKTAG(0, 0x3ff, 0));
+    }
+
     // iterate over dir block backwards (for faster lookups)
     while (off >= sizeof(lfs_tag_t) + lfs_tag_dsize(ntag)) {
         off -= lfs_tag_dsize(ntag);
@@ -638,6 +1101,7 @@ static int lfs_dir_traverse_filter(void *p,
             (LFS_MKTAG(0x7ff, 0x3ff, 0) & tag) == (
                 LFS_MKTAG(LFS_TYPE_DELETE, 0, 0) |
                     (LFS_MKTAG(0, 0x3ff, 0) & *filtertag))) {
+        *filtertag = LFS_MKTAG(LFS_FROM_NOOP, 0, 0);
         return true;
     }
 
@@ -650,114 +1114,371 @@ static int lfs_dir_traverse_filter(void *p,
     return false;
 }
 
+// Nesting of lfs_dir_traverse: a filter pass per tag, a move into another
+// pair, and a filter pass per tag of the move
+#define LFS_DIR_TRAVERSE_DEPTH 3
+
+struct lfs_dir_traverse {
+    const lfs_mdir_t *dir;
+    lfs_off_t off;
+    lfs_tag_t ptag;
+    const struct lfs_mattr *attrs;
+    int attrcount;
+    bool hasseenmove;
+
+    lfs_tag_t tmask;
+    lfs_tag_t ttag;
+    uint16_t begin;
+    uint16_t end;
+    int16_t diff;
+
+    int (*cb)(void *data, lfs_tag_t tag, const void *buffer);
+    void *data;
+
+    lfs_tag_t tag;
+    const void *buffer;
+    struct lfs_diskoff disk;
+};
+
 static int lfs_dir_traverse(lfs_t *lfs,
         const lfs_mdir_t *dir, lfs_off_t off, lfs_tag_t ptag,
         const struct lfs_mattr *attrs, int attrcount, bool hasseenmove,
         lfs_tag_t tmask, lfs_tag_t ttag,
         uint16_t begin, uint16_t end, int16_t diff,
         int (*cb)(void *data, lfs_tag_t tag, const void *buffer), void *data) {
+    // nested passes are kept on an explicit stack of bounded depth instead
+    // of recursing, a filter pass pushes the tag it filters and ends once
+    // the filter rules on it
+    struct lfs_dir_traverse stack[LFS_DIR_TRAVERSE_DEPTH-1];
+    unsigned sp = 0;
+    int res = 0;
+
     // iterate over directory and attrs
+    lfs_tag_t tag;
+    const void *buffer;
+    struct lfs_diskoff disk;
     while (true) {
-        lfs_tag_t tag;
-        const void *buffer;
-        struct lfs_diskoff disk;
-        if (off+lfs_tag_dsize(ptag) < dir->off) {
-            off += lfs_tag_dsize(ptag);
-            int err = lfs_bd_read(lfs,
-                    NULL, &lfs->rcache, sizeof(tag),
-                    dir->pair[0], off, &tag, sizeof(tag));
-            if (err) {
-                return err;
-            }
-
-            tag = (lfs_frombe32(tag) ^ ptag) | 0x80000000;
-            disk.block = dir->pair[0];
-            disk.off = off+sizeof(lfs_tag_t);
-            buffer = &disk;
-            ptag = tag;
-        } else if (attrcount > 0) {
-            tag = attrs[0].tag;
-            buffer = attrs[0].buffer;
-            attrs += 1;
-            attrcount -= 1;
-        } else if (!hasseenmove &&
-                lfs_gstate_hasmovehere(&lfs->gpending, dir->pair)) {
-            // Wait, we have pending move? Handle this here (we need to
-            // or else we risk letting moves fall out of date)
-            tag = lfs->gpending.tag & LFS_MKTAG(0x7ff, 0x3ff, 0);
-            buffer = NULL;
-            hasseenmove = true;
-        } else {
-            return 0;
-        }
-
-        lfs_tag_t mask = LFS_MKTAG(0x7ff, 0, 0);
-        if ((mask & tmask & tag) != (mask & tmask & ttag)) {
-            continue;
-        }
+        {
+            if (off+lfs_tag_dsize(ptag) < dir->off) {
+                off += lfs_tag_dsize(ptag);
+                int err = lfs_bd_read(lfs,
+                        NULL, &lfs->rcache, sizeof(tag),
+                        dir->pair[0], off, &tag, sizeof(tag));
+                if (err) {
+                    return err;
+                }
 
-        // do we need to filter? inlining the filtering logic here allows
-        // for some minor optimizations
-        if (lfs_tag_id(tmask) != 0) {
-            // scan for duplicates and update tag based on creates/deletes
-            int filter = lfs_dir_traverse(lfs,
-                    dir, off, ptag, attrs, attrcount, hasseenmove,
-                    0, 0, 0, 0, 0,
-                    lfs_dir_traverse_filter, &tag);
-            if (filter < 0) {
-                return filter;
+                tag = (lfs_frombe32(tag) ^ ptag) | 0x80000000;
+                disk.block = dir->pair[0];
+                disk.off = off+sizeof(lfs_tag_t);
+                buffer = &disk;
+                ptag = tag;
+            } else if (attrcount > 0) {
+                tag = attrs[0].tag;
+                buffer = attrs[0].buffer;
+                attrs += 1;
+                attrcount -= 1;
+            } else if (!hasseenmove &&
+                    lfs_gstate_hasmovehere(&lfs->gpending, dir->pair)) {
+                // Wait, we have pending move? Handle this here (we need to
+                // or else we risk letting moves fall out of date)
+                tag = lfs->gpending.tag & LFS_MKTAG(0x7ff, 0x3ff, 0);
+                buffer = NULL;
+                hasseenmove = true;
+            } else {
+                // finished traversal, pop from stack?
+                res = 0;
+                break;
             }
+#ifdef LFS_YES_TRAVERSE_STATS
+            lfs->traverse.tags += 1;
+#endif
 
-            if (filter) {
+            lfs_tag_t mask = LFS_MKTAG(0x7ff, 0, 0);
+            if ((mask & tmask & tag) != (mask & tmask & ttag)) {
                 continue;
             }
 
-            // in filter range?
-            if (!(lfs_tag_id(tag) >= begin && lfs_tag_id(tag) < end)) {
+            // do we need to filter? scan for duplicates and update tag
+            // based on creates/deletes in a pass over the rest
+            if (lfs_tag_id(tmask) != 0) {
+                LFS_ASSERT(sp < LFS_DIR_TRAVERSE_DEPTH-1);
+                stack[sp] = (struct lfs_dir_traverse){
+                    .dir        = dir,
+                    .off        = off,
+                    .ptag       = ptag,
+                    .attrs      = attrs,
+                    .attrcount  = attrcount,
+                    .hasseenmove = hasseenmove,
+                    .tmask      = tmask,
+                    .ttag       = ttag,
+                    .begin      = begin,
+                    .end        = end,
+                    .diff       = diff,
+                    .cb         = cb,
+                    .data       = data,
+                    .tag        = tag,
+                    .buffer     = buffer,
+                    .disk       = disk,
+                };
+                sp += 1;
+#ifdef LFS_YES_TRAVERSE_STATS
+                lfs->traverse.depth = lfs_max(lfs->traverse.depth, sp);
+#endif
+
+                tmask = 0;
+                ttag = 0;
+                begin = 0;
+                end = 0;
+                diff = 0;
+                cb = lfs_dir_traverse_filter;
+                data = &stack[sp-1].tag;
                 continue;
             }
         }
 
+popped:
+        // in filter range?
+        if (lfs_tag_id(tmask) != 0 &&
+                !(lfs_tag_id(tag) >= begin && lfs_tag_id(tag) < end)) {
+            continue;
+        }
+
         // handle special cases for mcu-side operations
         if (lfs_tag_type3(tag) == LFS_FROM_NOOP) {
             // do nothing
         } else if (lfs_tag_type3(tag) == LFS_FROM_MOVE) {
+            // a filter pass has no use for the tags of a move, they can
+            // only repeat the struct and attributes the move itself
+            // commits, skipping them saves a filter pass per moved tag
+            if (cb == lfs_dir_traverse_filter) {
+                continue;
+            }
+
+            // move into the source pair, the frame resumes as a noop
+            LFS_ASSERT(sp < LFS_DIR_TRAVERSE_DEPTH-1);
+            stack[sp] = (struct lfs_dir_traverse){
+                .dir        = dir,
+                .off        = off,
+                .ptag       = ptag,
+                .attrs      = attrs,
+                .attrcount  = attrcount,
+                .hasseenmove = hasseenmove,
+                .tmask      = tmask,
+                .ttag       = ttag,
+                .begin      = begin,
+                .end        = end,
+                .diff       = diff,
+                .cb         = cb,
+                .data       = data,
+                .tag        = LFS_MKTAG(LFS_FROM_NOOP, 0, 0),
+            };
+            sp += 1;
+#ifdef LFS_YES_TRAVERSE_STATS
+            lfs->traverse.depth = lfs_max(lfs->traverse.depth, sp);
+#endif
+
             uint16_t fromid = lfs_tag_size(tag);
             uint16_t toid = lfs_tag_id(tag);
-            int err = lfs_dir_traverse(lfs,
-                    buffer, 0, LFS_BLOCK_NULL, NULL, 0, true,
-                    LFS_MKTAG(0x600, 0x3ff, 0),
-                    LFS_MKTAG(LFS_TYPE_STRUCT, 0, 0),
-                    fromid, fromid+1, toid-fromid+diff,
-                    cb, data);
-            if (err) {
-                return err;
-            }
+            dir = buffer;
+            off = 0;
+            ptag = LFS_BLOCK_NULL;
+            attrs = NULL;
+            attrcount = 0;
+            hasseenmove = true;
+            tmask = LFS_MKTAG(0x600, 0x3ff, 0);
+            ttag = LFS_MKTAG(LFS_TYPE_STRUCT, 0, 0);
+            begin = fromid;
+            end = fromid+1;
+            diff = toid-fromid+diff;
         } else if (lfs_tag_type3(tag) == LFS_FROM_USERATTRS) {
             for (unsigned i = 0; i < lfs_tag_size(tag); i++) {
                 const struct lfs_attr *a = buffer;
-                int err = cb(data, LFS_MKTAG(LFS_TYPE_USERATTR + a[i].type,
+                res = cb(data, LFS_MKTAG(LFS_TYPE_USERATTR + a[i].type,
                         lfs_tag_id(tag) + diff, a[i].size), a[i].buffer);
-                if (err) {
-                    return err;
+                if (res < 0) {
+                    return res;
+                }
+
+                if (res) {
+                    break;
                 }
             }
+
+            if (res > 0) {
+                break;
+            }
         } else {
-            int err = cb(data, tag + LFS_MKTAG(0, diff, 0), buffer);
-            if (err) {
-                return err;
+            res = cb(data, tag + LFS_MKTAG(0, diff, 0), buffer);
+            if (res < 0) {
+                return res;
+            }
+
+            if (res) {
+                break;
             }
         }
     }
+
+    if (sp > 0) {
+        // pop from the stack and return, all pops resume at the same place
+        sp -= 1;
+        dir         = stack[sp].dir;
+        off         = stack[sp].off;
+        ptag        = stack[sp].ptag;
+        attrs       = stack[sp].attrs;
+        attrcount   = stack[sp].attrcount;
+        hasseenmove = stack[sp].hasseenmove;
+        tmask       = stack[sp].tmask;
+        ttag        = stack[sp].ttag;
+        begin       = stack[sp].begin;
+        end         = stack[sp].end;
+        diff        = stack[sp].diff;
+        cb          = stack[sp].cb;
+        data        = stack[sp].data;
+        tag         = stack[sp].tag;
+        buffer      = stack[sp].buffer;
+        disk        = stack[sp].disk;
+        goto popped;
+    } else {
+        return res;
+    }
+}
+
+// Reruns the match of a fetch over the tags of an already fetched pair.
+// Every commit up to dir->off is known to be valid, so there are no
+// revisions or crcs to check.
+static int lfs_dir_rematch(lfs_t *lfs, const lfs_mdir_t *dir,
+        lfs_tag_t fmask, lfs_tag_t ftag,
+        int (*cb)(void *data, lfs_tag_t tag, const void *buffer), void *data,
+        lfs_stag_t *besttag) {
+    *besttag = -1;
+    if (!cb) {
+        return 0;
+    }
+
+    lfs_off_t off = 0;
+    lfs_tag_t ptag = LFS_BLOCK_NULL;
+    while (true) {
+        off += lfs_tag_dsize(ptag);
+        if (off >= dir->off) {
+            return 0;
+        }
+
+        lfs_tag_t tag;
+        int err = lfs_bd_read(lfs,
+                NULL, &lfs->rcache, lfs->cfg->block_size,
+                dir->pair[0], off, &tag, sizeof(tag));
+        if (err) {
+            return err;
+        }
+
+        tag = lfs_frombe32(tag) ^ ptag;
+        ptag = tag;
+
+        if (lfs_tag_type1(tag) == LFS_TYPE_CRC) {
+            // reset the next bit if we need to
+            ptag ^= (lfs_tag_t)(lfs_tag_chunk(tag) & 1U) << 31;
+            continue;
+        }
+
+        if (lfs_tag_type1(tag) == LFS_TYPE_SPLICE) {
+            if (tag == (LFS_MKTAG(LFS_TYPE_DELETE, 0, 0) |
+                    (LFS_MKTAG(0, 0x3ff, 0) & *besttag))) {
+                *besttag |= 0x80000000;
+            } else if (*besttag != -1 &&
+                    lfs_tag_id(tag) <= lfs_tag_id(*besttag)) {
+                *besttag += LFS_MKTAG(0, lfs_tag_splice(tag), 0);
+            }
+        }
+
+        // found a match for our fetcher?
+        if ((fmask & tag) == (fmask & ftag)) {
+            int res = cb(data, tag, &(struct lfs_diskoff){
+                    dir->pair[0], off+sizeof(tag)});
+            if (res < 0) {
+                return res;
+            }
+
+            if (res == LFS_CMP_EQ) {
+                // found a match
+                *besttag = tag;
+            } else if ((LFS_MKTAG(0x7ff, 0x3ff, 0) & tag) ==
+                    (LFS_MKTAG(0x7ff, 0x3ff, 0) & *besttag)) {
+                // found an identical tag, but contents didn't match
+                *besttag = -1;
+            } else if (res == LFS_CMP_GT &&
+                    lfs_tag_id(tag) <= lfs_tag_id(*besttag)) {
+                // found a greater match, keep track to keep things sorted
+                *besttag = tag | 0x80000000;
+            }
+        }
+    }
+}
+
+// Result of a fetch that found dir and besttag
+static lfs_stag_t lfs_dir_fetchresult(lfs_t *lfs,
+        const lfs_mdir_t *dir, lfs_stag_t besttag, uint16_t *id) {
+    // synthetic move
+    if (lfs_gstate_hasmovehere(&lfs->gstate, dir->pair)) {
+        if (lfs_tag_id(lfs->gstate.tag) == lfs_tag_id(besttag)) {
+            besttag |= 0x80000000;
+        } else if (besttag != -1 &&
+                lfs_tag_id(lfs->gstate.tag) < lfs_tag_id(besttag)) {
+            besttag -= LFS_MKTAG(0, 1, 0);
+        }
+    }
+
+    // found tag? or found best id?
+    if (id) {
+        *id = lfs_min(lfs_tag_id(besttag), dir->count);
+    }
+
+    if (lfs_tag_isvalid(besttag)) {
+        return besttag;
+    } else if (lfs_tag_id(besttag) < dir->count) {
+        return LFS_ERR_NOENT;
+    } else {
+        return 0;
+    }
 }
 
 static lfs_stag_t lfs_dir_fetchmatch(lfs_t *lfs,
         lfs_mdir_t *dir, const lfs_block_t pair[2],
         lfs_tag_t fmask, lfs_tag_t ftag, uint16_t *id,
         int (*cb)(void *data, lfs_tag_t tag, const void *buffer), void *data) {
+    // a pair fetched before and not written since only needs the match
+    struct lfs_mcache_entry *entry = lfs_mcache_find(lfs, pair);
+    if (entry) {
+        lfs_stag_t besttag;
+        int err = lfs_dir_rematch(lfs, &entry->m,
+                fmask, ftag, cb, data, &besttag);
+        if (!err) {
+            lfs->mcache.hits += 1;
+            lfs->mcache.clock += 1;
+            entry->used = lfs->mcache.clock;
+            lfs->seed ^= entry->seed;
+            *dir = entry->m;
+            return lfs_dir_fetchresult(lfs, dir, besttag, id);
+        }
+
+        if (err != LFS_ERR_CORRUPT) {
+            return err;
+        }
+
+        // let a full fetch deal with it
+        lfs_mcache_clear(entry);
+    }
+
+    if (lfs->mcache.entries) {
+        lfs->mcache.misses += 1;
+    }
+
     // we can find tag very efficiently during a fetch, since we're already
     // scanning the entire directory
     lfs_stag_t besttag = -1;
+    uint32_t seed = 0;
+    lfs_size_t tagcount = 0;
 
     // find the block with the most recent revision
     uint32_t revs[2] = {0, 0};
@@ -791,6 +1512,7 @@ static lfs_stag_t lfs_dir_fetchmatch(lfs_t *lfs,
         lfs_block_t temptail[2] = {LFS_BLOCK_NULL, LFS_BLOCK_NULL};
         bool tempsplit = false;
         lfs_stag_t tempbesttag = besttag;
+        lfs_size_t temptagcount = 0;
 
         dir->rev = lfs_tole32(dir->rev);
         uint32_t crc = lfs_crc(LFS_BLOCK_NULL, &dir->rev, sizeof(dir->rev));
@@ -824,6 +1546,7 @@ static lfs_stag_t lfs_dir_fetchmatch(lfs_t *lfs,
             }
 
             ptag = tag;
+            temptagcount += 1;
 
             if (lfs_tag_type1(tag) == LFS_TYPE_CRC) {
                 // check the crc attr
@@ -851,6 +1574,7 @@ static lfs_stag_t lfs_dir_fetchmatch(lfs_t *lfs,
                 // toss our crc into the filesystem seed for
                 // pseudorandom numbers
                 lfs->seed ^= crc;
+                seed ^= crc;
 
                 // update with what's found so far
                 besttag = tempbesttag;
@@ -860,6 +1584,7 @@ static lfs_stag_t lfs_dir_fetchmatch(lfs_t *lfs,
                 dir->tail[0] = temptail[0];
                 dir->tail[1] = temptail[1];
                 dir->split = tempsplit;
+                tagcount = temptagcount;
 
                 // reset crc
                 crc = LFS_BLOCK_NULL;
@@ -944,28 +1669,8 @@ static lfs_stag_t lfs_dir_fetchmatch(lfs_t *lfs,
 
         // consider what we have good enough
         if (dir->off > 0) {
-            // synthetic move
-            if (lfs_gstate_hasmovehere(&lfs->gstate, dir->pair)) {
-                if (lfs_tag_id(lfs->gstate.tag) == lfs_tag_id(besttag)) {
-                    besttag |= 0x80000000;
-                } else if (besttag != -1 &&
-                        lfs_tag_id(lfs->gstate.tag) < lfs_tag_id(besttag)) {
-                    besttag -= LFS_MKTAG(0, 1, 0);
-                }
-            }
-
-            // found tag? or found best id?
-            if (id) {
-                *id = lfs_min(lfs_tag_id(besttag), dir->count);
-            }
-
-            if (lfs_tag_isvalid(besttag)) {
-                return besttag;
-            } else if (lfs_tag_id(besttag) < dir->count) {
-                return LFS_ERR_NOENT;
-            } else {
-                return 0;
-            }
+            lfs_mcache_insert(lfs, dir, seed, tagcount);
+            return lfs_dir_fetchresult(lfs, dir, besttag, id);
         }
 
         // failed, try the other block?
@@ -1004,68 +1709,468 @@ static int lfs_dir_getgstate(lfs_t *lfs, const lfs_mdir_t *dir,
     return 0;
 }
 
-static int lfs_dir_getinfo(lfs_t *lfs, lfs_mdir_t *dir,
-        uint16_t id, struct lfs_info *info) {
-    if (id == 0x3ff) {
-        // special case for root
-        strcpy(info->name, "/");
-        info->type = LFS_TYPE_DIR;
-        return 0;
-    }
+static int lfs_dir_getinfo(lfs_t *lfs, lfs_mdir_t *dir,
+        uint16_t id, struct lfs_info *info) {
+    if (id == 0x3ff) {
+        // special case for root
+        strcpy(info->name, "/");
+        info->type = LFS_TYPE_DIR;
+        return 0;
+    }
+
+    lfs_stag_t tag = lfs_dir_get(lfs, dir, LFS_MKTAG(0x780, 0x3ff, 0),
+            LFS_MKTAG(LFS_TYPE_NAME, id, lfs->name_max+1), info->name);
+    if (tag < 0) {
+        return (int)tag;
+    }
+
+    info->type = lfs_tag_type3(tag);
+
+    struct lfs_ctz ctz;
+    tag = lfs_dir_get(lfs, dir, LFS_MKTAG(0x700, 0x3ff, 0),
+            LFS_MKTAG(LFS_TYPE_STRUCT, id, sizeof(ctz)), &ctz);
+    if (tag < 0) {
+        return (int)tag;
+    }
+    lfs_ctz_fromle32(&ctz);
+
+    if (lfs_tag_type3(tag) == LFS_TYPE_CTZSTRUCT) {
+        info->size = ctz.size;
+    } else if (lfs_tag_type3(tag) == LFS_TYPE_INLINESTRUCT) {
+        info->size = lfs_tag_size(tag);
+    }
+
+    return 0;
+}
+
+struct lfs_dir_find_match {
+    lfs_t *lfs;
+    const void *name;
+    lfs_size_t size;
+};
+
+static int lfs_dir_find_match(void *data,
+        lfs_tag_t tag, const void *buffer) {
+    struct lfs_dir_find_match *name = data;
+    lfs_t *lfs = name->lfs;
+    const struct lfs_diskoff *disk = buffer;
+
+    // compare with disk
+    lfs_size_t diff = lfs_min(name->size, lfs_tag_size(tag));
+    int res = lfs_bd_cmp(lfs,
+            NULL, &lfs->rcache, diff,
+            disk->block, disk->off, name->name, diff);
+    if (res != LFS_CMP_EQ) {
+        return res;
+    }
+
+    // only equal if our size is still the same
+    if (name->size != lfs_tag_size(tag)) {
+        return (name->size < lfs_tag_size(tag)) ? LFS_CMP_LT : LFS_CMP_GT;
+    }
+
+    // found a match!
+    return LFS_CMP_EQ;
+}
+
+// Orders name a against name b the way lfs_dir_find_match orders a name on
+// disk against the one searched for, no name sorts first
+static int lfs_nindex_cmp(const uint8_t *a, lfs_size_t asize,
+        const void *b, lfs_size_t bsize) {
+    if (asize == 0) {
+        return LFS_CMP_LT;
+    }
+
+    int res = memcmp(a, b, lfs_min(asize, bsize));
+    if (res != 0) {
+        return (res < 0) ? LFS_CMP_LT : LFS_CMP_GT;
+    }
+
+    if (asize != bsize) {
+        return (bsize < asize) ? LFS_CMP_LT : LFS_CMP_GT;
+    }
+
+    return LFS_CMP_EQ;
+}
+
+#define LFS_NINDEX_NULL ((lfs_size_t)-1)
+
+// Pair with the greater name of two tree nodes
+static lfs_size_t lfs_nindex_max(lfs_t *lfs, const struct lfs_ndir *ndir,
+        lfs_size_t a, lfs_size_t b) {
+    if (a == LFS_NINDEX_NULL) {
+        return b;
+    } else if (b == LFS_NINDEX_NULL) {
+        return a;
+    }
+
+    return (lfs_nindex_cmp(&ndir->names[b*lfs->nindex.name_max],
+                ndir->pairs[b].size,
+                &ndir->names[a*lfs->nindex.name_max],
+                ndir->pairs[a].size) == LFS_CMP_GT) ? b : a;
+}
+
+static void lfs_nindex_update(lfs_t *lfs, struct lfs_ndir *ndir,
+        lfs_size_t i) {
+    lfs_size_t node = ndir->capacity + i;
+    ndir->tree[node] = (i < ndir->count && ndir->pairs[i].size)
+            ? i : LFS_NINDEX_NULL;
+    for (node /= 2; node > 0; node /= 2) {
+        ndir->tree[node] = lfs_nindex_max(lfs, ndir,
+                ndir->tree[2*node], ndir->tree[2*node+1]);
+    }
+}
+
+// Block positions of the pairs from i on, after pairs were inserted or
+// removed before them
+static void lfs_nindex_reposition(lfs_t *lfs, struct lfs_ndir *ndir,
+        lfs_size_t i) {
+    uint16_t owner = ndir - lfs->nindex.dirs + 1;
+    for (lfs_size_t j = i; j < ndir->count; j++) {
+        for (int k = 0; k < 2; k++) {
+            if (lfs->nindex.owners[ndir->pairs[j].pair[k]] == owner) {
+                lfs->nindex.positions[ndir->pairs[j].pair[k]] = j;
+            }
+        }
+    }
+}
+
+static void lfs_nindex_rebuild(lfs_t *lfs, struct lfs_ndir *ndir) {
+    for (lfs_size_t j = 0; j < ndir->capacity; j++) {
+        ndir->tree[ndir->capacity + j] = (j < ndir->count &&
+                ndir->pairs[j].size) ? j : LFS_NINDEX_NULL;
+    }
+
+    for (lfs_size_t node = ndir->capacity-1; node > 0; node--) {
+        ndir->tree[node] = lfs_nindex_max(lfs, ndir,
+                ndir->tree[2*node], ndir->tree[2*node+1]);
+    }
+}
+
+// Forgets pairs [i, j), which are no longer part of the directory
+static void lfs_nindex_remove(lfs_t *lfs, struct lfs_ndir *ndir,
+        lfs_size_t i, lfs_size_t j) {
+    if (i == j) {
+        return;
+    }
+
+    uint16_t owner = ndir - lfs->nindex.dirs + 1;
+    for (lfs_size_t k = i; k < j; k++) {
+        for (int l = 0; l < 2; l++) {
+            lfs_block_t block = ndir->pairs[k].pair[l];
+            if (lfs->nindex.owners[block] == owner &&
+                    lfs->nindex.positions[block] == k) {
+                lfs->nindex.owners[block] = 0;
+            }
+        }
+    }
+
+    memmove(&ndir->pairs[i], &ndir->pairs[j],
+            (ndir->count-j)*sizeof(struct lfs_npair));
+    memmove(&ndir->names[i*lfs->nindex.name_max],
+            &ndir->names[j*lfs->nindex.name_max],
+            (ndir->count-j)*lfs->nindex.name_max);
+    ndir->count -= j-i;
+    lfs_nindex_reposition(lfs, ndir, i);
+}
+
+// Makes room for a pair at i
+static int lfs_nindex_insert(lfs_t *lfs, struct lfs_ndir *ndir,
+        lfs_size_t i) {
+    if (ndir->count == ndir->capacity) {
+        lfs_size_t capacity = lfs_max(2*ndir->capacity, 4);
+        struct lfs_npair *pairs = lfs_malloc(
+                capacity*sizeof(struct lfs_npair));
+        uint8_t *names = lfs_malloc(capacity*lfs->nindex.name_max);
+        lfs_size_t *tree = lfs_malloc(2*capacity*sizeof(lfs_size_t));
+        if (!pairs || !names || !tree) {
+            lfs_free(pairs);
+            lfs_free(names);
+            lfs_free(tree);
+            return LFS_ERR_NOMEM;
+        }
+
+        if (ndir->count) {
+            memcpy(pairs, ndir->pairs, ndir->count*sizeof(struct lfs_npair));
+            memcpy(names, ndir->names, ndir->count*lfs->nindex.name_max);
+        }
+
+        lfs_free(ndir->pairs);
+        lfs_free(ndir->names);
+        lfs_free(ndir->tree);
+        ndir->pairs = pairs;
+        ndir->names = names;
+        ndir->tree = tree;
+        ndir->capacity = capacity;
+    }
+
+    memmove(&ndir->pairs[i+1], &ndir->pairs[i],
+            (ndir->count-i)*sizeof(struct lfs_npair));
+    memmove(&ndir->names[(i+1)*lfs->nindex.name_max],
+            &ndir->names[i*lfs->nindex.name_max],
+            (ndir->count-i)*lfs->nindex.name_max);
+    ndir->count += 1;
+    lfs_nindex_reposition(lfs, ndir, i+1);
+    return 0;
+}
+
+// Fetches the pair at i along with the greatest of its names
+static int lfs_nindex_load(lfs_t *lfs, struct lfs_ndir *ndir,
+        lfs_size_t i, const lfs_block_t pair[2]) {
+    lfs_mdir_t dir;
+    int err = lfs_dir_fetch(lfs, &dir, pair);
+    if (err) {
+        return err;
+    }
+
+    if (dir.pair[0] >= lfs->cfg->block_count ||
+            dir.pair[1] >= lfs->cfg->block_count) {
+        return LFS_ERR_CORRUPT;
+    }
+
+    struct lfs_npair *npair = &ndir->pairs[i];
+    uint8_t *max = &ndir->names[i*lfs->nindex.name_max];
+    npair->size = 0;
+    for (uint16_t id = 0; id < dir.count; id++) {
+        lfs_stag_t tag = lfs_dir_get(lfs, &dir, LFS_MKTAG(0x780, 0x3ff, 0),
+                LFS_MKTAG(LFS_TYPE_NAME, id, lfs->nindex.name_max),
+                lfs->nindex.buffer);
+        if (tag == LFS_ERR_NOENT) {
+            continue;
+        } else if (tag < 0) {
+            return tag;
+        } else if (lfs_tag_size(tag) > lfs->nindex.name_max) {
+            return LFS_ERR_NAMETOOLONG;
+        }
+
+        if (npair->size == 0 || lfs_nindex_cmp(lfs->nindex.buffer,
+                lfs_tag_size(tag), max, npair->size) == LFS_CMP_GT) {
+            memcpy(max, lfs->nindex.buffer, lfs_tag_size(tag));
+            npair->size = lfs_tag_size(tag);
+        }
+    }
+
+    npair->pair[0] = dir.pair[0];
+    npair->pair[1] = dir.pair[1];
+    npair->tail[0] = dir.tail[0];
+    npair->tail[1] = dir.tail[1];
+    npair->split = dir.split;
+
+    uint16_t owner = ndir - lfs->nindex.dirs + 1;
+    for (int k = 0; k < 2; k++) {
+        uint16_t prev = lfs->nindex.owners[dir.pair[k]];
+        if (prev && prev != owner) {
+            // taken over from another directory, which has to start over
+            lfs->nindex.dirs[prev-1].dirtycount = LFS_NINDEX_DIRTY+1;
+        }
+
+        lfs->nindex.owners[dir.pair[k]] = owner;
+        lfs->nindex.positions[dir.pair[k]] = i;
+    }
+
+    return 0;
+}
+
+// Follows the tails from the pair at i until they lead back to indexed
+// pairs, picking up pairs added by splits and dropping removed ones
+static int lfs_nindex_follow(lfs_t *lfs, struct lfs_ndir *ndir,
+        lfs_size_t i, bool *moved) {
+    uint16_t owner = ndir - lfs->nindex.dirs + 1;
+    while (ndir->pairs[i].split) {
+        const lfs_block_t *tail = ndir->pairs[i].tail;
+        if (i+1 < ndir->count && lfs_pair_sync(ndir->pairs[i+1].pair, tail)) {
+            return 0;
+        }
+
+        *moved = true;
+        if (tail[0] < lfs->cfg->block_count &&
+                lfs->nindex.owners[tail[0]] == owner) {
+            lfs_size_t j = lfs->nindex.positions[tail[0]];
+            if (j > i && j < ndir->count &&
+                    lfs_pair_sync(ndir->pairs[j].pair, tail)) {
+                lfs_nindex_remove(lfs, ndir, i+1, j);
+                return 0;
+            }
+        }
+
+        if (ndir->count >= lfs->cfg->block_count/2) {
+            // tails run in a circle
+            return LFS_ERR_CORRUPT;
+        }
+
+        lfs_block_t pair[2] = {tail[0], tail[1]};
+        int err = lfs_nindex_insert(lfs, ndir, i+1);
+        if (err) {
+            return err;
+        }
+
+        i += 1;
+        err = lfs_nindex_load(lfs, ndir, i, pair);
+        if (err) {
+            return err;
+        }
+    }
+
+    if (i+1 < ndir->count) {
+        *moved = true;
+        lfs_nindex_remove(lfs, ndir, i+1, ndir->count);
+    }
+
+    return 0;
+}
+
+// Brings the index up to date with the pairs written since the last lookup,
+// last first so positions still to be rechecked do not move
+static int lfs_nindex_sync(lfs_t *lfs, struct lfs_ndir *ndir) {
+    bool moved = false;
+    if (ndir->dirtycount > LFS_NINDEX_DIRTY) {
+        lfs_nindex_remove(lfs, ndir, 0, ndir->count);
+        ndir->dirtycount = 0;
+        moved = true;
 
-    lfs_stag_t tag = lfs_dir_get(lfs, dir, LFS_MKTAG(0x780, 0x3ff, 0),
-            LFS_MKTAG(LFS_TYPE_NAME, id, lfs->name_max+1), info->name);
-    if (tag < 0) {
-        return (int)tag;
+        int err = lfs_nindex_insert(lfs, ndir, 0);
+        if (err) {
+            return err;
+        }
+
+        err = lfs_nindex_load(lfs, ndir, 0, ndir->head);
+        if (err) {
+            return err;
+        }
+
+        err = lfs_nindex_follow(lfs, ndir, 0, &moved);
+        if (err) {
+            return err;
+        }
     }
 
-    info->type = lfs_tag_type3(tag);
+    while (ndir->dirtycount > 0) {
+        lfs_size_t last = 0;
+        for (lfs_size_t k = 1; k < ndir->dirtycount; k++) {
+            if (ndir->dirty[k] > ndir->dirty[last]) {
+                last = k;
+            }
+        }
 
-    struct lfs_ctz ctz;
-    tag = lfs_dir_get(lfs, dir, LFS_MKTAG(0x700, 0x3ff, 0),
-            LFS_MKTAG(LFS_TYPE_STRUCT, id, sizeof(ctz)), &ctz);
-    if (tag < 0) {
-        return (int)tag;
+        lfs_size_t i = ndir->dirty[last];
+        ndir->dirtycount -= 1;
+        ndir->dirty[last] = ndir->dirty[ndir->dirtycount];
+        if (i >= ndir->count) {
+            continue;
+        }
+
+        lfs_block_t pair[2] = {ndir->pairs[i].pair[0], ndir->pairs[i].pair[1]};
+        int err = lfs_nindex_load(lfs, ndir, i, pair);
+        if (err) {
+            return err;
+        }
+
+        err = lfs_nindex_follow(lfs, ndir, i, &moved);
+        if (err) {
+            return err;
+        }
+
+        if (!moved) {
+            lfs_nindex_update(lfs, ndir, i);
+        }
     }
-    lfs_ctz_fromle32(&ctz);
 
-    if (lfs_tag_type3(tag) == LFS_TYPE_CTZSTRUCT) {
-        info->size = ctz.size;
-    } else if (lfs_tag_type3(tag) == LFS_TYPE_INLINESTRUCT) {
-        info->size = lfs_tag_size(tag);
+    if (moved) {
+        lfs_nindex_rebuild(lfs, ndir);
     }
 
     return 0;
 }
 
-struct lfs_dir_find_match {
-    lfs_t *lfs;
-    const void *name;
-    lfs_size_t size;
-};
+static void lfs_nindex_evict(lfs_t *lfs, struct lfs_ndir *ndir) {
+    lfs_nindex_remove(lfs, ndir, 0, ndir->count);
+    lfs_free(ndir->pairs);
+    lfs_free(ndir->names);
+    lfs_free(ndir->tree);
+    ndir->pairs = NULL;
+    ndir->names = NULL;
+    ndir->tree = NULL;
+    ndir->capacity = 0;
+    ndir->dirtycount = 0;
+    ndir->used = 0;
+}
 
-static int lfs_dir_find_match(void *data,
-        lfs_tag_t tag, const void *buffer) {
-    struct lfs_dir_find_match *name = data;
-    lfs_t *lfs = name->lfs;
-    const struct lfs_diskoff *disk = buffer;
+// Moves tail from the first pair of a directory to the first of its pairs
+// holding a name not less than name, the pair the search in lfs_dir_find
+// would stop at, or its last pair. Left alone when the directory is not
+// indexed.
+static void lfs_nindex_seek(lfs_t *lfs, lfs_block_t tail[2],
+        const char *name, lfs_size_t namelen) {
+    if (!lfs->nindex.dirs) {
+        return;
+    }
+
+    struct lfs_ndir *ndir = NULL;
+    struct lfs_ndir *victim = &lfs->nindex.dirs[0];
+    for (lfs_size_t i = 0; i < lfs->cfg->name_index_size; i++) {
+        struct lfs_ndir *dir = &lfs->nindex.dirs[i];
+        if (dir->used && lfs_pair_sync(dir->head, tail)) {
+            ndir = dir;
+            break;
+        }
 
-    // compare with disk
-    lfs_size_t diff = lfs_min(name->size, lfs_tag_size(tag));
-    int res = lfs_bd_cmp(lfs,
-            NULL, &lfs->rcache, diff,
-            disk->block, disk->off, name->name, diff);
-    if (res != LFS_CMP_EQ) {
-        return res;
+        if (dir->used < victim->used) {
+            victim = dir;
+        }
     }
 
-    // only equal if our size is still the same
-    if (name->size != lfs_tag_size(tag)) {
-        return (name->size < lfs_tag_size(tag)) ? LFS_CMP_LT : LFS_CMP_GT;
+    if (!ndir) {
+        // only directories spanning several pairs are worth it
+        lfs_mdir_t dir;
+        int err = lfs_dir_fetch(lfs, &dir, tail);
+        if (err || !dir.split) {
+            return;
+        }
+
+        lfs_nindex_evict(lfs, victim);
+        ndir = victim;
+        ndir->head[0] = tail[0];
+        ndir->head[1] = tail[1];
+        ndir->dirtycount = LFS_NINDEX_DIRTY+1;
     }
 
-    // found a match!
-    return LFS_CMP_EQ;
+    lfs->nindex.clock += 1;
+    ndir->used = lfs->nindex.clock;
+
+    if (ndir->dirtycount) {
+        int err = lfs_nindex_sync(lfs, ndir);
+        if (err) {
+            // let the search find out
+            lfs_nindex_evict(lfs, ndir);
+            return;
+        }
+    }
+
+    // leftmost pair whose greatest name is not less than name
+    lfs_size_t i = ndir->count-1;
+    lfs_size_t root = ndir->tree[1];
+    if (root != LFS_NINDEX_NULL &&
+            lfs_nindex_cmp(&ndir->names[root*lfs->nindex.name_max],
+                ndir->pairs[root].size, name, namelen) != LFS_CMP_LT) {
+        lfs_size_t node = 1;
+        while (node < ndir->capacity) {
+            lfs_size_t max = ndir->tree[2*node];
+            if (max != LFS_NINDEX_NULL &&
+                    lfs_nindex_cmp(&ndir->names[max*lfs->nindex.name_max],
+                        ndir->pairs[max].size, name, namelen)
+                        != LFS_CMP_LT) {
+                node = 2*node;
+            } else {
+                node = 2*node+1;
+            }
+        }
+        i = node - ndir->capacity;
+    }
+
+    lfs->nindex.seeks += 1;
+    lfs->nindex.skipped += i;
+    tail[0] = ndir->pairs[i].pair[0];
+    tail[1] = ndir->pairs[i].pair[1];
 }
 
 static lfs_stag_t lfs_dir_find(lfs_t *lfs, lfs_mdir_t *dir,
@@ -1141,6 +2246,9 @@ nextname:
             lfs_pair_fromle32(dir->tail);
         }
 
+        // skip pairs of large directories that cannot hold name
+        lfs_nindex_seek(lfs, dir->tail, name, namelen);
+
         // find entry matching name
         while (true) {
             tag = lfs_dir_fetchmatch(lfs, dir, dir->tail,
@@ -1430,35 +2538,303 @@ static int lfs_dir_commit_commit(void *p, lfs_tag_t tag, const void *buffer) {
     return lfs_dir_commitattr(commit->lfs, commit->commit, tag, buffer);
 }
 
-static int lfs_dir_compact(lfs_t *lfs,
+// Tags a compaction keeps, in the order lfs_dir_traverse passes them to the
+// commit, with the ids they end up with
+struct lfs_ctable {
+    struct lfs_ctag {
+        lfs_tag_t tag;
+        const void *buffer;
+        struct lfs_diskoff disk;
+    } *tags;
+    lfs_size_t count;
+};
+
+// ids tracked by lfs_ctable_build, 0x3ff is the id of pair-wide tags
+#define LFS_CTABLE_IDS 0x3ff
+// set on entries deleted later, next to a bit per type1 written later
+#define LFS_CTABLE_DEAD 0x100
+#define LFS_CTABLE_NULL ((lfs_size_t)-1)
+
+// Finds the tags compacting source with attrs keeps in one backward pass,
+// instead of scanning every tag after each one the way the filter of
+// lfs_dir_traverse does. Entries are tracked through creates and deletes
+// back from the ids they end up with. Leaves table->tags NULL to fall back
+// to lfs_dir_traverse, which needs no memory.
+static int lfs_ctable_build(lfs_t *lfs, struct lfs_ctable *table,
+        const lfs_mdir_t *source,
+        const struct lfs_mattr *attrs, int attrcount) {
+    table->tags = NULL;
+    table->count = 0;
+    if (!lfs->cfg->compact_table) {
+        return 0;
+    }
+
+    // moves pull tags from another pair, leave those to lfs_dir_traverse
+    lfs_size_t size = source->off/sizeof(lfs_tag_t) + attrcount + 1;
+    lfs_size_t uniques = size;
+    for (int i = 0; i < attrcount; i++) {
+        if (lfs_tag_type3(attrs[i].tag) == LFS_FROM_MOVE) {
+            return 0;
+        } else if (lfs_tag_type3(attrs[i].tag) == LFS_FROM_USERATTRS) {
+            uniques += lfs_tag_size(attrs[i].tag);
+        }
+    }
+
+    // an entry per id plus one per splice
+    lfs_size_t handles = LFS_CTABLE_IDS + size;
+    struct lfs_ctag *tags = lfs_malloc(size*sizeof(*tags));
+    lfs_size_t *slots = lfs_malloc(
+            (LFS_CTABLE_IDS + handles + uniques)*sizeof(lfs_size_t)
+            + (handles + uniques)*sizeof(uint16_t));
+    if (!tags || !slots) {
+        lfs_free(tags);
+        lfs_free(slots);
+        return 0;
+    }
+    // newest unique type written to each entry, older ones linked
+    lfs_size_t *heads = &slots[LFS_CTABLE_IDS];
+    lfs_size_t *nexts = &heads[handles];
+    uint16_t *flags = (uint16_t*)&nexts[uniques];
+    uint16_t *types = &flags[handles];
+
+    lfs_size_t count = 0;
+    lfs_off_t off = 0;
+    lfs_tag_t ptag = LFS_BLOCK_NULL;
+    while (off + lfs_tag_dsize(ptag) < source->off) {
+        off += lfs_tag_dsize(ptag);
+        lfs_tag_t tag;
+        int err = lfs_bd_read(lfs,
+                NULL, &lfs->rcache, lfs->cfg->block_size,
+                source->pair[0], off, &tag, sizeof(tag));
+        if (err) {
+            lfs_free(tags);
+            lfs_free(slots);
+            return err;
+        }
+
+        tag = (lfs_frombe32(tag) ^ ptag) | 0x80000000;
+        ptag = tag;
+        tags[count].tag = tag;
+        tags[count].buffer = NULL;
+        tags[count].disk.block = source->pair[0];
+        tags[count].disk.off = off + sizeof(tag);
+        count += 1;
+    }
+
+    lfs_size_t logcount = count;
+    for (int i = 0; i < attrcount; i++) {
+        tags[count].tag = attrs[i].tag;
+        tags[count].buffer = attrs[i].buffer;
+        count += 1;
+    }
+
+    if (lfs_gstate_hasmovehere(&lfs->gpending, source->pair)) {
+        tags[count].tag = lfs->gpending.tag & LFS_MKTAG(0x7ff, 0x3ff, 0);
+        tags[count].buffer = NULL;
+        count += 1;
+    }
+
+    // creates shift ids up, kept tags must stay clear of the pair-wide id
+    lfs_size_t idmax = 0;
+    lfs_size_t creates = 0;
+    for (lfs_size_t i = 0; i < count; i++) {
+        uint16_t type3 = lfs_tag_type3(tags[i].tag);
+        uint16_t id = lfs_tag_id(tags[i].tag);
+        if ((type3 != LFS_FROM_NOOP && !(type3 & 0x400)) ||
+                (lfs_tag_type1(tags[i].tag) == LFS_TYPE_SPLICE &&
+                    id != 0x3ff)) {
+            idmax = lfs_max(idmax, id);
+        }
+        creates += (type3 == LFS_TYPE_CREATE);
+    }
+
+    if (idmax + creates + 1 >= LFS_CTABLE_IDS) {
+        lfs_free(tags);
+        lfs_free(slots);
+        return 0;
+    }
+
+    for (lfs_size_t i = 0; i < LFS_CTABLE_IDS; i++) {
+        slots[i] = i;
+        heads[i] = LFS_CTABLE_NULL;
+        flags[i] = 0;
+    }
+
+    lfs_size_t nhandles = LFS_CTABLE_IDS;
+    lfs_size_t nuniques = 0;
+    bool later = false;
+    for (lfs_size_t i = count; i-- > 0;) {
+        lfs_tag_t tag = tags[i].tag;
+        uint16_t type3 = lfs_tag_type3(tag);
+        uint16_t id = lfs_tag_id(tag);
+        tags[i].tag = LFS_BLOCK_NULL;
+        if (type3 == LFS_FROM_NOOP) {
+            // never passed on, not even to the filter
+            continue;
+        }
+
+        // kept unless deleted, written again or a deleted attribute with
+        // anything after it
+        if (!(type3 & 0x400)) {
+            lfs_size_t h = slots[id];
+            bool keep = !(flags[h] &
+                    (LFS_CTABLE_DEAD | (1U << (lfs_tag_type1(tag) >> 8)))) &&
+                    !(later && lfs_tag_isdelete(tag));
+            for (lfs_size_t j = heads[h]; keep && j != LFS_CTABLE_NULL;
+                    j = nexts[j]) {
+                keep = (types[j] != type3);
+            }
+
+            if (keep) {
+                tags[i].tag = (tag & ~LFS_MKTAG(0, 0x3ff, 0))
+                        | LFS_MKTAG(0, h, 0);
+            }
+        }
+
+        if (type3 == LFS_FROM_USERATTRS) {
+            const struct lfs_attr *a = tags[i].buffer;
+            for (lfs_size_t j = 0; j < lfs_tag_size(tag); j++) {
+                types[nuniques] = LFS_TYPE_USERATTR + a[j].type;
+                nexts[nuniques] = heads[slots[id]];
+                heads[slots[id]] = nuniques++;
+                later = true;
+            }
+        } else if (lfs_tag_type1(tag) == LFS_TYPE_SPLICE && id != 0x3ff) {
+            // undo the splice, earlier tags see the ids from before it
+            if (lfs_tag_splice(tag) > 0) {
+                memmove(&slots[id], &slots[id+1],
+                        (LFS_CTABLE_IDS-id-1)*sizeof(lfs_size_t));
+                slots[LFS_CTABLE_IDS-1] = nhandles;
+                flags[nhandles] = 0;
+            } else if (lfs_tag_splice(tag) < 0) {
+                memmove(&slots[id+1], &slots[id],
+                        (LFS_CTABLE_IDS-id-1)*sizeof(lfs_size_t));
+                slots[id] = nhandles;
+                flags[nhandles] = LFS_CTABLE_DEAD;
+            }
+            heads[nhandles] = LFS_CTABLE_NULL;
+            nhandles += 1;
+            later = true;
+        } else if (id != 0x3ff) {
+            if (type3 & 0x100) {
+                types[nuniques] = type3;
+                nexts[nuniques] = heads[slots[id]];
+                heads[slots[id]] = nuniques++;
+            } else {
+                flags[slots[id]] |= 1U << (lfs_tag_type1(tag) >> 8);
+            }
+            later = true;
+        } else {
+            later = true;
+        }
+    }
+
+    // pack the kept tags, those from the log point at their copy of disk
+    table->count = 0;
+    for (lfs_size_t i = 0; i < count; i++) {
+        if (tags[i].tag != LFS_BLOCK_NULL) {
+            tags[table->count] = tags[i];
+            if (i < logcount) {
+                tags[table->count].buffer = &tags[table->count].disk;
+            }
+            table->count += 1;
+        }
+    }
+
+    table->tags = tags;
+    lfs_free(slots);
+    return 0;
+}
+
+// Passes the tags compaction keeps for ids begin to end to cb, renumbered
+// from 0, the same way lfs_dir_traverse does
+static int lfs_dir_compacttraverse(lfs_t *lfs, const struct lfs_ctable *table,
+        const lfs_mdir_t *source, const struct lfs_mattr *attrs, int attrcount,
+        uint16_t begin, uint16_t end,
+        int (*cb)(void *data, lfs_tag_t tag, const void *buffer), void *data) {
+    if (!table->tags) {
+        return lfs_dir_traverse(lfs,
+                source, 0, LFS_BLOCK_NULL, attrs, attrcount, false,
+                LFS_MKTAG(0x400, 0x3ff, 0),
+                LFS_MKTAG(LFS_TYPE_NAME, 0, 0),
+                begin, end, -begin,
+                cb, data);
+    }
+
+    for (lfs_size_t i = 0; i < table->count; i++) {
+        const struct lfs_ctag *t = &table->tags[i];
+        uint16_t id = lfs_tag_id(t->tag);
+        if (id < begin || id >= end) {
+            continue;
+        }
+
+        if (lfs_tag_type3(t->tag) == LFS_FROM_USERATTRS) {
+            const struct lfs_attr *a = t->buffer;
+            for (unsigned j = 0; j < lfs_tag_size(t->tag); j++) {
+                int err = cb(data, LFS_MKTAG(LFS_TYPE_USERATTR + a[j].type,
+                        id - begin, a[j].size), a[j].buffer);
+                if (err) {
+                    return err;
+                }
+            }
+        } else {
+            int err = cb(data, t->tag - LFS_MKTAG(0, begin, 0), t->buffer);
+            if (err) {
+                return err;
+            }
+        }
+    }
+
+    return 0;
+}
+
+// Whether attrs only write the entry at the end of ids up to end, the way
+// filling a directory in name order does
+static bool lfs_dir_isappend(const struct lfs_mattr *attrs, int attrcount,
+        uint16_t end) {
+    bool append = false;
+    for (int i = 0; i < attrcount; i++) {
+        uint16_t id = lfs_tag_id(attrs[i].tag);
+        if (lfs_tag_type3(attrs[i].tag) == LFS_FROM_NOOP || id == 0x3ff) {
+            continue;
+        } else if (lfs_tag_type3(attrs[i].tag) == LFS_TYPE_DELETE ||
+                id + 1 != end) {
+            return false;
+        }
+
+        append = true;
+    }
+
+    return append;
+}
+
+static int lfs_dir_rawcompact(lfs_t *lfs,
         lfs_mdir_t *dir, const struct lfs_mattr *attrs, int attrcount,
-        lfs_mdir_t *source, uint16_t begin, uint16_t end) {
+        lfs_mdir_t *source, uint16_t begin, uint16_t end,
+        const struct lfs_ctable *table) {
     // save some state in case block is bad
     const lfs_block_t oldpair[2] = {dir->pair[1], dir->pair[0]};
     bool relocated = false;
     bool exhausted = false;
 
+    // space is complicated, we need room for tail, crc, gstate,
+    // cleanup delete, and we cap at half a block to give room
+    // for metadata updates.
+    lfs_size_t limit = lfs_min(lfs->cfg->block_size - 36,
+            lfs_alignup(lfs->cfg->block_size/2, lfs->cfg->prog_size));
+
     // should we split?
     while (end - begin > 1) {
         // find size
         lfs_size_t size = 0;
-        int err = lfs_dir_traverse(lfs,
-                source, 0, LFS_BLOCK_NULL, attrs, attrcount, false,
-                LFS_MKTAG(0x400, 0x3ff, 0),
-                LFS_MKTAG(LFS_TYPE_NAME, 0, 0),
-                begin, end, -begin,
+        int err = lfs_dir_compacttraverse(lfs, table,
+                source, attrs, attrcount, begin, end,
                 lfs_dir_commit_size, &size);
         if (err) {
             return err;
         }
 
-        // space is complicated, we need room for tail, crc, gstate,
-        // cleanup delete, and we cap at half a block to give room
-        // for metadata updates.
-        if (end - begin < 0xff &&
-                size <= lfs_min(lfs->cfg->block_size - 36,
-                    lfs_alignup(lfs->cfg->block_size/2,
-                        lfs->cfg->prog_size))) {
+        if (end - begin < 0xff && size <= limit) {
             break;
         }
 
@@ -1466,6 +2842,13 @@ static int lfs_dir_compact(lfs_t *lfs,
         // largest size that fits with a small binary search, but right now
         // it's not worth the code size
         uint16_t split = (end - begin) / 2;
+        if (lfs->cfg->bulk_load && !dir->split &&
+                lfs_dir_isappend(attrs, attrcount, end)) {
+            // appended to the end of the directory, only the new entry
+            // moves on, the others stay put filling up to the whole block
+            split = end-1 - begin;
+            limit = lfs->cfg->block_size - 36;
+        }
         err = lfs_dir_split(lfs, dir, attrs, attrcount,
                 source, begin+split, end);
         if (err) {
@@ -1568,11 +2951,8 @@ static int lfs_dir_compact(lfs_t *lfs,
             }
 
             // traverse the directory, this time writing out all unique tags
-            err = lfs_dir_traverse(lfs,
-                    source, 0, LFS_BLOCK_NULL, attrs, attrcount, false,
-                    LFS_MKTAG(0x400, 0x3ff, 0),
-                    LFS_MKTAG(LFS_TYPE_NAME, 0, 0),
-                    begin, end, -begin,
+            err = lfs_dir_compacttraverse(lfs, table,
+                    source, attrs, attrcount, begin, end,
                     lfs_dir_commit_commit, &(struct lfs_dir_commit_commit){
                         lfs, &commit});
             if (err) {
@@ -1673,6 +3053,21 @@ relocate:
     return 0;
 }
 
+static int lfs_dir_compact(lfs_t *lfs,
+        lfs_mdir_t *dir, const struct lfs_mattr *attrs, int attrcount,
+        lfs_mdir_t *source, uint16_t begin, uint16_t end) {
+    struct lfs_ctable table;
+    int err = lfs_ctable_build(lfs, &table, source, attrs, attrcount);
+    if (err) {
+        return err;
+    }
+
+    err = lfs_dir_rawcompact(lfs, dir, attrs, attrcount,
+            source, begin, end, &table);
+    lfs_free(table.tags);
+    return err;
+}
+
 static int lfs_dir_commit(lfs_t *lfs, lfs_mdir_t *dir,
         const struct lfs_mattr *attrs, int attrcount) {
     // check for any inline files that aren't RAM backed and
@@ -1693,6 +3088,10 @@ static int lfs_dir_commit(lfs_t *lfs, lfs_mdir_t *dir,
         }
     }
 
+#ifdef LFS_YES_TRAVERSE_STATS
+    lfs->traverse.commits += 1;
+#endif
+
     // calculate changes to the directory
     lfs_tag_t deletetag = LFS_BLOCK_NULL;
     lfs_tag_t createtag = LFS_BLOCK_NULL;
@@ -2140,8 +3539,35 @@ static int lfs_ctz_index(lfs_t *lfs, lfs_off_t *off) {
     return i;
 }
 
+static void lfs_ctzcache_push(lfs_t *lfs, struct lfs_ctzcache *ctzcache,
+        lfs_off_t index, lfs_block_t block) {
+    if (!ctzcache || !ctzcache->entries) {
+        return;
+    }
+
+    for (lfs_size_t i = 0; i < ctzcache->count; i++) {
+        if (ctzcache->entries[i].index == index) {
+            return;
+        }
+    }
+
+    if (ctzcache->count < lfs->cfg->ctz_cache_size) {
+        ctzcache->entries[ctzcache->count] = (struct lfs_ctzpos){index, block};
+        ctzcache->count += 1;
+    } else {
+        ctzcache->entries[ctzcache->next] = (struct lfs_ctzpos){index, block};
+        ctzcache->next = (ctzcache->next + 1) % lfs->cfg->ctz_cache_size;
+    }
+}
+
+static void lfs_ctzcache_drop(struct lfs_ctzcache *ctzcache) {
+    ctzcache->count = 0;
+    ctzcache->next = 0;
+}
+
 static int lfs_ctz_find(lfs_t *lfs,
         const lfs_cache_t *pcache, lfs_cache_t *rcache,
+        struct lfs_ctzcache *ctzcache,
         lfs_block_t head, lfs_size_t size,
         lfs_size_t pos, lfs_block_t *block, lfs_off_t *off) {
     if (size == 0) {
@@ -2153,6 +3579,15 @@ static int lfs_ctz_find(lfs_t *lfs,
     lfs_off_t current = lfs_ctz_index(lfs, &(lfs_off_t){size-1});
     lfs_off_t target = lfs_ctz_index(lfs, &pos);
 
+    // start from the nearest known block at or after the target
+    for (lfs_size_t i = 0; ctzcache && i < ctzcache->count; i++) {
+        if (ctzcache->entries[i].index >= target &&
+                ctzcache->entries[i].index < current) {
+            current = ctzcache->entries[i].index;
+            head = ctzcache->entries[i].block;
+        }
+    }
+
     while (current > target) {
         lfs_size_t skip = lfs_min(
                 lfs_npw2(current-target+1) - 1,
@@ -2168,6 +3603,7 @@ static int lfs_ctz_find(lfs_t *lfs,
 
         LFS_ASSERT(head >= 2 && head <= lfs->cfg->block_count);
         current -= 1 << skip;
+        lfs_ctzcache_push(lfs, ctzcache, current, head);
     }
 
     *block = head;
@@ -2345,6 +3781,7 @@ int lfs_file_opencfg(lfs_t *lfs, lfs_file_t *file,
     file->pos = 0;
     file->off = 0;
     file->cache.buffer = NULL;
+    file->ctzcache = (struct lfs_ctzcache){NULL};
 
     // allocate entry for file if it doesn't exist
     lfs_stag_t tag = lfs_dir_find(lfs, &file->m, &path, &file->id);
@@ -2441,6 +3878,15 @@ int lfs_file_opencfg(lfs_t *lfs, lfs_file_t *file,
     // zero to avoid information leak
     lfs_cache_zero(lfs, &file->cache);
 
+    if (lfs->cfg->ctz_cache_size) {
+        file->ctzcache.entries = lfs_malloc(
+                lfs->cfg->ctz_cache_size*sizeof(struct lfs_ctzpos));
+        if (!file->ctzcache.entries) {
+            err = LFS_ERR_NOMEM;
+            goto cleanup;
+        }
+    }
+
     if (lfs_tag_type3(tag) == LFS_TYPE_INLINESTRUCT) {
         // load inline files
         file->ctz.head = LFS_BLOCK_INLINE;
@@ -2503,6 +3949,7 @@ int lfs_file_close(lfs_t *lfs, lfs_file_t *file) {
     if (!file->cfg->buffer) {
         lfs_free(file->cache.buffer);
     }
+    lfs_free(file->ctzcache.entries);
 
     file->flags &= ~LFS_F_OPENED;
     LFS_TRACE("lfs_file_close -> %d", err);
@@ -2663,6 +4110,7 @@ relocate:
         // actual file updates
         file->ctz.head = file->block;
         file->ctz.size = file->pos;
+        lfs_ctzcache_drop(&file->ctzcache);
         file->flags &= ~LFS_F_WRITING;
         file->flags |= LFS_F_DIRTY;
 
@@ -2772,7 +4220,7 @@ lfs_ssize_t lfs_file_read(lfs_t *lfs, lfs_file_t *file,
                 file->off == lfs->cfg->block_size) {
             if (!(file->flags & LFS_F_INLINE)) {
                 int err = lfs_ctz_find(lfs, NULL, &file->cache,
-                        file->ctz.head, file->ctz.size,
+                        &file->ctzcache, file->ctz.head, file->ctz.size,
                         file->pos, &file->block, &file->off);
                 if (err) {
                     LFS_TRACE("lfs_file_read -> %d", err);
@@ -2882,7 +4330,7 @@ lfs_ssize_t lfs_file_write(lfs_t *lfs, lfs_file_t *file,
                 if (!(file->flags & LFS_F_WRITING) && file->pos > 0) {
                     // find out which block we're extending from
                     int err = lfs_ctz_find(lfs, NULL, &file->cache,
-                            file->ctz.head, file->ctz.size,
+                            &file->ctzcache, file->ctz.head, file->ctz.size,
                             file->pos-1, &file->block, &file->off);
                     if (err) {
                         file->flags |= LFS_F_ERRED;
@@ -3007,7 +4455,7 @@ int lfs_file_truncate(lfs_t *lfs, lfs_file_t *file, lfs_off_t size) {
 
         // lookup new head in ctz skip list
         err = lfs_ctz_find(lfs, NULL, &file->cache,
-                file->ctz.head, file->ctz.size,
+                &file->ctzcache, file->ctz.head, file->ctz.size,
                 size, &file->block, &file->off);
         if (err) {
             LFS_TRACE("lfs_file_truncate -> %d", err);
@@ -3016,6 +4464,7 @@ int lfs_file_truncate(lfs_t *lfs, lfs_file_t *file, lfs_off_t size) {
 
         file->ctz.head = file->block;
         file->ctz.size = size;
+        lfs_ctzcache_drop(&file->ctzcache);
         file->flags |= LFS_F_DIRTY | LFS_F_READING;
     } else if (size > oldsize) {
         // flush+seek if not already at end
@@ -3381,6 +4830,12 @@ int lfs_removeattr(lfs_t *lfs, const char *path, uint8_t type) {
 /// Filesystem operations ///
 static int lfs_init(lfs_t *lfs, const struct lfs_config *cfg) {
     lfs->cfg = cfg;
+    lfs->lcache = (struct lfs_lcache){0};
+    lfs->mcache = (struct lfs_mcache){0};
+    lfs->nindex = (struct lfs_nindex){0};
+#ifdef LFS_YES_TRAVERSE_STATS
+    lfs->traverse = (struct lfs_traverse){0};
+#endif
     int err = 0;
 
     // validate that the lfs-cfg sizes were initiated properly before
@@ -3448,6 +4903,58 @@ static int lfs_init(lfs_t *lfs, const struct lfs_config *cfg) {
         }
     }
 
+    // setup line cache, optional
+    if (lfs->cfg->read_cache_ways) {
+        lfs->lcache.size = lfs->cfg->read_cache_line;
+        if (!lfs->lcache.size) {
+            lfs->lcache.size = lfs->cfg->cache_size;
+        }
+
+        LFS_ASSERT(lfs->cfg->read_cache_sets > 0);
+        LFS_ASSERT(lfs->lcache.size % lfs->cfg->read_size == 0);
+        LFS_ASSERT(lfs->cfg->block_size % lfs->lcache.size == 0);
+
+        lfs_size_t count = lfs->cfg->read_cache_ways*lfs->cfg->read_cache_sets;
+        lfs->lcache.lines = lfs_malloc(count*sizeof(*lfs->lcache.lines));
+        lfs->lcache.buffer = lfs_malloc(count*lfs->lcache.size);
+        if (!lfs->lcache.lines || !lfs->lcache.buffer) {
+            err = LFS_ERR_NOMEM;
+            goto cleanup;
+        }
+
+        for (lfs_size_t i = 0; i < count; i++) {
+            lfs->lcache.lines[i].block = LFS_BLOCK_NULL;
+            lfs->lcache.lines[i].off = 0;
+            lfs->lcache.lines[i].used = 0;
+        }
+    }
+
+    // setup mdir cache, optional
+    if (lfs->cfg->mdir_cache_size) {
+        lfs->mcache.sets = (lfs->cfg->mdir_cache_size+LFS_MCACHE_WAYS-1)
+                / LFS_MCACHE_WAYS;
+        lfs_size_t count = lfs->mcache.sets*LFS_MCACHE_WAYS;
+        lfs->mcache.entries = lfs_malloc(count*sizeof(*lfs->mcache.entries));
+        if (!lfs->mcache.entries) {
+            err = LFS_ERR_NOMEM;
+            goto cleanup;
+        }
+
+        for (lfs_size_t i = 0; i < count; i++) {
+            lfs->mcache.entries[i].tags = NULL;
+            lfs_mcache_clear(&lfs->mcache.entries[i]);
+        }
+
+        lfs->mcache.writes = lfs_malloc(
+                lfs->cfg->block_count*sizeof(*lfs->mcache.writes));
+        if (!lfs->mcache.writes) {
+            err = LFS_ERR_NOMEM;
+            goto cleanup;
+        }
+        memset(lfs->mcache.writes, 0,
+                lfs->cfg->block_count*sizeof(*lfs->mcache.writes));
+    }
+
     // check that the size limits are sane
     LFS_ASSERT(lfs->cfg->name_max <= LFS_NAME_MAX);
     lfs->name_max = lfs->cfg->name_max;
@@ -3467,6 +4974,30 @@ static int lfs_init(lfs_t *lfs, const struct lfs_config *cfg) {
         lfs->attr_max = LFS_ATTR_MAX;
     }
 
+    // setup name index, optional, it relies on the mdir cache to notice
+    // writes
+    if (lfs->cfg->name_index_size && lfs->mcache.writes) {
+        LFS_ASSERT(lfs->cfg->name_index_size < 0xffff);
+        lfs->nindex.name_max = lfs->name_max;
+        lfs->nindex.dirs = lfs_malloc(
+                lfs->cfg->name_index_size*sizeof(*lfs->nindex.dirs));
+        lfs->nindex.owners = lfs_malloc(
+                lfs->cfg->block_count*sizeof(*lfs->nindex.owners));
+        lfs->nindex.positions = lfs_malloc(
+                lfs->cfg->block_count*sizeof(*lfs->nindex.positions));
+        lfs->nindex.buffer = lfs_malloc(lfs->nindex.name_max);
+        if (!lfs->nindex.dirs || !lfs->nindex.owners ||
+                !lfs->nindex.positions || !lfs->nindex.buffer) {
+            err = LFS_ERR_NOMEM;
+            goto cleanup;
+        }
+
+        memset(lfs->nindex.dirs, 0,
+                lfs->cfg->name_index_size*sizeof(*lfs->nindex.dirs));
+        memset(lfs->nindex.owners, 0,
+                lfs->cfg->block_count*sizeof(*lfs->nindex.owners));
+    }
+
     // setup default state
     lfs->root[0] = LFS_BLOCK_NULL;
     lfs->root[1] = LFS_BLOCK_NULL;
@@ -3500,6 +5031,39 @@ static int lfs_deinit(lfs_t *lfs) {
         lfs_free(lfs->free.buffer);
     }
 
+    lfs_free(lfs->lcache.lines);
+    lfs_free(lfs->lcache.buffer);
+    lfs->lcache.lines = NULL;
+    lfs->lcache.buffer = NULL;
+
+    if (lfs->nindex.dirs) {
+        for (lfs_size_t i = 0; i < lfs->cfg->name_index_size; i++) {
+            lfs_free(lfs->nindex.dirs[i].pairs);
+            lfs_free(lfs->nindex.dirs[i].names);
+            lfs_free(lfs->nindex.dirs[i].tree);
+        }
+    }
+
+    lfs_free(lfs->nindex.dirs);
+    lfs_free(lfs->nindex.owners);
+    lfs_free(lfs->nindex.positions);
+    lfs_free(lfs->nindex.buffer);
+    lfs->nindex.dirs = NULL;
+    lfs->nindex.owners = NULL;
+    lfs->nindex.positions = NULL;
+    lfs->nindex.buffer = NULL;
+
+    if (lfs->mcache.entries) {
+        for (lfs_size_t i = 0; i < lfs->mcache.sets*LFS_MCACHE_WAYS; i++) {
+            lfs_mcache_clear(&lfs->mcache.entries[i]);
+        }
+    }
+
+    lfs_free(lfs->mcache.entries);
+    lfs_free(lfs->mcache.writes);
+    lfs->mcache.entries = NULL;
+    lfs->mcache.writes = NULL;
+
     return 0;
 }
 
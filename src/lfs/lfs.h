@@ -209,7 +209,9 @@ struct lfs_config {
     // Size of the lookahead buffer in bytes. A larger lookahead buffer
     // increases the number of blocks found during an allocation pass. The
     // lookahead buffer is stored as a compact bitmap, so each byte of RAM
-    // can track 8 blocks. Must be a multiple of 8.
+    // can track 8 blocks. Must be a multiple of 8. When it tracks at least
+    // block_count blocks the allocator runs in whole-image mode and traverses
+    // the filesystem once per pass over the device, see lfs_alloc_full.
     lfs_size_t lookahead_size;
 
     // Optional statically allocated read buffer. Must be cache_size.
@@ -240,6 +242,54 @@ struct lfs_config {
     // larger attributes size but must be <= LFS_ATTR_MAX. Defaults to
     // LFS_ATTR_MAX when zero.
     lfs_size_t attr_max;
+
+    // Optional set-associative read cache behind the read cache, for hosts
+    // with RAM to spare. Holds read_cache_sets sets of read_cache_ways lines,
+    // keyed by block and offset, so alternating reads of a few blocks stop
+    // evicting each other. Disabled when read_cache_ways is zero. Lines are
+    // read_cache_line bytes, cache_size when zero, and must be a multiple of
+    // the read size and a factor of the block size.
+    lfs_size_t read_cache_ways;
+    lfs_size_t read_cache_sets;
+    lfs_size_t read_cache_line;
+
+    // Optional number of fetched metadata pairs to keep in RAM, in sets of
+    // LFS_MCACHE_WAYS. A pair that was fetched before and has not been
+    // programmed or erased since is not read and checked again, lookups in
+    // it only rescan its tags, and lfs_dir_get finds tags through an index
+    // built once per fetch instead of reading the log backwards. Also takes
+    // a 32-bit write counter per block. Disabled when zero.
+    lfs_size_t mdir_cache_size;
+
+    // Optional number of directories spanning several metadata pairs to keep
+    // a name index of. The index holds the greatest name of each pair, so
+    // lfs_dir_find goes straight to the pair a name sorts into instead of
+    // searching every pair before it. Takes 48 bits per block and name_max
+    // bytes per indexed pair. Needs mdir_cache_size, disabled when zero.
+    lfs_size_t name_index_size;
+
+    // Optional split policy for directories filled in name order. A pair at
+    // the end of its directory that overflows on a commit to its last entry
+    // splits off just that entry instead of half its entries, so the entries
+    // already compacted are not copied again and pairs end up full instead
+    // of a quarter full. Disabled when false.
+    bool bulk_load;
+
+    // Optional number of blocks of the CTZ skip list each open file keeps
+    // the position of. A seek or block crossing walks the list from the
+    // nearest known block after the target instead of from the file head,
+    // so reads in order take about one pointer per block and random reads
+    // O(log distance) pointers. Takes 8 bytes per block per open file.
+    // Disabled when zero.
+    lfs_size_t ctz_cache_size;
+
+    // Optional one-pass compaction. The tags a compaction keeps are found in
+    // a single backward pass over the log instead of a pass over the rest of
+    // the log per tag, which makes compacting a pair linear in its tags
+    // instead of quadratic. Takes about 10 KiB plus 36 bytes per tag of the
+    // log for the length of each compaction, which falls back to the passes
+    // if the allocation fails. Disabled when false.
+    bool compact_table;
 };
 
 // File info structure
@@ -343,6 +393,16 @@ typedef struct lfs_file {
     lfs_off_t off;
     lfs_cache_t cache;
 
+    // blocks of ctz resolved by lfs_ctz_find, replaced in turn
+    struct lfs_ctzcache {
+        struct lfs_ctzpos {
+            lfs_off_t index;
+            lfs_block_t block;
+        } *entries;
+        lfs_size_t count;
+        lfs_size_t next;
+    } ctzcache;
+
     const struct lfs_file_config *cfg;
 } lfs_file_t;
 
@@ -355,6 +415,17 @@ typedef struct lfs_superblock {
     lfs_size_t attr_max;
 } lfs_superblock_t;
 
+// Ways per set of the fetched metadata pair cache
+#ifndef LFS_MCACHE_WAYS
+#define LFS_MCACHE_WAYS 4
+#endif
+
+// Pairs of a name indexed directory written to between two lookups that are
+// rechecked one by one, more rebuild the index
+#ifndef LFS_NINDEX_DIRTY
+#define LFS_NINDEX_DIRTY 8
+#endif
+
 // The littlefs filesystem type
 typedef struct lfs {
     lfs_cache_t rcache;
@@ -382,6 +453,111 @@ typedef struct lfs {
         uint32_t *buffer;
     } free;
 
+    struct lfs_lcache {
+        struct lfs_lcache_line {
+            lfs_block_t block;
+            lfs_off_t off;
+            // clock of the last hit, 0 when empty
+            uint32_t used;
+        } *lines;
+        uint8_t *buffer;
+        lfs_size_t size;
+        uint32_t clock;
+
+        // reads served by the caches and reads that went to the block
+        // device, counted with or without lines
+        uint32_t hits;
+        uint32_t misses;
+    } lcache;
+
+    struct lfs_mcache {
+        struct lfs_mcache_entry {
+            lfs_mdir_t m;
+            // crcs the fetch folded into the seed
+            uint32_t seed;
+            // writes of m.pair when fetched, stale once they differ
+            uint32_t writes[2];
+            // clock of the last hit, 0 when empty
+            uint32_t used;
+
+            // tags of m.pair[0] up to m.off, linked newest first by the id
+            // they have after all splices, built on the first lookup
+            struct lfs_mtag {
+                uint32_t tag;
+                lfs_off_t off;
+                // older tag with the same id, 0xffff when none
+                uint16_t next;
+            } *tags;
+            // newest tag per id
+            uint16_t *ids;
+            lfs_size_t tagcount;
+            uint16_t idcount;
+            // most ids the log ever spans, lookups with a narrower id mask
+            // would alias
+            uint16_t idmax;
+            bool unindexed;
+        } *entries;
+        // programs and erases per block
+        uint32_t *writes;
+        lfs_size_t sets;
+        uint32_t clock;
+
+        uint32_t hits;
+        uint32_t misses;
+        // lfs_dir_get lookups answered by a tag index
+        uint32_t indexed;
+    } mcache;
+
+    struct lfs_nindex {
+        struct lfs_ndir {
+            // first pair of the directory
+            lfs_block_t head[2];
+            // clock of the last lookup, 0 when empty
+            uint32_t used;
+
+            // pairs of the directory in order
+            struct lfs_npair {
+                lfs_block_t pair[2];
+                lfs_block_t tail[2];
+                bool split;
+                // size of the greatest name, 0 when there are none
+                lfs_size_t size;
+            } *pairs;
+            // greatest name of each pair
+            uint8_t *names;
+            // max tree over the names, pair of the greatest name per node
+            lfs_size_t *tree;
+            lfs_size_t count;
+            lfs_size_t capacity;
+
+            // positions of pairs written since the last lookup, a count
+            // past LFS_NINDEX_DIRTY rebuilds the index
+            lfs_size_t dirty[LFS_NINDEX_DIRTY];
+            lfs_size_t dirtycount;
+        } *dirs;
+        // directory of each block plus one, 0 when none, and its position
+        uint16_t *owners;
+        lfs_size_t *positions;
+        uint8_t *buffer;
+        lfs_size_t name_max;
+        uint32_t clock;
+
+        // lookups that went straight to a pair, and pairs not searched
+        uint32_t seeks;
+        uint32_t skipped;
+    } nindex;
+
+#ifdef LFS_YES_TRAVERSE_STATS
+    // work of lfs_dir_traverse, tags it visited over the commits that ran
+    // it and the deepest its stack got, only counted in builds that define
+    // LFS_YES_TRAVERSE_STATS as it is the inner loop of every compaction
+    struct lfs_traverse {
+        uint32_t commits;
+        uint32_t tags;
+        uint8_t depth;
+    } traverse;
+#endif
+
     const struct lfs_config *cfg;
     lfs_size_t name_max;
     lfs_size_t file_max;
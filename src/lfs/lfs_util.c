@@ -9,9 +9,20 @@
 // Only compile if user does not provide custom config
 #ifndef LFS_CONFIG
 
+#if defined(__GNUC__) && defined(__x86_64__)
+#define LFS_CRC_CLMUL
+#include <emmintrin.h>
+#include <wmmintrin.h>
+#elif defined(__GNUC__) && defined(__aarch64__) && defined(__linux__) && \
+        __BYTE_ORDER__ == __ORDER_LITTLE_ENDIAN__
+#define LFS_CRC_ARM
+#include <arm_acle.h>
+#include <sys/auxv.h>
+#endif
+
 
 // Software CRC implementation with small lookup table
-uint32_t lfs_crc(uint32_t crc, const void *buffer, size_t size) {
+uint32_t lfs_crc_nibble(uint32_t crc, const void *buffer, size_t size) {
     static const uint32_t rtable[16] = {
         0x00000000, 0x1db71064, 0x3b6e20c8, 0x26d930ac,
         0x76dc4190, 0x6b6b51f4, 0x4db26158, 0x5005713c,
@@ -29,5 +40,188 @@ uint32_t lfs_crc(uint32_t crc, const void *buffer, size_t size) {
     return crc;
 }
 
+#ifdef __GNUC__
+
+// Slicing-by-8, stable[k][n] is the crc of byte n followed by k zero bytes
+static uint32_t lfs_crc_stable[8][256];
+
+static void lfs_crc_stable_init(void) {
+    for (int n = 0; n < 256; n++) {
+        uint8_t byte = n;
+        lfs_crc_stable[0][n] = lfs_crc_nibble(0, &byte, 1);
+    }
+
+    for (int k = 1; k < 8; k++) {
+        for (int n = 0; n < 256; n++) {
+            uint32_t crc = lfs_crc_stable[k-1][n];
+            lfs_crc_stable[k][n] = (crc >> 8) ^ lfs_crc_stable[0][crc & 0xff];
+        }
+    }
+}
+
+uint32_t lfs_crc_slice8(uint32_t crc, const void *buffer, size_t size) {
+    const uint8_t *data = buffer;
+
+    for (; size >= 8; data += 8, size -= 8) {
+        uint32_t a = crc ^ (((uint32_t)data[0] <<  0) |
+                            ((uint32_t)data[1] <<  8) |
+                            ((uint32_t)data[2] << 16) |
+                            ((uint32_t)data[3] << 24));
+        crc = lfs_crc_stable[7][(a >>  0) & 0xff] ^
+              lfs_crc_stable[6][(a >>  8) & 0xff] ^
+              lfs_crc_stable[5][(a >> 16) & 0xff] ^
+              lfs_crc_stable[4][(a >> 24) & 0xff] ^
+              lfs_crc_stable[3][data[4]] ^
+              lfs_crc_stable[2][data[5]] ^
+              lfs_crc_stable[1][data[6]] ^
+              lfs_crc_stable[0][data[7]];
+    }
+
+    for (; size > 0; data += 1, size -= 1) {
+        crc = (crc >> 8) ^ lfs_crc_stable[0][(crc ^ data[0]) & 0xff];
+    }
+
+    return crc;
+}
+
+#else
+
+uint32_t lfs_crc_slice8(uint32_t crc, const void *buffer, size_t size) {
+    return lfs_crc_nibble(crc, buffer, size);
+}
+
+#endif
+
+#if defined(LFS_CRC_CLMUL)
+
+// a.lo*k.lo ^ a.hi*k.hi ^ b, folds a forward by the distance k encodes
+__attribute__((target("pclmul")))
+static inline __m128i lfs_crc_fold(__m128i a, __m128i k, __m128i b) {
+    return _mm_xor_si128(_mm_xor_si128(
+            _mm_clmulepi64_si128(a, k, 0x00),
+            _mm_clmulepi64_si128(a, k, 0x11)), b);
+}
+
+// Carry-less multiplication folding, "Fast CRC Computation for Generic
+// Polynomials Using PCLMULQDQ Instruction" (Intel, 2009), bit-reflected.
+// Folds 64 bytes per step, the tail goes through slicing-by-8.
+__attribute__((target("pclmul")))
+static uint32_t lfs_crc_clmul(uint32_t crc, const void *buffer, size_t size) {
+    const uint8_t *data = buffer;
+    if (size < 64) {
+        return lfs_crc_slice8(crc, data, size);
+    }
+
+    // x^(512+32) and x^(512-32) mod P, bit-reflected and shifted by one
+    const __m128i k512 = _mm_set_epi64x(0x1c6e41596, 0x154442bd4);
+    // same for 128 bits
+    const __m128i k128 = _mm_set_epi64x(0x0ccaa009e, 0x1751997d0);
+    // x^64 mod P
+    const __m128i k64 = _mm_set_epi64x(0, 0x163cd6124);
+    // Barrett constants, mu and P
+    const __m128i barrett = _mm_set_epi64x(0x1f7011641, 0x1db710641);
+    const __m128i mask32 = _mm_set_epi32(0, 0, 0, -1);
+
+    __m128i x0 = _mm_loadu_si128((const __m128i*)(data +  0));
+    __m128i x1 = _mm_loadu_si128((const __m128i*)(data + 16));
+    __m128i x2 = _mm_loadu_si128((const __m128i*)(data + 32));
+    __m128i x3 = _mm_loadu_si128((const __m128i*)(data + 48));
+    x0 = _mm_xor_si128(x0, _mm_cvtsi32_si128(crc));
+    data += 64;
+    size -= 64;
+
+    for (; size >= 64; data += 64, size -= 64) {
+        x0 = lfs_crc_fold(x0, k512,
+                _mm_loadu_si128((const __m128i*)(data +  0)));
+        x1 = lfs_crc_fold(x1, k512,
+                _mm_loadu_si128((const __m128i*)(data + 16)));
+        x2 = lfs_crc_fold(x2, k512,
+                _mm_loadu_si128((const __m128i*)(data + 32)));
+        x3 = lfs_crc_fold(x3, k512,
+                _mm_loadu_si128((const __m128i*)(data + 48)));
+    }
+
+    x0 = lfs_crc_fold(x0, k128, x1);
+    x0 = lfs_crc_fold(x0, k128, x2);
+    x0 = lfs_crc_fold(x0, k128, x3);
+
+    for (; size >= 16; data += 16, size -= 16) {
+        x0 = lfs_crc_fold(x0, k128, _mm_loadu_si128((const __m128i*)data));
+    }
+
+    // 128 bits to 64, then to 32 with a Barrett reduction
+    x0 = _mm_xor_si128(_mm_srli_si128(x0, 8),
+            _mm_clmulepi64_si128(x0, k128, 0x10));
+    x0 = _mm_xor_si128(_mm_srli_si128(x0, 4),
+            _mm_clmulepi64_si128(_mm_and_si128(x0, mask32), k64, 0x00));
+
+    __m128i t = _mm_clmulepi64_si128(_mm_and_si128(x0, mask32), barrett, 0x10);
+    t = _mm_clmulepi64_si128(_mm_and_si128(t, mask32), barrett, 0x00);
+    crc = _mm_cvtsi128_si32(_mm_srli_si128(_mm_xor_si128(x0, t), 4));
+
+    return lfs_crc_slice8(crc, data, size);
+}
+
+#elif defined(LFS_CRC_ARM)
+
+// The ARMv8 CRC32 instructions use this polynomial, no folding needed
+__attribute__((target("+crc")))
+static uint32_t lfs_crc_arm(uint32_t crc, const void *buffer, size_t size) {
+    const uint8_t *data = buffer;
+
+    for (; size >= 8; data += 8, size -= 8) {
+        uint64_t word;
+        memcpy(&word, data, sizeof(word));
+        crc = __crc32d(crc, word);
+    }
+
+    for (; size > 0; data += 1, size -= 1) {
+        crc = __crc32b(crc, data[0]);
+    }
+
+    return crc;
+}
+
+#endif
+
+lfs_crc_t lfs_crc_hw(void) {
+#if defined(LFS_CRC_CLMUL)
+    __builtin_cpu_init();
+    if (__builtin_cpu_supports("pclmul")) {
+        return lfs_crc_clmul;
+    }
+#elif defined(LFS_CRC_ARM)
+    if (getauxval(AT_HWCAP) & HWCAP_CRC32) {
+        return lfs_crc_arm;
+    }
+#endif
+    return NULL;
+}
+
+#ifdef __GNUC__
+
+static lfs_crc_t lfs_crc_impl = lfs_crc_nibble;
+
+// Runs before main, so lfs_crc never races with the dispatch
+__attribute__((constructor))
+static void lfs_crc_init(void) {
+    lfs_crc_stable_init();
+
+    lfs_crc_t hw = lfs_crc_hw();
+    lfs_crc_impl = hw ? hw : lfs_crc_slice8;
+}
+
+uint32_t lfs_crc(uint32_t crc, const void *buffer, size_t size) {
+    return lfs_crc_impl(crc, buffer, size);
+}
+
+#else
+
+uint32_t lfs_crc(uint32_t crc, const void *buffer, size_t size) {
+    return lfs_crc_nibble(crc, buffer, size);
+}
+
+#endif
+
 
 #endif
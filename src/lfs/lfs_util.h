@@ -201,6 +201,15 @@ static inline uint32_t lfs_tobe32(uint32_t a) {
 // Calculate CRC-32 with polynomial = 0x04c11db7
 uint32_t lfs_crc(uint32_t crc, const void *buffer, size_t size);
 
+// Implementations behind lfs_crc, all give the same result. lfs_crc uses
+// the hardware one when the CPU has it and slicing-by-8 otherwise.
+typedef uint32_t (*lfs_crc_t)(uint32_t crc, const void *buffer, size_t size);
+uint32_t lfs_crc_nibble(uint32_t crc, const void *buffer, size_t size);
+uint32_t lfs_crc_slice8(uint32_t crc, const void *buffer, size_t size);
+// PCLMULQDQ folding on x86-64, CRC32 instructions on arm64, NULL if the CPU
+// has neither
+lfs_crc_t lfs_crc_hw(void);
+
 // Allocate memory, only used if buffers are not provided to littlefs
 // Note, memory must be 64-bit aligned
 static inline void *lfs_malloc(size_t size) {
@@ -17,9 +17,12 @@
 #include <stdio.h>
 #include <stdlib.h>
 #include <stdbool.h>
+#include <inttypes.h>
 #include <string.h>
 #include <errno.h>
 #include <unistd.h>
+#include <getopt.h>
+#include <pthread.h>
 
 #include <sys/stat.h>
 #include <sys/types.h>
@@ -27,26 +30,109 @@
 
 #include "vfs_lfs.h"
 #include "vfs_native.h"
+#include "vfs_cache.h"
+#include "bd_trace.h"
+#include "bd_flash.h"
 #include "macro.h"
 #include "util.h"
 
-static uint8_t m_buffer[4096];
+#define COPY_BUFFER_SIZE 4096
 
 typedef enum {
     ACTION_NONE = 0,
     ACTION_EXTRACT,
     ACTION_CREATE,
-    ACTION_INTERACTION
+    ACTION_INTERACTION,
+    ACTION_REPLAY,
+    ACTION_JOBS,
+    ACTION_WORKLOAD,
+    ACTION_AUTOTUNE
 } action_t;
 
+// long-only options
+enum {
+    OPT_STATS = 0x100,
+    OPT_TRACE,
+    OPT_REPLAY,
+    OPT_JOBS,
+    OPT_THREADS,
+    OPT_SOURCE_CACHE,
+    OPT_FLASH,
+    OPT_WORKLOAD,
+    OPT_WEAR,
+    OPT_BLOCK_CYCLES,
+    OPT_READ_SIZE,
+    OPT_PROG_SIZE,
+    OPT_CACHE_SIZE,
+    OPT_LOOKAHEAD_SIZE,
+    OPT_AUTOTUNE,
+    OPT_READ_CACHE,
+    OPT_MDIR_CACHE,
+    OPT_NAME_INDEX,
+    OPT_BULK_LOAD,
+    OPT_CTZ_CACHE,
+};
+
+static const struct option m_long_options[] = {
+    {"stats", optional_argument, NULL, OPT_STATS},
+    {"trace", required_argument, NULL, OPT_TRACE},
+    {"replay", required_argument, NULL, OPT_REPLAY},
+    {"jobs", required_argument, NULL, OPT_JOBS},
+    {"threads", required_argument, NULL, OPT_THREADS},
+    {"source-cache", required_argument, NULL, OPT_SOURCE_CACHE},
+    {"flash", required_argument, NULL, OPT_FLASH},
+    {"workload", required_argument, NULL, OPT_WORKLOAD},
+    {"wear", required_argument, NULL, OPT_WEAR},
+    {"block-cycles", required_argument, NULL, OPT_BLOCK_CYCLES},
+    {"read-size", required_argument, NULL, OPT_READ_SIZE},
+    {"prog-size", required_argument, NULL, OPT_PROG_SIZE},
+    {"cache-size", required_argument, NULL, OPT_CACHE_SIZE},
+    {"lookahead-size", required_argument, NULL, OPT_LOOKAHEAD_SIZE},
+    {"autotune", no_argument, NULL, OPT_AUTOTUNE},
+    {"read-cache", required_argument, NULL, OPT_READ_CACHE},
+    {"mdir-cache", required_argument, NULL, OPT_MDIR_CACHE},
+    {"name-index", required_argument, NULL, OPT_NAME_INDEX},
+    {"bulk-load", no_argument, NULL, OPT_BULK_LOAD},
+    {"ctz-cache", required_argument, NULL, OPT_CTZ_CACHE},
+    {NULL, 0, NULL, 0},
+};
+
 struct options {
     const char *directory;
     const char *image;
     action_t action;
-    size_t name_max;
-    size_t io_size;
-    size_t block_size;
-    size_t block_count;
+    struct bd_config bd;
+    struct vfs_lfs_config lfs;
+    // JSON statistics output, NULL for the summary only
+    const char *stats_json;
+    const char *replay;
+    const char *jobs;
+    // worker threads for --jobs, 0 for one per CPU
+    size_t threads;
+    // MiB of source file data kept by --jobs, -1 for no limit, 0 for default
+    int32_t source_cache;
+    struct bd_flash flash;
+    // file list read by --workload
+    const char *workload;
+};
+
+// One image of a job file, geometry left 0 falls back to the options.
+struct job {
+    char *directory;
+    char *image;
+    struct vfs_lfs_config lfs;
+    int result;
+    uint64_t ns;
+};
+
+struct job_queue {
+    const struct options *options;
+    struct vfs_cache *cache;
+    struct job *jobs;
+    size_t count;
+    // next job to hand out
+    size_t next;
+    pthread_mutex_t mutex;
 };
 
 extern int cli_main(void *arg);
@@ -54,13 +140,55 @@ extern int cli_main(void *arg);
 static void usage(const char *name)
 {
     fprintf(stderr, "Usage:\n");
-    fprintf(stderr, "   %s [-n <max name length>] [-s <io size>] [-b <block size>] [-a <number of blocks>] -i <lfs image> -d <directory> (-x | -c)\n", name);
+    fprintf(stderr, "   %s [-n <max name length>] [-s <io size>] [-b <block size>] [-a <number of blocks>] [-t <block device> | -m] [-S] [-C <blocks>] [--stats[=<json file>]] [--trace <file>] -i <lfs image> -d <directory> (-x | -c)\n", name);
+    fprintf(stderr, "   %s [-t <block device> | -m] [-S] [-C <blocks>] [--stats[=<json file>]] --replay <trace> -i <lfs image>\n", name);
+    fprintf(stderr, "   %s [-n <max name length>] [-t <block device> | -m] [-S] [-C <blocks>] [--stats] [--threads <n>] [--source-cache <MiB>] --jobs <job file>\n", name);
+    fprintf(stderr, "   %s [-n <max name length>] [-s <io size>] [-b <block size>] [-a <number of blocks>] [--flash <model>] --workload <file list> -i <lfs image>\n", name);
+    fprintf(stderr, "   %s [-b <block size>] [-a <number of blocks>] [-t <block device> | -m] [--<read|prog|cache|lookahead>-size <n>] --autotune -i <scratch image> -d <directory>\n", name);
     fprintf(stderr, "   \n");
     fprintf(stderr, "   -n <max name length>   Maximum file name length.\n");
     fprintf(stderr, "   -s <io size>           IO size [default: 512].\n");
+    fprintf(stderr, "   --read-size <n>        lfs read size [default: io size].\n");
+    fprintf(stderr, "   --prog-size <n>        lfs prog size [default: io size].\n");
+    fprintf(stderr, "   --cache-size <n>       lfs cache size [default: io size].\n");
+    fprintf(stderr, "   --lookahead-size <n>   lfs lookahead size in bytes, 8 blocks per byte [default: io size,\n");
+    fprintf(stderr, "                          whole image without -s].\n");
+    fprintf(stderr, "   --read-cache <ways>,<sets>[,<line>]\n");
+    fprintf(stderr, "                          Set-associative lfs read cache, line in bytes [default: cache size].\n");
+    fprintf(stderr, "                          --stats prints its hit rate.\n");
+    fprintf(stderr, "   --mdir-cache <n>       Fetched lfs metadata pairs kept in RAM, 0 disables [default: 1024].\n");
+    fprintf(stderr, "   --name-index <n>       Large lfs directories indexed by name, 0 disables [default: 64].\n");
+    fprintf(stderr, "   --bulk-load            Fill lfs directories written in name order up to whole blocks, changes\n");
+    fprintf(stderr, "                          the image layout.\n");
+    fprintf(stderr, "   --ctz-cache <n>        Blocks of each open lfs file whose position is kept, 0 disables\n");
+    fprintf(stderr, "                          [default: 64].\n");
     fprintf(stderr, "   -b <block size>        Block size [default: 4096].\n");
     fprintf(stderr, "   -a <number of blocks>  Number of blocks [default: 4059].\n");
-    fprintf(stderr, "   -i <lfs image>         Path to lfs image.\n");
+    fprintf(stderr, "   -t <block device>      Image access: auto, mmap, pread, uring, ram, stdio [default: auto,\n");
+    fprintf(stderr, "                          mmap for files, stdio for block devices, ram for pipes].\n");
+    fprintf(stderr, "   -m                     Build the image in RAM and write it out once, same as -t ram.\n");
+    fprintf(stderr, "   -S                     Leave unused blocks as holes (read as zeroes) in created image.\n");
+    fprintf(stderr, "   -C <blocks>            Write-back block cache size in blocks [default: 0, disabled].\n");
+    fprintf(stderr, "   --stats[=<json file>]  Print block device statistics to stderr, and as JSON to file.\n");
+    fprintf(stderr, "   --trace <file>         Record block device operations to file.\n");
+    fprintf(stderr, "   --replay <trace>       Re-issue recorded operations against the image.\n");
+    fprintf(stderr, "   --jobs <job file>      Create the images listed in job file, one per line:\n");
+    fprintf(stderr, "                          <directory> <image> [<block size> [<number of blocks> [<io size>]]]\n");
+    fprintf(stderr, "                          Source files are read once and shared between jobs.\n");
+    fprintf(stderr, "   --threads <n>          Number of --jobs workers [default: number of CPUs].\n");
+    fprintf(stderr, "   --source-cache <MiB>   Source file data kept in memory by --jobs, least recently used\n");
+    fprintf(stderr, "                          files are read again, 0 keeps all [default: 1024].\n");
+    fprintf(stderr, "   --flash <model>        Charge operations to a flash timing model and print the device time,\n");
+    fprintf(stderr, "                          <nor|nand>[,<key>=<ns or bytes>...], keys: read_setup, read_byte,\n");
+    fprintf(stderr, "                          read_page, prog_page, prog_byte, page_size, erase.\n");
+    fprintf(stderr, "   --workload <file list> Mount the image and read the listed files, print the device time\n");
+    fprintf(stderr, "                          of each step [default model: nor].\n");
+    fprintf(stderr, "   --wear <file>          Write per-block erase and prog counts to file (CSV, JSON for *.json).\n");
+    fprintf(stderr, "   --block-cycles <n>     Erase cycles before lfs moves a metadata block, -1 disables [default: -1].\n");
+    fprintf(stderr, "   --autotune             Build the -d tree into the scratch image with a grid of read, prog, cache\n");
+    fprintf(stderr, "                          and lookahead sizes and print the fastest valid ones. Sizes given with\n");
+    fprintf(stderr, "                          --<...>-size are kept fixed. Point -d at a sample of the input.\n");
+    fprintf(stderr, "   -i <lfs image>         Path to lfs image, - for stdout/stdin.\n");
     fprintf(stderr, "   -d <directory>         Path to root directory.\n");
     fprintf(stderr, "   -x                     Extract files from image.\n");
     fprintf(stderr, "   -c                     Create image.\n");
@@ -74,6 +202,7 @@ static int process_file(struct vfs *vfs, struct vfs *target_vfs, const char *pat
 
     void *in = NULL;
     void *out = NULL;
+    uint8_t buffer[COPY_BUFFER_SIZE];
 
     INFO("process: %s", path);
 
@@ -84,10 +213,10 @@ static int process_file(struct vfs *vfs, struct vfs *target_vfs, const char *pat
     CHECK_ERROR(in != NULL, -1, "vfs->open() failed");
 
     int32_t rb = 0;
-    while ((rb = vfs->read(vfs, in, m_buffer, sizeof(m_buffer))) >= 0) {
-        int32_t wb = target_vfs->write(target_vfs, out, m_buffer, rb);
+    while ((rb = vfs->read(vfs, in, buffer, sizeof(buffer))) >= 0) {
+        int32_t wb = target_vfs->write(target_vfs, out, buffer, rb);
         CHECK_ERROR(wb == rb, -1, "target_vfs->write() failed");
-        if (rb != sizeof(m_buffer)) {
+        if (rb != sizeof(buffer)) {
             break;
         }
     }
@@ -192,6 +321,528 @@ done:
     return result;
 }
 
+static int string_to_int32(const char *str, int32_t *value)
+{
+    int result = 0;
+
+    CHECK_ERROR(str != NULL, -1, "str == NULL");
+    CHECK_ERROR(value != NULL, -1, "value == NULL");
+
+    char *endptr = NULL;
+    errno = 0;
+
+    long parsed = strtol(str, &endptr, 10);
+    CHECK_ERROR(endptr != str && errno == 0, -1, "invalid number: %s", str);
+    CHECK_ERROR(parsed >= INT32_MIN && parsed <= INT32_MAX, -1, "out of range: %s", str);
+
+    *value = (int32_t)parsed;
+
+done:
+    return result;
+}
+
+// Parses <ways>,<sets>[,<line>] of --read-cache.
+static int read_cache_parse(const char *str, struct vfs_lfs_config *lfs)
+{
+    int result = 0;
+
+    size_t ways = 0;
+    size_t sets = 0;
+    size_t line = 0;
+    int end = 0;
+
+    // CHECK_ERROR() prints its condition as a format, keep sscanf() out of it
+    int n = sscanf(str, "%zu,%zu%n", &ways, &sets, &end);
+    const char *rest = str + end;
+    if (n == 2 && *rest == ',') {
+        end = 0;
+        n = sscanf(rest + 1, "%zu%n", &line, &end) == 1 ? 2 : 0;
+        rest += 1 + end;
+    }
+    bool valid = n == 2 && *rest == '\0' && ways != 0 && sets != 0;
+    CHECK_ERROR(valid, -1, "invalid read cache: %s", str);
+
+    lfs->read_cache_ways = ways;
+    lfs->read_cache_sets = sets;
+    lfs->read_cache_line = line;
+
+done:
+    return result;
+}
+
+static FILE *stats_json_open(const struct options *options)
+{
+    FILE *json = NULL;
+
+    if (options->stats_json != NULL) {
+        json = strcmp(options->stats_json, "-") == 0 ? stdout : fopen(options->stats_json, "w");
+        if (json == NULL) {
+            ERROR("cannot open %s: %s", options->stats_json, strerror(errno));
+        }
+    }
+
+    return json;
+}
+
+static void flash_report(const struct bd_flash *flash, FILE *out)
+{
+    fprintf(out, "predicted device time (%s): %.3f ms, read: %.3f ms, prog: %.3f ms, erase: %.3f ms\n", flash->name,
+            bd_flash_elapsed(flash) / 1e6, flash->read_time / 1e6, flash->prog_time / 1e6, flash->erase_time / 1e6);
+}
+
+// Mounts the image and reads every file of the list (one path per line),
+// printing the simulated device time of each step. vfs is left mounted.
+static int workload_run(struct vfs *vfs, const char *list, const struct bd_flash *flash)
+{
+    int result = 0;
+
+    FILE *file = NULL;
+    void *fd = NULL;
+    char line[VFS_MAX_NAME_LEN];
+    uint8_t buffer[COPY_BUFFER_SIZE];
+
+    file = fopen(list, "r");
+    CHECK_ERROR(file != NULL, -1, "fopen(%s) failed: %s", list, strerror(errno));
+
+    fprintf(stderr, "predicted device time (%s):\n", flash->name);
+
+    uint64_t start = bd_flash_elapsed(flash);
+    int err = vfs->mount(vfs);
+    CHECK_ERROR(err == 0, -1, "vfs->mount() failed: %d", err);
+    fprintf(stderr, "  %-48s %12s %12.3f ms\n", "mount", "", (bd_flash_elapsed(flash) - start) / 1e6);
+
+    while (fgets(line, sizeof(line), file) != NULL) {
+        char *path = line + strspn(line, " \t");
+        path[strcspn(path, "\r\n")] = '\0';
+        if (path[0] == '\0' || path[0] == '#') {
+            continue;
+        }
+
+        start = bd_flash_elapsed(flash);
+
+        fd = vfs->open(vfs, path, O_RDONLY);
+        CHECK_ERROR(fd != NULL, -1, "vfs->open(%s) failed", path);
+
+        uint64_t size = 0;
+        int32_t rb = 0;
+        while ((rb = vfs->read(vfs, fd, buffer, sizeof(buffer))) > 0) {
+            size += rb;
+        }
+        CHECK_ERROR(rb == 0, -1, "vfs->read(%s) failed: %d", path, rb);
+
+        err = vfs->close(vfs, fd);
+        fd = NULL;
+        CHECK_ERROR(err == 0, -1, "vfs->close(%s) failed: %d", path, err);
+
+        fprintf(stderr, "  %-48s %10" PRIu64 " B %12.3f ms\n", path, size, (bd_flash_elapsed(flash) - start) / 1e6);
+    }
+
+    CHECK_ERROR(ferror(file) == 0, -1, "fgets() failed: %s", strerror(errno));
+
+    fprintf(stderr, "  %-48s %12s %12.3f ms\n", "total", "", bd_flash_elapsed(flash) / 1e6);
+
+done:
+    if (fd != NULL) {
+        vfs->close(vfs, fd);
+    }
+    if (file != NULL) {
+        fclose(file);
+    }
+    return result;
+}
+
+static void jobs_free(struct job *jobs, size_t count)
+{
+    for (size_t i = 0; i < count; i++) {
+        free(jobs[i].directory);
+        free(jobs[i].image);
+    }
+    free(jobs);
+}
+
+// Splits the next whitespace separated field off *line, NULL at the end.
+static char *next_field(char **line)
+{
+    char *field = *line + strspn(*line, " \t\r\n");
+    if (*field == '\0') {
+        return NULL;
+    }
+
+    char *end = field + strcspn(field, " \t\r\n");
+    *line = *end != '\0' ? end + 1 : end;
+    *end = '\0';
+    return field;
+}
+
+static int jobs_load(const char *path, struct job **jobs, size_t *count)
+{
+    int result = 0;
+
+    FILE *file = NULL;
+    struct job *list = NULL;
+    size_t n = 0;
+    size_t capacity = 0;
+    size_t line_number = 0;
+    char line[4096];
+
+    file = fopen(path, "r");
+    CHECK_ERROR(file != NULL, -1, "fopen(%s) failed: %s", path, strerror(errno));
+
+    while (fgets(line, sizeof(line), file) != NULL) {
+        line_number++;
+        CHECK_ERROR(strchr(line, '\n') != NULL || feof(file), -1, "%s:%zu: line is too long", path, line_number);
+
+        char *p = line;
+        char *directory = next_field(&p);
+        if (directory == NULL || directory[0] == '#') {
+            continue;
+        }
+
+        char *image = next_field(&p);
+        CHECK_ERROR(image != NULL, -1, "%s:%zu: image is missing", path, line_number);
+        CHECK_ERROR(strcmp(image, "-") != 0, -1, "%s:%zu: jobs cannot write to stdout", path, line_number);
+
+        if (n == capacity) {
+            capacity = capacity != 0 ? capacity * 2 : 16;
+            struct job *grown = realloc(list, capacity * sizeof(*list));
+            CHECK_ERROR(grown != NULL, -1, "realloc() failed");
+            list = grown;
+        }
+
+        struct job *job = &list[n++];
+        memset(job, 0, sizeof(*job));
+
+        job->directory = strdup(directory);
+        job->image = strdup(image);
+        CHECK_ERROR(job->directory != NULL && job->image != NULL, -1, "strdup() failed");
+
+        size_t *geometry[] = {&job->lfs.block_size, &job->lfs.block_count, &job->lfs.io_size};
+        for (size_t i = 0; i < sizeof(geometry) / sizeof(geometry[0]); i++) {
+            char *field = next_field(&p);
+            if (field == NULL) {
+                break;
+            }
+            CHECK_ERROR(string_to_size(field, geometry[i]) == 0, -1, "%s:%zu: bad number", path, line_number);
+        }
+
+        CHECK_ERROR(next_field(&p) == NULL, -1, "%s:%zu: too many fields", path, line_number);
+    }
+
+    CHECK_ERROR(ferror(file) == 0, -1, "fgets() failed: %s", strerror(errno));
+    CHECK_ERROR(n != 0, -1, "%s has no jobs", path);
+
+    *jobs = list;
+    *count = n;
+    list = NULL;
+    n = 0;
+
+done:
+    jobs_free(list, n);
+    if (file != NULL) {
+        fclose(file);
+    }
+    return result;
+}
+
+static int job_run(struct job_queue *queue, struct job *job)
+{
+    int result = 0;
+
+    const struct options *options = queue->options;
+    struct vfs *source = NULL;
+    struct vfs *image = NULL;
+    bool mounted = false;
+
+    source = vfs_cache_get(queue->cache, job->directory);
+    CHECK_ERROR(source != NULL, -1, "vfs_cache_get() failed");
+
+    struct vfs_lfs_config lfs = options->lfs;
+    if (job->lfs.io_size != 0) {
+        lfs.io_size = job->lfs.io_size;
+    }
+    if (job->lfs.block_size != 0) {
+        lfs.block_size = job->lfs.block_size;
+    }
+    if (job->lfs.block_count != 0) {
+        lfs.block_count = job->lfs.block_count;
+    }
+
+    image = vfs_lfs_get(job->image, true, &options->bd, &lfs);
+    CHECK_ERROR(image != NULL, -1, "vfs_lfs_get(%s) failed", job->image);
+
+    int err = image->mount(image);
+    CHECK_ERROR(err == 0, -1, "vfs->mount() failed: %d", err);
+    mounted = true;
+
+    err = traversal(source, image, "/");
+    CHECK_ERROR(err == 0, -1, "traversal(%s) failed: %d", job->directory, err);
+
+done:
+    if (mounted && image->unmount(image) != 0) {
+        ERROR("vfs->unmount(%s) failed", job->image);
+        result = -1;
+    }
+    if (image != NULL) {
+        if (options->bd.stats) {
+            pthread_mutex_lock(&queue->mutex);
+            fprintf(stderr, "%s:\n", job->image);
+            vfs_lfs_report(image, stderr, NULL);
+            pthread_mutex_unlock(&queue->mutex);
+        }
+        if (vfs_lfs_put(image) != 0) {
+            ERROR("vfs_lfs_put(%s) failed", job->image);
+            result = -1;
+        }
+    }
+    if (source != NULL) {
+        vfs_cache_put(source);
+    }
+    return result;
+}
+
+static void *job_worker(void *arg)
+{
+    struct job_queue *queue = arg;
+
+    while (true) {
+        pthread_mutex_lock(&queue->mutex);
+        struct job *job = queue->next < queue->count ? &queue->jobs[queue->next++] : NULL;
+        pthread_mutex_unlock(&queue->mutex);
+
+        if (job == NULL) {
+            break;
+        }
+
+        uint64_t start = now_ns();
+        job->result = job_run(queue, job);
+        job->ns = now_ns() - start;
+    }
+
+    return NULL;
+}
+
+static int jobs_run(const struct options *options)
+{
+    int result = 0;
+
+    struct job_queue queue = {0};
+    pthread_t *threads = NULL;
+    size_t started = 0;
+    bool mutex = false;
+
+    queue.options = options;
+
+    int err = jobs_load(options->jobs, &queue.jobs, &queue.count);
+    CHECK_ERROR(err == 0, -1, "jobs_load() failed: %d", err);
+
+    size_t source_cache = options->source_cache < 0 ? 0 : (size_t)(options->source_cache ? options->source_cache : 1024) << 20;
+    queue.cache = vfs_cache_create(source_cache);
+    CHECK_ERROR(queue.cache != NULL, -1, "vfs_cache_create() failed");
+
+    err = pthread_mutex_init(&queue.mutex, NULL);
+    CHECK_ERROR(err == 0, -1, "pthread_mutex_init() failed: %d", err);
+    mutex = true;
+
+    size_t thread_count = options->threads;
+#ifdef _SC_NPROCESSORS_ONLN
+    if (thread_count == 0) {
+        long cpus = sysconf(_SC_NPROCESSORS_ONLN);
+        thread_count = cpus > 0 ? (size_t)cpus : 1;
+    }
+#endif
+    if (thread_count == 0) {
+        thread_count = 1;
+    }
+    if (thread_count > queue.count) {
+        thread_count = queue.count;
+    }
+
+    threads = calloc(thread_count, sizeof(*threads));
+    CHECK_ERROR(threads != NULL, -1, "calloc() failed");
+
+    uint64_t start = now_ns();
+
+    for (; started < thread_count; started++) {
+        err = pthread_create(&threads[started], NULL, job_worker, &queue);
+        CHECK_ERROR(err == 0, -1, "pthread_create() failed: %d", err);
+    }
+
+done:
+    // the workers drain the queue even when not all of them started
+    for (size_t i = 0; i < started; i++) {
+        pthread_join(threads[i], NULL);
+    }
+
+    if (started != 0) {
+        uint64_t elapsed = now_ns() - start;
+        struct vfs_cache_stats stats = {0};
+        vfs_cache_get_stats(queue.cache, &stats);
+
+        fprintf(stderr, "jobs:\n");
+        for (size_t i = 0; i < queue.count; i++) {
+            const struct job *job = &queue.jobs[i];
+            fprintf(stderr, "  %-40s %10.1f ms  %s\n", job->image, job->ns / 1e6, job->result == 0 ? "ok" : "FAILED");
+            if (job->result != 0) {
+                result = -1;
+            }
+        }
+        fprintf(stderr, "  %zu jobs on %zu threads in %.1f ms\n", queue.count, started, elapsed / 1e6);
+        fprintf(stderr, "  source cache: hits: %" PRIu64 ", misses: %" PRIu64 ", bytes: %" PRIu64 ", evictions: %" PRIu64 "\n",
+                stats.hits, stats.misses, stats.bytes, stats.evictions);
+    }
+
+    free(threads);
+    if (mutex) {
+        pthread_mutex_destroy(&queue.mutex);
+    }
+    vfs_cache_destroy(queue.cache);
+    jobs_free(queue.jobs, queue.count);
+    return result;
+}
+
+// --autotune grid, sizes fixed on the command line are not searched. A
+// lookahead of 0 stands for one covering the whole image.
+static const size_t m_tune_read[] = {64, 256, 1024, 4096};
+static const size_t m_tune_prog[] = {64, 256, 1024};
+static const size_t m_tune_cache[] = {256, 1024, 4096, 16384, 65536};
+static const size_t m_tune_lookahead[] = {16, 256, 0};
+
+#define TUNE_RUNS 2
+#define TUNE_REPORT 10
+
+struct tune_result {
+    struct vfs_lfs_config lfs;
+    uint64_t ns;
+};
+
+static int tune_compare(const void *a, const void *b)
+{
+    const struct tune_result *x = a;
+    const struct tune_result *y = b;
+    return (x->ns > y->ns) - (x->ns < y->ns);
+}
+
+// Builds the image once, returns the elapsed time or 0 on failure.
+static uint64_t tune_build(const struct options *options, struct vfs *source, const struct vfs_lfs_config *lfs)
+{
+    uint64_t start = now_ns();
+    bool ok = false;
+
+    struct vfs *image = vfs_lfs_get(options->image, true, &options->bd, lfs);
+    if (image == NULL) {
+        return 0;
+    }
+
+    if (image->mount(image) == 0) {
+        ok = traversal(source, image, "/") == 0;
+        ok = image->unmount(image) == 0 && ok;
+    }
+
+    ok = vfs_lfs_put(image) == 0 && ok;
+
+    return ok ? now_ns() - start : 0;
+}
+
+static int autotune_run(const struct options *options)
+{
+    int result = 0;
+
+    struct vfs_cache *cache = NULL;
+    struct vfs *source = NULL;
+    struct tune_result *results = NULL;
+    size_t count = 0;
+    size_t invalid = 0;
+    size_t failed = 0;
+
+    cache = vfs_cache_create(0);
+    CHECK_ERROR(cache != NULL, -1, "vfs_cache_create() failed");
+
+    source = vfs_cache_get(cache, options->directory);
+    CHECK_ERROR(source != NULL, -1, "vfs_cache_get() failed");
+
+    const struct vfs_lfs_config *base = &options->lfs;
+
+#define TUNE_DIM(fixed, grid) ((fixed) != 0 ? 1 : sizeof(grid) / sizeof((grid)[0]))
+    size_t n_read = TUNE_DIM(base->read_size, m_tune_read);
+    size_t n_prog = TUNE_DIM(base->prog_size, m_tune_prog);
+    size_t n_cache = TUNE_DIM(base->cache_size, m_tune_cache);
+    size_t n_lookahead = TUNE_DIM(base->lookahead_size, m_tune_lookahead);
+#undef TUNE_DIM
+
+    results = calloc(n_read * n_prog * n_cache * n_lookahead, sizeof(*results));
+    CHECK_ERROR(results != NULL, -1, "calloc() failed");
+
+    for (size_t r = 0; r < n_read; r++)
+    for (size_t p = 0; p < n_prog; p++)
+    for (size_t c = 0; c < n_cache; c++)
+    for (size_t l = 0; l < n_lookahead; l++) {
+        struct vfs_lfs_config lfs = *base;
+        lfs.read_size = base->read_size != 0 ? base->read_size : m_tune_read[r];
+        lfs.prog_size = base->prog_size != 0 ? base->prog_size : m_tune_prog[p];
+        lfs.cache_size = base->cache_size != 0 ? base->cache_size : m_tune_cache[c];
+        lfs.lookahead_size = base->lookahead_size != 0 ? base->lookahead_size : m_tune_lookahead[l];
+        // the grid stands in for -s, which would turn a lookahead of 0 into
+        // the io size instead of the whole image
+        lfs.io_size = 0;
+        vfs_lfs_config_resolve(&lfs);
+
+        if (!vfs_lfs_config_valid(&lfs)) {
+            invalid++;
+            continue;
+        }
+
+        if (count == 0) {
+            // warm up, loads the source tree into the cache
+            tune_build(options, source, &lfs);
+        }
+
+        uint64_t best = 0;
+        for (size_t run = 0; run < TUNE_RUNS; run++) {
+            uint64_t ns = tune_build(options, source, &lfs);
+            if (ns == 0) {
+                best = 0;
+                break;
+            }
+            if (best == 0 || ns < best) {
+                best = ns;
+            }
+        }
+
+        if (best == 0) {
+            failed++;
+            continue;
+        }
+
+        results[count].lfs = lfs;
+        results[count].ns = best;
+        count++;
+    }
+
+    CHECK_ERROR(count != 0, -1, "no configuration succeeded, invalid: %zu, failed: %zu", invalid, failed);
+
+    qsort(results, count, sizeof(*results), tune_compare);
+
+    fprintf(stderr, "autotune: %zu configurations, %zu rejected by lfs_init checks, %zu failed\n", count, invalid,
+            failed);
+    fprintf(stderr, "  %10s %10s %10s %10s %12s\n", "read", "prog", "cache", "lookahead", "time, ms");
+    for (size_t i = 0; i < count && i < TUNE_REPORT; i++) {
+        const struct vfs_lfs_config *lfs = &results[i].lfs;
+        fprintf(stderr, "  %10zu %10zu %10zu %10zu %12.1f\n", lfs->read_size, lfs->prog_size, lfs->cache_size,
+                lfs->lookahead_size, results[i].ns / 1e6);
+    }
+    fprintf(stderr, "fastest: --read-size %zu --prog-size %zu --cache-size %zu --lookahead-size %zu\n",
+            results[0].lfs.read_size, results[0].lfs.prog_size, results[0].lfs.cache_size,
+            results[0].lfs.lookahead_size);
+
+done:
+    free(results);
+    if (source != NULL) {
+        vfs_cache_put(source);
+    }
+    vfs_cache_destroy(cache);
+    return result;
+}
+
 int main(int argc, char **argv)
 {
     int result = EXIT_SUCCESS;
@@ -199,9 +850,10 @@ int main(int argc, char **argv)
     struct options options = {0};
     struct vfs *vfs_lfs = NULL;
     struct vfs *vfs_native = NULL;
+    FILE *stats_json = NULL;
 
     int opt = 0;
-    while ((opt = getopt(argc, argv, "i:d:n:s:b:a:cxph?")) != -1) {
+    while ((opt = getopt_long(argc, argv, "i:d:n:s:b:a:t:mSC:cxph?", m_long_options, NULL)) != -1) {
         switch (opt) {
             case 'i':
                 options.image = optarg;
@@ -222,16 +874,115 @@ int main(int argc, char **argv)
                 options.action = ACTION_INTERACTION;
             } break;
             case 'n': {
-                CHECK_ERROR(string_to_size(optarg, &options.name_max) == 0, 1, "string_to_size() failed");
+                CHECK_ERROR(string_to_size(optarg, &options.lfs.name_max) == 0, 1, "string_to_size() failed");
             } break;
             case 's': {
-                CHECK_ERROR(string_to_size(optarg, &options.io_size) == 0, 1, "string_to_size() failed");
+                CHECK_ERROR(string_to_size(optarg, &options.lfs.io_size) == 0, 1, "string_to_size() failed");
             } break;
             case 'b': {
-                CHECK_ERROR(string_to_size(optarg, &options.block_size) == 0, 1, "string_to_size() failed");
+                CHECK_ERROR(string_to_size(optarg, &options.lfs.block_size) == 0, 1, "string_to_size() failed");
             } break;
             case 'a': {
-                CHECK_ERROR(string_to_size(optarg, &options.block_count) == 0, 1, "string_to_size() failed");
+                CHECK_ERROR(string_to_size(optarg, &options.lfs.block_count) == 0, 1, "string_to_size() failed");
+            } break;
+            case 't': {
+                CHECK_ERROR(bd_type_parse(optarg, &options.bd.type) == 0, 1, "bd_type_parse() failed");
+            } break;
+            case 'm':
+                options.bd.type = BD_TYPE_RAM;
+                break;
+            case 'S':
+                options.bd.sparse = true;
+                break;
+            case 'C': {
+                CHECK_ERROR(string_to_size(optarg, &options.bd.cache_blocks) == 0, 1, "string_to_size() failed");
+            } break;
+            case OPT_STATS:
+                options.bd.stats = true;
+                options.stats_json = optarg;
+                break;
+            case OPT_TRACE:
+                options.bd.trace = optarg;
+                break;
+            case OPT_REPLAY: {
+                CHECK_ERROR(options.action == ACTION_NONE, 1, "REQUIRED -x OR -c or -p or --replay");
+                options.action = ACTION_REPLAY;
+                options.replay = optarg;
+            } break;
+            case OPT_JOBS: {
+                CHECK_ERROR(options.action == ACTION_NONE, 1, "REQUIRED -x OR -c or -p or --replay or --jobs");
+                options.action = ACTION_JOBS;
+                options.jobs = optarg;
+            } break;
+            case OPT_THREADS: {
+                CHECK_ERROR(string_to_size(optarg, &options.threads) == 0, 1, "string_to_size() failed");
+            } break;
+            case OPT_SOURCE_CACHE: {
+                CHECK_ERROR(string_to_int32(optarg, &options.source_cache) == 0, 1, "string_to_int32() failed");
+                CHECK_ERROR(options.source_cache >= 0, 1, "--source-cache must not be negative");
+                if (options.source_cache == 0) {
+                    options.source_cache = -1;
+                }
+            } break;
+            case OPT_FLASH: {
+                CHECK_ERROR(bd_flash_parse(optarg, &options.flash) == 0, 1, "bd_flash_parse() failed");
+                options.bd.flash = &options.flash;
+            } break;
+            case OPT_WORKLOAD: {
+                CHECK_ERROR(options.action == ACTION_NONE, 1, "REQUIRED -x OR -c or -p or --replay or --jobs or --workload");
+                options.action = ACTION_WORKLOAD;
+                options.workload = optarg;
+            } break;
+            case OPT_WEAR:
+                options.bd.wear = optarg;
+                break;
+            case OPT_BLOCK_CYCLES: {
+                CHECK_ERROR(string_to_int32(optarg, &options.lfs.block_cycles) == 0, 1, "string_to_int32() failed");
+                CHECK_ERROR(options.lfs.block_cycles != 0, 1, "--block-cycles must not be 0");
+            } break;
+            case OPT_READ_SIZE: {
+                CHECK_ERROR(string_to_size(optarg, &options.lfs.read_size) == 0, 1, "string_to_size() failed");
+            } break;
+            case OPT_PROG_SIZE: {
+                CHECK_ERROR(string_to_size(optarg, &options.lfs.prog_size) == 0, 1, "string_to_size() failed");
+            } break;
+            case OPT_CACHE_SIZE: {
+                CHECK_ERROR(string_to_size(optarg, &options.lfs.cache_size) == 0, 1, "string_to_size() failed");
+            } break;
+            case OPT_LOOKAHEAD_SIZE: {
+                CHECK_ERROR(string_to_size(optarg, &options.lfs.lookahead_size) == 0, 1, "string_to_size() failed");
+            } break;
+            case OPT_READ_CACHE: {
+                CHECK_ERROR(read_cache_parse(optarg, &options.lfs) == 0, 1, "read_cache_parse() failed");
+            } break;
+            case OPT_MDIR_CACHE: {
+                CHECK_ERROR(string_to_int32(optarg, &options.lfs.mdir_cache_size) == 0, 1, "string_to_int32() failed");
+                CHECK_ERROR(options.lfs.mdir_cache_size >= 0, 1, "--mdir-cache must not be negative");
+                if (options.lfs.mdir_cache_size == 0) {
+                    options.lfs.mdir_cache_size = -1;
+                }
+            } break;
+            case OPT_NAME_INDEX: {
+                CHECK_ERROR(string_to_int32(optarg, &options.lfs.name_index_size) == 0, 1, "string_to_int32() failed");
+                CHECK_ERROR(options.lfs.name_index_size >= 0, 1, "--name-index must not be negative");
+                CHECK_ERROR(options.lfs.name_index_size < 0xffff, 1, "--name-index must be below 65535");
+                if (options.lfs.name_index_size == 0) {
+                    options.lfs.name_index_size = -1;
+                }
+            } break;
+            case OPT_BULK_LOAD: {
+                options.lfs.bulk_load = true;
+            } break;
+            case OPT_CTZ_CACHE: {
+                CHECK_ERROR(string_to_int32(optarg, &options.lfs.ctz_cache_size) == 0, 1, "string_to_int32() failed");
+                CHECK_ERROR(options.lfs.ctz_cache_size >= 0, 1, "--ctz-cache must not be negative");
+                if (options.lfs.ctz_cache_size == 0) {
+                    options.lfs.ctz_cache_size = -1;
+                }
+            } break;
+            case OPT_AUTOTUNE: {
+                CHECK_ERROR(options.action == ACTION_NONE, 1, "REQUIRED -x OR -c or -p or --replay or --jobs or --workload or --autotune");
+                options.action = ACTION_AUTOTUNE;
             } break;
             case 'h':
             /* FALLTHROUGH */
@@ -244,16 +995,16 @@ int main(int argc, char **argv)
     }
 
     CHECK_ERROR(optind == argc, 1, "Invalid argument count");
-    CHECK_ERROR(options.image != NULL, 1, "-i required");
-	if (options.action != ACTION_INTERACTION) {
+    CHECK_ERROR(options.image != NULL || options.action == ACTION_JOBS, 1, "-i required");
+	if (options.action == ACTION_CREATE || options.action == ACTION_EXTRACT || options.action == ACTION_AUTOTUNE) {
     	CHECK_ERROR(options.directory != NULL, 1, "-d required");
 		vfs_native = vfs_native_get(options.directory);
 	}
 
     switch (options.action) {
         case ACTION_EXTRACT: {
-            vfs_lfs = vfs_lfs_get(options.image, false, options.name_max, options.io_size, options.block_size,
-                                  options.block_count);
+            vfs_lfs = vfs_lfs_get(options.image, false, &options.bd, &options.lfs);
+            CHECK_ERROR(vfs_lfs != NULL, 2, "vfs_lfs_get() failed");
 
             int err = vfs_lfs->mount(vfs_lfs);
             CHECK_ERROR(err == 0, 2, "vfs->mount() failed: %d", err);
@@ -261,18 +1012,22 @@ int main(int argc, char **argv)
             traversal(vfs_lfs, vfs_native, "/");
         } break;
         case ACTION_CREATE: {
-            vfs_lfs = vfs_lfs_get(options.image, true, options.name_max, options.io_size, options.block_size,
-                                  options.block_count);
+            vfs_lfs = vfs_lfs_get(options.image, true, &options.bd, &options.lfs);
             CHECK_ERROR(vfs_lfs != NULL, 2, "vfs_lfs_get() failed");
 
+            if (strcmp(options.image, "-") == 0) {
+                // the image owns the original stdout now, keep the log out of it
+                fflush(stdout);
+                CHECK_ERROR(dup2(STDERR_FILENO, STDOUT_FILENO) >= 0, 2, "dup2() failed: %s", strerror(errno));
+            }
+
             int err = vfs_lfs->mount(vfs_lfs);
             CHECK_ERROR(err == 0, 2, "vfs->mount() failed: %d", err);
 
             traversal(vfs_native, vfs_lfs, "/");
         } break;
 		case ACTION_INTERACTION: {
-			vfs_lfs = vfs_lfs_get(options.image, false, options.name_max, options.io_size, options.block_size,
-                                  options.block_count);
+			vfs_lfs = vfs_lfs_get(options.image, false, &options.bd, &options.lfs);
             CHECK_ERROR(vfs_lfs != NULL, 2, "vfs_lfs_get() failed");
 
             int err = vfs_lfs->mount(vfs_lfs);
@@ -280,6 +1035,41 @@ int main(int argc, char **argv)
 
 			cli_main(vfs_lfs);
 		}break;
+        case ACTION_REPLAY: {
+            stats_json = stats_json_open(&options);
+
+            int err = bd_trace_replay(options.replay, &options.bd, options.image, stderr, stats_json);
+            CHECK_ERROR(err == 0, 2, "bd_trace_replay() failed: %d", err);
+        } break;
+        case ACTION_JOBS: {
+            CHECK_ERROR(options.bd.trace == NULL, 1, "--trace cannot be used with --jobs");
+            CHECK_ERROR(options.bd.flash == NULL, 1, "--flash cannot be used with --jobs");
+            CHECK_ERROR(options.bd.wear == NULL, 1, "--wear cannot be used with --jobs");
+            CHECK_ERROR(options.stats_json == NULL, 1, "--stats with --jobs prints the summary only");
+
+            int err = jobs_run(&options);
+            CHECK_ERROR(err == 0, 2, "jobs_run() failed: %d", err);
+        } break;
+        case ACTION_WORKLOAD: {
+            if (options.bd.flash == NULL) {
+                CHECK_ERROR(bd_flash_parse("nor", &options.flash) == 0, 2, "bd_flash_parse() failed");
+                options.bd.flash = &options.flash;
+            }
+
+            vfs_lfs = vfs_lfs_get(options.image, false, &options.bd, &options.lfs);
+            CHECK_ERROR(vfs_lfs != NULL, 2, "vfs_lfs_get() failed");
+
+            int err = workload_run(vfs_lfs, options.workload, &options.flash);
+            CHECK_ERROR(err == 0, 2, "workload_run() failed: %d", err);
+        } break;
+        case ACTION_AUTOTUNE: {
+            CHECK_ERROR(strcmp(options.image, "-") != 0, 1, "--autotune needs a scratch image file");
+            CHECK_ERROR(options.bd.trace == NULL && options.bd.wear == NULL && !options.bd.stats, 1,
+                        "--autotune cannot be used with --trace, --wear or --stats");
+
+            int err = autotune_run(&options);
+            CHECK_ERROR(err == 0, 2, "autotune_run() failed: %d", err);
+        } break;
         case ACTION_NONE:
             ERROR("REQUIRED -x OR -c");
             usage(argv[0]);
@@ -291,7 +1081,35 @@ done:
         int err = vfs_lfs->unmount(vfs_lfs);
         if (err != 0) {
             ERROR("vfs->unmount: %d", err);
+            if (result == EXIT_SUCCESS) {
+                result = 2;
+            }
+        }
+
+        if (options.bd.flash != NULL && options.action != ACTION_WORKLOAD) {
+            flash_report(&options.flash, stderr);
         }
+
+        if (options.bd.stats) {
+            stats_json = stats_json_open(&options);
+
+            err = vfs_lfs_report(vfs_lfs, stderr, stats_json);
+            if (err != 0) {
+                ERROR("vfs_lfs_report: %d", err);
+            }
+        }
+
+        err = vfs_lfs_put(vfs_lfs);
+        if (err != 0) {
+            ERROR("vfs_lfs_put: %d", err);
+            if (result == EXIT_SUCCESS) {
+                result = 2;
+            }
+        }
+    }
+
+    if (stats_json != NULL && stats_json != stdout) {
+        fclose(stats_json);
     }
 
     if (result != EXIT_SUCCESS) {
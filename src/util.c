@@ -19,6 +19,7 @@
 #include <stdint.h>
 #include <stdlib.h>
 #include <string.h>
+#include <time.h>
 
 #include "macro.h"
 
@@ -44,3 +45,15 @@ char *append_dir_alloc(const char *dir, const char *path)
 done:
     return result;
 }
+
+uint32_t *bitmap_alloc(size_t bits)
+{
+    return calloc((bits + 31) / 32, sizeof(uint32_t));
+}
+
+uint64_t now_ns(void)
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * 1000000000u + ts.tv_nsec;
+}
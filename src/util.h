@@ -14,4 +14,28 @@
 
 #pragma once
 
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
 char *append_dir_alloc(const char *dir, const char *path);
+
+uint32_t *bitmap_alloc(size_t bits);
+
+// CLOCK_MONOTONIC in nanoseconds.
+uint64_t now_ns(void);
+
+static inline bool bitmap_test(const uint32_t *bitmap, size_t bit)
+{
+    return (bitmap[bit / 32] >> (bit % 32)) & 1;
+}
+
+static inline void bitmap_set(uint32_t *bitmap, size_t bit)
+{
+    bitmap[bit / 32] |= 1U << (bit % 32);
+}
+
+static inline void bitmap_clear(uint32_t *bitmap, size_t bit)
+{
+    bitmap[bit / 32] &= ~(1U << (bit % 32));
+}
@@ -0,0 +1,678 @@
+/**
+ * Copyright 2019 Sergey Tyultyaev
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include "vfs_cache.h"
+
+#include <sys/types.h>
+#include <sys/stat.h>
+#include <fcntl.h>
+#include <errno.h>
+#include <dirent.h>
+#include <stdbool.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <pthread.h>
+
+#include "macro.h"
+#include "util.h"
+
+#define CACHE_BUCKETS_MIN 1024
+
+struct cache_name
+{
+    char *name;
+    vfs_dirent_type_t type;
+};
+
+// Contents are immutable once it is in the table, the links and refs are
+// guarded by the cache mutex.
+struct cache_entry
+{
+    struct cache_entry *next;
+    char *path;
+    uint32_t hash;
+    bool dir;
+
+    uint8_t *data;
+    size_t size;
+
+    struct cache_name *names;
+    size_t count;
+
+    // files only: open handles, and the least recently used order of the
+    // files in the table; a file that did not fit is not in the table and
+    // is freed with its last handle
+    size_t refs;
+    bool cached;
+    struct cache_entry *older;
+    struct cache_entry *newer;
+};
+
+struct vfs_cache
+{
+    pthread_mutex_t mutex;
+    struct cache_entry **buckets;
+    size_t bucket_count;
+    size_t count;
+    // file data held is kept within max_bytes, 0 for no limit
+    size_t max_bytes;
+    struct cache_entry *oldest;
+    struct cache_entry *newest;
+    struct vfs_cache_stats stats;
+};
+
+struct view
+{
+    struct vfs_cache *cache;
+    const char *path;
+};
+
+struct cache_file
+{
+    struct cache_entry *entry;
+    size_t pos;
+};
+
+struct cache_dir
+{
+    const struct cache_entry *entry;
+    size_t index;
+    struct vfs_dirent dirent;
+};
+
+static uint32_t hash_string(const char *str)
+{
+    // FNV-1a
+    uint32_t hash = 2166136261u;
+    while (*str != '\0') {
+        hash = (hash ^ (uint8_t)*str++) * 16777619u;
+    }
+    return hash;
+}
+
+// Joins root and path with duplicate and trailing slashes removed, so a file
+// seen through different roots gets the same key.
+static char *cache_key(const char *root, const char *path)
+{
+    char *key = append_dir_alloc(root, path);
+    if (key == NULL) {
+        return NULL;
+    }
+
+    size_t len = 0;
+    for (const char *p = key; *p != '\0'; p++) {
+        if (*p == '/' && len > 0 && key[len - 1] == '/') {
+            continue;
+        }
+        key[len++] = *p;
+    }
+    if (len > 1 && key[len - 1] == '/') {
+        len--;
+    }
+    key[len] = '\0';
+
+    return key;
+}
+
+static void entry_free(struct cache_entry *entry)
+{
+    if (entry == NULL) {
+        return;
+    }
+
+    for (size_t i = 0; i < entry->count; i++) {
+        free(entry->names[i].name);
+    }
+    free(entry->names);
+    free(entry->data);
+    free(entry->path);
+    free(entry);
+}
+
+static struct cache_entry *entry_load_file(const char *path, int fd, size_t size)
+{
+    struct cache_entry *result = NULL;
+
+    struct cache_entry *entry = NULL;
+
+    entry = calloc(1, sizeof(*entry));
+    CHECK_ERROR(entry != NULL, NULL, "calloc() failed");
+
+    entry->data = malloc(size != 0 ? size : 1);
+    CHECK_ERROR(entry->data != NULL, NULL, "malloc() failed");
+
+    while (entry->size < size) {
+        ssize_t bytes = read(fd, entry->data + entry->size, size - entry->size);
+        if (bytes < 0 && errno == EINTR) {
+            continue;
+        }
+        CHECK_ERROR(bytes > 0, NULL, "read(%s) failed: %s", path, bytes < 0 ? strerror(errno) : "file shrank");
+        entry->size += bytes;
+    }
+
+    result = entry;
+
+done:
+    if (result == NULL) {
+        entry_free(entry);
+    }
+    return result;
+}
+
+static struct cache_entry *entry_load_dir(const char *path)
+{
+    struct cache_entry *result = NULL;
+
+    struct cache_entry *entry = NULL;
+    DIR *dir = NULL;
+    char *child = NULL;
+    size_t capacity = 0;
+
+    entry = calloc(1, sizeof(*entry));
+    CHECK_ERROR(entry != NULL, NULL, "calloc() failed");
+    entry->dir = true;
+
+    dir = opendir(path);
+    CHECK_ERROR(dir != NULL, NULL, "opendir(%s) failed: %s", path, strerror(errno));
+
+    while (true) {
+        errno = 0;
+        struct dirent *dirent = readdir(dir);
+        if (dirent == NULL) {
+            CHECK_ERROR(errno == 0, NULL, "readdir() failed: %s", strerror(errno));
+            break;
+        }
+
+        child = append_dir_alloc(path, dirent->d_name);
+        CHECK_ERROR(child != NULL, NULL, "append_dir_alloc() failed");
+
+        struct stat st = {0};
+        int err = stat(child, &st);
+        CHECK_ERROR(err == 0, NULL, "stat(%s) failed: %s", child, strerror(errno));
+        CHECK_ERROR(S_ISREG(st.st_mode) || S_ISDIR(st.st_mode), NULL, "unknown file type: 0x%x", st.st_mode);
+        CHECK_ERROR(strlen(dirent->d_name) < VFS_MAX_NAME_LEN, NULL, "name is too long: %s", child);
+
+        free(child);
+        child = NULL;
+
+        if (entry->count == capacity) {
+            capacity = capacity != 0 ? capacity * 2 : 16;
+            struct cache_name *names = realloc(entry->names, capacity * sizeof(*names));
+            CHECK_ERROR(names != NULL, NULL, "realloc() failed");
+            entry->names = names;
+        }
+
+        struct cache_name *name = &entry->names[entry->count];
+        name->name = strdup(dirent->d_name);
+        CHECK_ERROR(name->name != NULL, NULL, "strdup() failed");
+        name->type = S_ISREG(st.st_mode) ? VFS_TYPE_FILE : VFS_TYPE_DIR;
+        entry->count++;
+    }
+
+    result = entry;
+
+done:
+    free(child);
+    if (dir != NULL) {
+        closedir(dir);
+    }
+    if (result == NULL) {
+        entry_free(entry);
+    }
+    return result;
+}
+
+static struct cache_entry *cache_lookup_locked(struct vfs_cache *cache, const char *key, uint32_t hash)
+{
+    for (struct cache_entry *entry = cache->buckets[hash % cache->bucket_count]; entry != NULL;
+         entry = entry->next) {
+        if (entry->hash == hash && strcmp(entry->path, key) == 0) {
+            return entry;
+        }
+    }
+    return NULL;
+}
+
+static void cache_grow_locked(struct vfs_cache *cache)
+{
+    size_t bucket_count = cache->bucket_count * 2;
+    struct cache_entry **buckets = calloc(bucket_count, sizeof(*buckets));
+    if (buckets == NULL) {
+        // keep the longer chains
+        return;
+    }
+
+    for (size_t i = 0; i < cache->bucket_count; i++) {
+        struct cache_entry *entry = cache->buckets[i];
+        while (entry != NULL) {
+            struct cache_entry *next = entry->next;
+            entry->next = buckets[entry->hash % bucket_count];
+            buckets[entry->hash % bucket_count] = entry;
+            entry = next;
+        }
+    }
+
+    free(cache->buckets);
+    cache->buckets = buckets;
+    cache->bucket_count = bucket_count;
+}
+
+static void lru_unlink_locked(struct vfs_cache *cache, struct cache_entry *entry)
+{
+    *(entry->older != NULL ? &entry->older->newer : &cache->oldest) = entry->newer;
+    *(entry->newer != NULL ? &entry->newer->older : &cache->newest) = entry->older;
+    entry->older = NULL;
+    entry->newer = NULL;
+}
+
+static void lru_push_locked(struct vfs_cache *cache, struct cache_entry *entry)
+{
+    entry->older = cache->newest;
+    *(cache->newest != NULL ? &cache->newest->newer : &cache->oldest) = entry;
+    cache->newest = entry;
+}
+
+// Drops least recently used files without open handles until size more bytes
+// fit, returns whether they do.
+static bool cache_evict_locked(struct vfs_cache *cache, size_t size)
+{
+    if (cache->max_bytes == 0) {
+        return true;
+    }
+
+    struct cache_entry *entry = cache->oldest;
+    while (entry != NULL && cache->stats.bytes + size > cache->max_bytes) {
+        struct cache_entry *newer = entry->newer;
+        if (entry->refs == 0) {
+            struct cache_entry **link = &cache->buckets[entry->hash % cache->bucket_count];
+            while (*link != entry) {
+                link = &(*link)->next;
+            }
+            *link = entry->next;
+
+            lru_unlink_locked(cache, entry);
+            cache->count--;
+            cache->stats.bytes -= entry->size;
+            cache->stats.evictions++;
+            entry_free(entry);
+        }
+        entry = newer;
+    }
+
+    return cache->stats.bytes + size <= cache->max_bytes;
+}
+
+// Returns the entry for root/path, loading it on the first request. Loading
+// runs unlocked, when two views race the first inserted entry wins. File
+// entries are referenced until cache_release().
+static struct cache_entry *cache_find(struct vfs_cache *cache, const char *root, const char *path, bool dir)
+{
+    struct cache_entry *result = NULL;
+
+    struct cache_entry *entry = NULL;
+    char *key = NULL;
+    int fd = -1;
+
+    key = cache_key(root, path);
+    CHECK_ERROR(key != NULL, NULL, "cache_key() failed");
+
+    uint32_t hash = hash_string(key);
+
+    pthread_mutex_lock(&cache->mutex);
+    struct cache_entry *found = cache_lookup_locked(cache, key, hash);
+    if (found != NULL) {
+        cache->stats.hits++;
+        if (!found->dir && !dir) {
+            found->refs++;
+            lru_unlink_locked(cache, found);
+            lru_push_locked(cache, found);
+        }
+    }
+    pthread_mutex_unlock(&cache->mutex);
+
+    if (found != NULL) {
+        CHECK_ERROR(found->dir == dir, NULL, "%s: %s", key, dir ? "not a directory" : "is a directory");
+        result = found;
+        goto done;
+    }
+
+    if (dir) {
+        entry = entry_load_dir(key);
+        CHECK_ERROR(entry != NULL, NULL, "entry_load_dir() failed");
+    } else {
+        fd = open(key, O_RDONLY);
+        CHECK_ERROR(fd >= 0, NULL, "open(%s) failed: %s", key, strerror(errno));
+
+        struct stat st = {0};
+        int err = fstat(fd, &st);
+        CHECK_ERROR(err == 0, NULL, "fstat() failed: %s", strerror(errno));
+        CHECK_ERROR(S_ISREG(st.st_mode), NULL, "%s is not a regular file", key);
+
+        entry = entry_load_file(key, fd, st.st_size);
+        CHECK_ERROR(entry != NULL, NULL, "entry_load_file() failed");
+    }
+
+    entry->path = key;
+    entry->hash = hash;
+    key = NULL;
+
+    pthread_mutex_lock(&cache->mutex);
+    found = cache_lookup_locked(cache, entry->path, hash);
+    if (found != NULL) {
+        cache->stats.hits++;
+        if (!found->dir && !dir) {
+            found->refs++;
+        }
+    } else if (!dir && !cache_evict_locked(cache, entry->size)) {
+        // too large to keep, served to this handle only
+        cache->stats.misses++;
+        entry->refs = 1;
+        found = entry;
+        entry = NULL;
+    } else {
+        if (cache->count >= cache->bucket_count) {
+            cache_grow_locked(cache);
+        }
+        entry->next = cache->buckets[hash % cache->bucket_count];
+        cache->buckets[hash % cache->bucket_count] = entry;
+        cache->count++;
+        cache->stats.misses++;
+        if (!dir) {
+            entry->refs = 1;
+            entry->cached = true;
+            lru_push_locked(cache, entry);
+            cache->stats.bytes += entry->size;
+        }
+        found = entry;
+        entry = NULL;
+    }
+    pthread_mutex_unlock(&cache->mutex);
+
+    result = found;
+
+done:
+    if (fd >= 0) {
+        close(fd);
+    }
+    entry_free(entry);
+    free(key);
+    return result;
+}
+
+static void cache_release(struct vfs_cache *cache, struct cache_entry *entry)
+{
+    struct cache_entry *owned = NULL;
+
+    pthread_mutex_lock(&cache->mutex);
+    entry->refs--;
+    if (!entry->cached && entry->refs == 0) {
+        owned = entry;
+    }
+    pthread_mutex_unlock(&cache->mutex);
+
+    entry_free(owned);
+}
+
+static void *vfs_open(struct vfs *vfs, const char *pathname, int flags)
+{
+    void *result = NULL;
+
+    struct cache_file *file = NULL;
+
+    CHECK_ERROR(vfs != NULL, NULL, "vfs == NULL");
+    CHECK_ERROR(pathname != NULL, NULL, "pathname == NULL");
+    CHECK_ERROR((flags & O_ACCMODE) == O_RDONLY, NULL, "read-only");
+
+    struct view *view = vfs->opaque;
+
+    file = calloc(1, sizeof(*file));
+    CHECK_ERROR(file != NULL, NULL, "calloc() failed");
+
+    file->entry = cache_find(view->cache, view->path, pathname, false);
+    CHECK_ERROR(file->entry != NULL, NULL, "cache_find() failed");
+
+    result = file;
+
+done:
+    if (result == NULL) {
+        free(file);
+    }
+    return result;
+}
+
+static int vfs_close(struct vfs *vfs, void *fd)
+{
+    int result = 0;
+
+    CHECK_ERROR(vfs != NULL, -1, "vfs == NULL");
+    CHECK_ERROR(fd != NULL, -1, "fd == NULL");
+
+    struct view *view = vfs->opaque;
+    struct cache_file *file = fd;
+
+    cache_release(view->cache, file->entry);
+    free(file);
+
+done:
+    return result;
+}
+
+static int32_t vfs_read(struct vfs *vfs, void *fd, void *buf, size_t count)
+{
+    int32_t result = 0;
+
+    CHECK_ERROR(vfs != NULL, -1, "vfs == NULL");
+    CHECK_ERROR(fd != NULL, -1, "fd == NULL");
+    CHECK_ERROR(buf != NULL, -1, "buf == NULL");
+    CHECK_ERROR(count <= INT32_MAX, -1, "count is too large: %zu", count);
+
+    struct cache_file *file = fd;
+
+    size_t left = file->entry->size - file->pos;
+    if (count > left) {
+        count = left;
+    }
+
+    memcpy(buf, file->entry->data + file->pos, count);
+    file->pos += count;
+    result = count;
+
+done:
+    return result;
+}
+
+static int vfs_mount(struct vfs *vfs)
+{
+    return vfs != NULL ? 0 : -1;
+}
+
+static int vfs_unmount(struct vfs *vfs)
+{
+    return vfs != NULL ? 0 : -1;
+}
+
+static void *vfs_opendir(struct vfs *vfs, const char *pathname)
+{
+    void *result = NULL;
+
+    struct cache_dir *dir = NULL;
+
+    CHECK_ERROR(vfs != NULL, NULL, "vfs == NULL");
+    CHECK_ERROR(pathname != NULL, NULL, "pathname == NULL");
+
+    struct view *view = vfs->opaque;
+
+    dir = calloc(1, sizeof(*dir));
+    CHECK_ERROR(dir != NULL, NULL, "calloc() failed");
+
+    dir->entry = cache_find(view->cache, view->path, pathname, true);
+    CHECK_ERROR(dir->entry != NULL, NULL, "cache_find() failed");
+
+    result = dir;
+
+done:
+    if (result == NULL) {
+        free(dir);
+    }
+    return result;
+}
+
+static int vfs_closedir(struct vfs *vfs, void *dir)
+{
+    int result = 0;
+
+    CHECK_ERROR(vfs != NULL, -1, "vfs == NULL");
+    CHECK_ERROR(dir != NULL, -1, "dir == NULL");
+
+    free(dir);
+
+done:
+    return result;
+}
+
+static struct vfs_dirent *vfs_readdir(struct vfs *vfs, void *dir)
+{
+    struct vfs_dirent *result = NULL;
+
+    CHECK_ERROR(vfs != NULL, NULL, "vfs == NULL");
+    CHECK_ERROR(dir != NULL, NULL, "dir == NULL");
+
+    struct cache_dir *cache_dir = dir;
+
+    if (cache_dir->index == cache_dir->entry->count) {
+        cache_dir->dirent.name[0] = '\0';
+        cache_dir->dirent.type = VFS_TYPE_END;
+    } else {
+        const struct cache_name *name = &cache_dir->entry->names[cache_dir->index++];
+        strcpy(cache_dir->dirent.name, name->name);
+        cache_dir->dirent.type = name->type;
+    }
+
+    result = &cache_dir->dirent;
+
+done:
+    return result;
+}
+
+static const struct vfs m_vfs_cache = {
+    .open = vfs_open,
+    .close = vfs_close,
+    .read = vfs_read,
+    .mount = vfs_mount,
+    .unmount = vfs_unmount,
+    .opendir = vfs_opendir,
+    .closedir = vfs_closedir,
+    .readdir = vfs_readdir,
+};
+
+struct vfs_cache *vfs_cache_create(size_t max_bytes)
+{
+    struct vfs_cache *result = NULL;
+
+    struct vfs_cache *cache = NULL;
+
+    cache = calloc(1, sizeof(*cache));
+    CHECK_ERROR(cache != NULL, NULL, "calloc() failed");
+
+    cache->max_bytes = max_bytes;
+    cache->bucket_count = CACHE_BUCKETS_MIN;
+    cache->buckets = calloc(cache->bucket_count, sizeof(*cache->buckets));
+    CHECK_ERROR(cache->buckets != NULL, NULL, "calloc() failed");
+
+    int err = pthread_mutex_init(&cache->mutex, NULL);
+    CHECK_ERROR(err == 0, NULL, "pthread_mutex_init() failed: %d", err);
+
+    result = cache;
+
+done:
+    if (result == NULL && cache != NULL) {
+        free(cache->buckets);
+        free(cache);
+    }
+    return result;
+}
+
+void vfs_cache_destroy(struct vfs_cache *cache)
+{
+    if (cache == NULL) {
+        return;
+    }
+
+    for (size_t i = 0; i < cache->bucket_count; i++) {
+        struct cache_entry *entry = cache->buckets[i];
+        while (entry != NULL) {
+            struct cache_entry *next = entry->next;
+            entry_free(entry);
+            entry = next;
+        }
+    }
+
+    pthread_mutex_destroy(&cache->mutex);
+    free(cache->buckets);
+    free(cache);
+}
+
+void vfs_cache_get_stats(struct vfs_cache *cache, struct vfs_cache_stats *stats)
+{
+    pthread_mutex_lock(&cache->mutex);
+    *stats = cache->stats;
+    pthread_mutex_unlock(&cache->mutex);
+}
+
+struct vfs *vfs_cache_get(struct vfs_cache *cache, const char *path)
+{
+    struct vfs *result = NULL;
+
+    struct vfs *vfs = NULL;
+    struct view *view = NULL;
+
+    CHECK_ERROR(cache != NULL, NULL, "cache == NULL");
+    CHECK_ERROR(path != NULL, NULL, "path == NULL");
+
+    vfs = malloc(sizeof(*vfs));
+    CHECK_ERROR(vfs != NULL, NULL, "malloc() failed");
+    *vfs = m_vfs_cache;
+
+    view = calloc(1, sizeof(*view));
+    CHECK_ERROR(view != NULL, NULL, "calloc() failed");
+
+    view->cache = cache;
+    view->path = path;
+
+    vfs->opaque = view;
+    result = vfs;
+
+done:
+    if (result == NULL) {
+        free(view);
+        free(vfs);
+    }
+    return result;
+}
+
+int vfs_cache_put(struct vfs *vfs)
+{
+    int result = 0;
+
+    CHECK_ERROR(vfs != NULL, -1, "vfs == NULL");
+
+    free(vfs->opaque);
+    free(vfs);
+
+done:
+    return result;
+}
@@ -0,0 +1,51 @@
+// Copyright 2019 Sergey Tyultyaev
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#pragma once
+
+#include <stdint.h>
+
+#include "vfs.h"
+
+// Read-only store of native directory listings and file contents shared by
+// several vfs views. Every directory is listed (and its entries stat'ed) and
+// every file is read once, whichever view asks first. Listings stay in memory
+// until vfs_cache_destroy(), file contents as long as they fit in the limit
+// of the cache; least recently used files without open handles are dropped
+// and read again on the next open. Thread-safe.
+struct vfs_cache;
+
+struct vfs_cache_stats
+{
+    uint64_t hits;
+    uint64_t misses;
+    // bytes of file data held
+    uint64_t bytes;
+    // files dropped to stay within the limit
+    uint64_t evictions;
+};
+
+// max_bytes limits the file data held, 0 for no limit. A file larger than
+// the limit is read for the handle that opens it only.
+struct vfs_cache *vfs_cache_create(size_t max_bytes);
+
+void vfs_cache_destroy(struct vfs_cache *cache);
+
+void vfs_cache_get_stats(struct vfs_cache *cache, struct vfs_cache_stats *stats);
+
+// Read-only vfs over the native directory path served from cache. open,
+// read, close, opendir, readdir and closedir are supported.
+struct vfs *vfs_cache_get(struct vfs_cache *cache, const char *path);
+
+int vfs_cache_put(struct vfs *vfs);
@@ -25,28 +25,68 @@
 #include <string.h>
 #include <errno.h>
 #include <pthread.h>
+#include <inttypes.h>
 
 #include "vfs.h"
+#include "bd.h"
+#include "bd_stats.h"
 #include "lfs/lfs.h"
+#include "lfs/lfs_util.h"
 
 #define BLOCK_SIZE 4096
 #define IO_SIZE 256
 
+// State of one image, vfs->opaque. Calls on the same image are serialized by
+// mutex, different images are independent.
 struct context
 {
-    FILE *file;
+    struct bd *bd;
+    // bd is topped with bd_stats
+    bool stats;
+    // file bytes passed through vfs_write()/vfs_read()
+    uint64_t payload_written;
+    uint64_t payload_read;
+
+    struct lfs_config config;
+    lfs_t lfs;
+    bool mounted;
+    pthread_mutex_t mutex;
 };
 
-static lfs_t *g_lfs = NULL;
+struct dir
+{
+    lfs_dir_t dir;
+    // returned by vfs_readdir(), valid until the next call on this dir
+    struct vfs_dirent dirent;
+};
 
 static int fs_read(const struct lfs_config *c, lfs_block_t block,
-                   lfs_off_t off, void *buffer, lfs_size_t size);
+                   lfs_off_t off, void *buffer, lfs_size_t size)
+{
+    struct context *context = c->context;
+    return context->bd->read(context->bd, block, off, buffer, size);
+}
+
 static int fs_prog(const struct lfs_config *c, lfs_block_t block,
-                   lfs_off_t off, const void *buffer, lfs_size_t size);
-static int fs_erase(const struct lfs_config *c, lfs_block_t block);
-static int fs_sync(const struct lfs_config *c);
+                   lfs_off_t off, const void *buffer, lfs_size_t size)
+{
+    struct context *context = c->context;
+    return context->bd->prog(context->bd, block, off, buffer, size);
+}
+
+static int fs_erase(const struct lfs_config *c, lfs_block_t block)
+{
+    struct context *context = c->context;
+    return context->bd->erase(context->bd, block);
+}
 
-static struct lfs_config m_lfs_config = {
+static int fs_sync(const struct lfs_config *c)
+{
+    struct context *context = c->context;
+    return context->bd->sync(context->bd);
+}
+
+static const struct lfs_config m_default_config = {
     .read = fs_read,
     .prog = fs_prog,
     .erase = fs_erase,
@@ -59,92 +99,92 @@ static struct lfs_config m_lfs_config = {
     .block_cycles = -1,
 };
 
-static struct context m_context = {0};
-
-static pthread_mutex_t mutex;
-
-static int fs_read(const struct lfs_config *c, lfs_block_t block,
-                   lfs_off_t off, void *buffer, lfs_size_t size)
+static lfs_size_t size_or(size_t value, lfs_size_t fallback)
 {
-    int result = 0;
-    struct context *context = c->context;
-
-    size_t offset = c->block_size * block + off;
-
-    int err = fseek(context->file, offset, SEEK_SET);
-    CHECK_ERROR(err == 0, -1, "fseek() failed: %d", err);
-
-    size_t bytes = fread(buffer, 1, size, context->file);
-    CHECK_ERROR(bytes == size, -1, "fread() failed: off: %u, size: %u, bytes: %ld", off, size, bytes);
-
-    //INFO("read block: %u, off: %u", block, off);
-    //INFO("read offset: %u, size: %u", offset, size);
-
-done:
-    return result;
+    return value != 0 ? value : fallback;
 }
 
-static int fs_prog(const struct lfs_config *c, lfs_block_t block,
-                   lfs_off_t off, const void *buffer, lfs_size_t size)
+// Fills the geometry of lfs_config from config over the defaults.
+static void config_resolve(const struct vfs_lfs_config *config, struct lfs_config *lfs_config)
 {
-    int result = 0;
-    struct context *context = c->context;
-
-    size_t offset = c->block_size * block + off;
-
-    int err = fseek(context->file, offset, SEEK_SET);
-    CHECK_ERROR(err == 0, -1, "fseek() failed: %d", err);
-
-    size_t bytes = fwrite(buffer, 1, size, context->file);
-    CHECK_ERROR(bytes == size, -1, "fwrite() failed");
+    lfs_size_t io_size = size_or(config->io_size, IO_SIZE);
+
+    lfs_config->read_size = size_or(config->read_size, io_size);
+    lfs_config->prog_size = size_or(config->prog_size, io_size);
+    lfs_config->cache_size = size_or(config->cache_size, io_size);
+    lfs_config->block_size = size_or(config->block_size, BLOCK_SIZE);
+    lfs_config->block_count = size_or(config->block_count, 4059);
+
+    // without -s the lookahead covers the whole image, a bitmap of
+    // block_count bits is cheap on the host and lfs_alloc then traverses
+    // the filesystem once per pass instead of once per window
+    lfs_size_t lookahead_all = ((lfs_config->block_count + 7) / 8 + 7) / 8 * 8;
+    lfs_config->lookahead_size = size_or(config->lookahead_size, config->io_size != 0 ? io_size : lookahead_all);
+    lfs_config->name_max = config->name_max;
+
+    if (config->block_cycles != 0) {
+        lfs_config->block_cycles = config->block_cycles;
+    }
 
-done:
-    return result;
+    lfs_config->read_cache_ways = config->read_cache_ways;
+    lfs_config->read_cache_sets = config->read_cache_sets;
+    lfs_config->read_cache_line = size_or(config->read_cache_line, lfs_config->cache_size);
+    lfs_config->mdir_cache_size = config->mdir_cache_size < 0 ? 0 : size_or(config->mdir_cache_size, 1024);
+    lfs_config->name_index_size = config->name_index_size < 0 ? 0 : size_or(config->name_index_size, 64);
+    lfs_config->bulk_load = config->bulk_load;
+    lfs_config->ctz_cache_size = config->ctz_cache_size < 0 ? 0 : size_or(config->ctz_cache_size, 64);
+    // the RAM a compaction takes is nothing next to an image
+    lfs_config->compact_table = true;
 }
 
-static int fs_erase(const struct lfs_config *c, lfs_block_t block)
+// Same conditions as the asserts in lfs_init(), which would abort instead.
+static bool config_valid(const struct lfs_config *c)
 {
-    int result = 0;
-    struct context *context = c->context;
-
-    size_t offset = c->block_size * block;
-
-    int err = fseek(context->file, offset, SEEK_SET);
-    CHECK_ERROR(err == 0, -1, "fseek() failed: %d", err);
-
-    for (size_t i = 0; i < c->block_size; i++) {
-        int c = fputc(0xFF, context->file);
-        CHECK_ERROR(c == 0xff, -1, "fputc() failed: %d", c);
-    }
-
-done:
-    return result;
+    return c->read_size != 0 && c->prog_size != 0 && c->cache_size != 0 &&
+           c->cache_size % c->read_size == 0 && c->cache_size % c->prog_size == 0 &&
+           c->block_size % c->cache_size == 0 && c->block_size > 2 * 4 &&
+           4 * lfs_npw2((lfs_block_t)-1 / (c->block_size - 2 * 4)) <= c->block_size &&
+           c->block_cycles != 0 &&
+           c->lookahead_size != 0 && c->lookahead_size % 8 == 0 &&
+           c->name_max <= LFS_NAME_MAX && c->name_index_size < 0xffff &&
+           (c->read_cache_ways == 0 ||
+            (c->read_cache_sets != 0 && c->read_cache_line % c->read_size == 0 &&
+             c->block_size % c->read_cache_line == 0));
 }
 
-static int fs_sync(const struct lfs_config *c)
+bool vfs_lfs_config_valid(const struct vfs_lfs_config *config)
 {
-    struct context *context = c->context;
-    return fflush(context->file) != EOF ? 0 : -1;
+    struct lfs_config lfs_config = m_default_config;
+    config_resolve(config, &lfs_config);
+    return config_valid(&lfs_config);
 }
 
-static int vfs_lock_init(void)
+void vfs_lfs_config_resolve(struct vfs_lfs_config *config)
 {
-	return pthread_mutex_init(&mutex, NULL);
+    struct lfs_config lfs_config = m_default_config;
+    config_resolve(config, &lfs_config);
+
+    config->read_size = lfs_config.read_size;
+    config->prog_size = lfs_config.prog_size;
+    config->cache_size = lfs_config.cache_size;
+    config->lookahead_size = lfs_config.lookahead_size;
+    config->block_size = lfs_config.block_size;
+    config->block_count = lfs_config.block_count;
 }
 
-static int vfs_lock(void)
+static struct context *vfs_context(struct vfs *vfs)
 {
-	return pthread_mutex_lock(&mutex);
+    return vfs != NULL ? vfs->opaque : NULL;
 }
 
-static int vfs_unlock(void)
+static void vfs_lock(struct context *context)
 {
-	return pthread_mutex_unlock(&mutex);
+    pthread_mutex_lock(&context->mutex);
 }
 
-static int vfs_lock_destory(void)
+static void vfs_unlock(struct context *context)
 {
-	return pthread_mutex_destroy(&mutex);
+    pthread_mutex_unlock(&context->mutex);
 }
 
 int vfs_format(struct vfs *vfs)
@@ -152,45 +192,40 @@ int vfs_format(struct vfs *vfs)
     int result = 0;
 
     lfs_t *lfs = NULL;
+    struct context *context = vfs_context(vfs);
 
-    CHECK_ERROR(vfs != NULL, -1, "vfs == NULL");
+    CHECK_ERROR(context != NULL, -1, "vfs == NULL");
 
     lfs = malloc(sizeof(*lfs));
     CHECK_ERROR(lfs != NULL, -1, "format() failed");
 
-    result = lfs_format(lfs, &m_lfs_config);
+    vfs_lock(context);
+    result = lfs_format(lfs, &context->config);
+    vfs_unlock(context);
     CHECK_ERROR(result == 0, -1, "lfs_format() failed: %d", result);
 
 done:
-    if (lfs != NULL)
-		free(lfs);
-
+    free(lfs);
     return result;
 }
 
-
 int vfs_mount(struct vfs *vfs)
 {
     int result = 0;
 
-    CHECK_ERROR(vfs != NULL, -1, "vfs == NULL");
+    struct context *context = vfs_context(vfs);
 
-	CHECK_ERROR(g_lfs == NULL, -1, "g_lfs != NULL");
+    CHECK_ERROR(context != NULL, -1, "vfs == NULL");
+    CHECK_ERROR(!context->mounted, -1, "already mounted");
 
-    g_lfs = malloc(sizeof(*g_lfs));
-    CHECK_ERROR(g_lfs != NULL, -1, "malloc() failed");
+    vfs_lock(context);
+    int err = lfs_mount(&context->lfs, &context->config);
+    context->mounted = err == 0;
+    vfs_unlock(context);
 
-	vfs_lock_init();
-
-    result = lfs_mount(g_lfs, &m_lfs_config);
-    CHECK_ERROR(result == 0, -1, "lfs_mount() failed: %d", result);
+    CHECK_ERROR(err == 0, -1, "lfs_mount() failed: %d", err);
 
 done:
-    if (result != 0) {
-        free(g_lfs);
-		g_lfs = NULL;
-		vfs_lock_destory();
-    }
     return result;
 }
 
@@ -198,16 +233,18 @@ int vfs_unmount(struct vfs *vfs)
 {
     int result = 0;
 
-    if (g_lfs == NULL)
-		return -1;
+    struct context *context = vfs_context(vfs);
 
-    result = lfs_unmount(g_lfs);
-    CHECK_ERROR(result == 0, -1, "lfs_unmount() failed: %d", result);
+    if (context == NULL || !context->mounted) {
+        return -1;
+    }
 
-    free(g_lfs);
-	g_lfs = NULL;
+    vfs_lock(context);
+    int err = lfs_unmount(&context->lfs);
+    context->mounted = false;
+    vfs_unlock(context);
 
-	vfs_lock_destory();
+    CHECK_ERROR(err == 0, -1, "lfs_unmount() failed: %d", err);
 
 done:
     return result;
@@ -215,13 +252,16 @@ done:
 
 int vfs_remove(struct vfs *vfs, const char *path)
 {
-	int result;
+    int result = 0;
 
+    struct context *context = vfs_context(vfs);
+
+    CHECK_ERROR(context != NULL, -1, "vfs == NULL");
     CHECK_ERROR(path != NULL, -1, "path == NULL");
 
-	vfs_lock();
-    int err = lfs_remove(g_lfs, path);
-	vfs_unlock();
+    vfs_lock(context);
+    int err = lfs_remove(&context->lfs, path);
+    vfs_unlock(context);
     CHECK_ERROR(err == 0, -1, "lfs_remove() failed: %d", err);
 
 done:
@@ -230,14 +270,17 @@ done:
 
 int vfs_rename(struct vfs *vfs, const char *oldpath, const char *newpath)
 {
-	int result;
+    int result = 0;
 
+    struct context *context = vfs_context(vfs);
+
+    CHECK_ERROR(context != NULL, -1, "vfs == NULL");
     CHECK_ERROR(oldpath != NULL, -1, "oldpath == NULL");
-	CHECK_ERROR(newpath != NULL, -1, "newpath == NULL");
+    CHECK_ERROR(newpath != NULL, -1, "newpath == NULL");
 
-	vfs_lock();
-    int err = lfs_rename(g_lfs, oldpath, newpath);
-	vfs_unlock();
+    vfs_lock(context);
+    int err = lfs_rename(&context->lfs, oldpath, newpath);
+    vfs_unlock(context);
     CHECK_ERROR(err == 0, -1, "lfs_rename() failed: %d", err);
 
 done:
@@ -249,7 +292,9 @@ void *vfs_open(struct vfs *vfs, const char *pathname, int flags)
     void *result = NULL;
 
     lfs_file_t *file = NULL;
+    struct context *context = vfs_context(vfs);
 
+    CHECK_ERROR(context != NULL, NULL, "vfs == NULL");
     CHECK_ERROR(pathname != NULL, NULL, "pathname == NULL");
 
     file = malloc(sizeof(*file));
@@ -276,9 +321,9 @@ void *vfs_open(struct vfs *vfs, const char *pathname, int flags)
         lfs_flags |= LFS_O_APPEND;
     }
 
-	vfs_lock();
-    int err = lfs_file_open(g_lfs, file, pathname, lfs_flags);
-	vfs_unlock();
+    vfs_lock(context);
+    int err = lfs_file_open(&context->lfs, file, pathname, lfs_flags);
+    vfs_unlock(context);
 
     CHECK_ERROR(err >= 0, NULL, "lfs_file_open() failed: %d", err);
 
@@ -296,14 +341,16 @@ int vfs_close(struct vfs *vfs, void *fd)
     int result = 0;
 
     lfs_file_t *file = NULL;
+    struct context *context = vfs_context(vfs);
 
+    CHECK_ERROR(context != NULL, -1, "vfs == NULL");
     CHECK_ERROR(fd != NULL, -1, "fd == NULL");
 
     file = fd;
 
-	vfs_lock();
-    int err = lfs_file_close(g_lfs, file);
-	vfs_unlock();
+    vfs_lock(context);
+    int err = lfs_file_close(&context->lfs, file);
+    vfs_unlock(context);
 
     CHECK_ERROR(err == 0, -1, "lfs_file_close() failed: %d", err);
 
@@ -317,14 +364,20 @@ int32_t vfs_read(struct vfs *vfs, void *fd, void *buf, size_t count)
 {
     int32_t result = 0;
 
+    struct context *context = vfs_context(vfs);
+
+    CHECK_ERROR(context != NULL, -1, "vfs == NULL");
     CHECK_ERROR(fd != NULL, -1, "fd == NULL");
     CHECK_ERROR(buf != NULL, -1, "buf == NULL");
 
     lfs_file_t *file = fd;
 
-	vfs_lock();
-    result = lfs_file_read(g_lfs, file, buf, count);
-	vfs_unlock();
+    vfs_lock(context);
+    result = lfs_file_read(&context->lfs, file, buf, count);
+    if (result > 0) {
+        context->payload_read += result;
+    }
+    vfs_unlock(context);
 
     CHECK_ERROR(result >= 0, -1, "lfs_file_read() failed: %d", result);
 
@@ -336,14 +389,21 @@ int32_t vfs_write(struct vfs *vfs, void *fd, const void *buf, size_t count)
 {
     int32_t result = 0;
 
+    struct context *context = vfs_context(vfs);
+
+    CHECK_ERROR(context != NULL, -1, "vfs == NULL");
     CHECK_ERROR(fd != NULL, -1, "fd == NULL");
     CHECK_ERROR(buf != NULL, -1, "buf == NULL");
 
     lfs_file_t *file = fd;
 
-	vfs_lock();
-    result = lfs_file_write(g_lfs, file, buf, count);
-	vfs_unlock();
+    vfs_lock(context);
+    result = lfs_file_write(&context->lfs, file, buf, count);
+    if (result > 0) {
+        context->payload_written += result;
+    }
+    vfs_unlock(context);
+
     CHECK_ERROR(result >= 0, -1, "lfs_file_write() failed: %d", result);
 
 done:
@@ -354,13 +414,16 @@ int32_t vfs_fsync(struct vfs *vfs, void *fd)
 {
     int32_t result = 0;
 
+    struct context *context = vfs_context(vfs);
+
+    CHECK_ERROR(context != NULL, -1, "vfs == NULL");
     CHECK_ERROR(fd != NULL, -1, "fd == NULL");
 
     lfs_file_t *file = fd;
 
-	vfs_lock();
-    result = lfs_file_sync(g_lfs, file);
-	vfs_unlock();
+    vfs_lock(context);
+    result = lfs_file_sync(&context->lfs, file);
+    vfs_unlock(context);
 
     CHECK_ERROR(result >= 0, -1, "lfs_file_sync() failed: %d", result);
 
@@ -370,74 +433,86 @@ done:
 
 int32_t vfs_seek(struct vfs *vfs, void *fd, int32_t off, int whence)
 {
-	int32_t result = 0;
+    int32_t result = 0;
 
+    struct context *context = vfs_context(vfs);
+
+    CHECK_ERROR(context != NULL, -1, "vfs == NULL");
     CHECK_ERROR(fd != NULL, -1, "fd == NULL");
 
     lfs_file_t *file = fd;
 
-	vfs_lock();
-	result = lfs_file_seek(g_lfs, file, off, whence);
-	vfs_unlock();
-	CHECK_ERROR(result >= 0, -1, "lfs_file_sync() failed: %d", result);
+    vfs_lock(context);
+    result = lfs_file_seek(&context->lfs, file, off, whence);
+    vfs_unlock(context);
+
+    CHECK_ERROR(result >= 0, -1, "lfs_file_seek() failed: %d", result);
 
 done:
-	return result;
+    return result;
 }
 
-
 int32_t vfs_tell(struct vfs *vfs, void *fd)
 {
-	int32_t result = 0;
+    int32_t result = 0;
+
+    struct context *context = vfs_context(vfs);
 
+    CHECK_ERROR(context != NULL, -1, "vfs == NULL");
     CHECK_ERROR(fd != NULL, -1, "fd == NULL");
 
     lfs_file_t *file = fd;
 
-	vfs_lock();
-	result = lfs_file_tell(g_lfs, file);
-	vfs_unlock();
+    vfs_lock(context);
+    result = lfs_file_tell(&context->lfs, file);
+    vfs_unlock(context);
 
-	CHECK_ERROR(result >= 0, -1, "lfs_file_tell() failed: %d", result);
+    CHECK_ERROR(result >= 0, -1, "lfs_file_tell() failed: %d", result);
 
 done:
-	return result;
+    return result;
 }
 
 int32_t vfs_stat(struct vfs *vfs, const char *path, struct stat *s)
 {
-	int32_t result = 0;
+    int32_t result = 0;
 
-    CHECK_ERROR(path != NULL, -1, "path== NULL");
+    struct context *context = vfs_context(vfs);
 
-	struct lfs_info info;
+    CHECK_ERROR(context != NULL, -1, "vfs == NULL");
+    CHECK_ERROR(path != NULL, -1, "path == NULL");
+    CHECK_ERROR(s != NULL, -1, "s == NULL");
+
+    struct lfs_info info;
 
-	vfs_lock();
-	result = lfs_stat(g_lfs, path, &info);
-	vfs_unlock();
+    vfs_lock(context);
+    result = lfs_stat(&context->lfs, path, &info);
+    vfs_unlock(context);
 
-	if (!result) {
-		s->st_size = info.size;
-		s->st_mode = S_IRWXU | S_IRWXG | S_IRWXO |
-		             ((info.type == LFS_TYPE_DIR)? S_IFDIR: S_IFREG);
-	}
+    if (!result) {
+        s->st_size = info.size;
+        s->st_mode = S_IRWXU | S_IRWXG | S_IRWXO |
+                     ((info.type == LFS_TYPE_DIR) ? S_IFDIR : S_IFREG);
+    }
 
-	CHECK_ERROR(result >= 0, -1, "lfs_file_tell() failed: %d", result);
+    CHECK_ERROR(result >= 0, -1, "lfs_stat() failed: %d", result);
 
 done:
-	return result;
+    return result;
 }
 
-
 int vfs_mkdir(struct vfs *vfs, const char *pathname)
 {
     int result = 0;
 
+    struct context *context = vfs_context(vfs);
+
+    CHECK_ERROR(context != NULL, -1, "vfs == NULL");
     CHECK_ERROR(pathname != NULL, -1, "pathname == NULL");
 
-	vfs_lock();
-    int err = lfs_mkdir(g_lfs, pathname);
-	vfs_unlock();
+    vfs_lock(context);
+    int err = lfs_mkdir(&context->lfs, pathname);
+    vfs_unlock(context);
 
     CHECK_ERROR(err == 0 || err == LFS_ERR_EXIST, -1, "lfs_mkdir() failed: %d", err);
 
@@ -445,20 +520,22 @@ done:
     return result;
 }
 
-void * vfs_opendir(struct vfs *vfs, const char *path)
+void *vfs_opendir(struct vfs *vfs, const char *path)
 {
     void *result = NULL;
 
-    lfs_dir_t *dir = NULL;
+    struct dir *dir = NULL;
+    struct context *context = vfs_context(vfs);
 
+    CHECK_ERROR(context != NULL, NULL, "vfs == NULL");
     CHECK_ERROR(path != NULL, NULL, "path == NULL");
 
     dir = malloc(sizeof(*dir));
     CHECK_ERROR(dir != NULL, NULL, "malloc() failed");
 
-	vfs_lock();
-    int err = lfs_dir_open(g_lfs, dir, path);
-	vfs_unlock();
+    vfs_lock(context);
+    int err = lfs_dir_open(&context->lfs, &dir->dir, path);
+    vfs_unlock(context);
 
     CHECK_ERROR(err == 0, NULL, "lfs_dir_open() failed: %d", err);
 
@@ -475,13 +552,16 @@ int vfs_closedir(struct vfs *vfs, void *dir)
 {
     int result = 0;
 
+    struct context *context = vfs_context(vfs);
+
+    CHECK_ERROR(context != NULL, -1, "vfs == NULL");
     CHECK_ERROR(dir != NULL, -1, "dir == NULL");
 
-    lfs_dir_t *lfs_dir = dir;
+    struct dir *lfs_dir = dir;
 
-	vfs_lock();
-	int err = lfs_dir_close(g_lfs, lfs_dir);
-	vfs_unlock();
+    vfs_lock(context);
+    int err = lfs_dir_close(&context->lfs, &lfs_dir->dir);
+    vfs_unlock(context);
 
     CHECK_ERROR(err == 0, -1, "lfs_dir_close() failed: %d", err);
 
@@ -491,45 +571,47 @@ done:
     return result;
 }
 
-struct vfs_dirent* vfs_readdir(struct vfs *vfs, void *dir)
+struct vfs_dirent *vfs_readdir(struct vfs *vfs, void *dir)
 {
     struct vfs_dirent *result = NULL;
 
+    struct context *context = vfs_context(vfs);
+
+    CHECK_ERROR(context != NULL, NULL, "vfs == NULL");
     CHECK_ERROR(dir != NULL, NULL, "dir == NULL");
 
-    lfs_dir_t *lfs_dir = dir;
+    struct dir *lfs_dir = dir;
+    struct vfs_dirent *dirent = &lfs_dir->dirent;
 
     struct lfs_info info = {0};
 
-	vfs_lock();
-    int err = lfs_dir_read(g_lfs, lfs_dir, &info);
-	vfs_unlock();
+    vfs_lock(context);
+    int err = lfs_dir_read(&context->lfs, &lfs_dir->dir, &info);
+    vfs_unlock(context);
 
     CHECK_ERROR(err >= 0, NULL, "lfs_dir_read() failed: %d", err);
 
-    static struct vfs_dirent dirent = {0};
-
     if (err == 0)
     {
-        dirent.name[0] = '\0';
-        dirent.type = VFS_TYPE_END;
+        dirent->name[0] = '\0';
+        dirent->type = VFS_TYPE_END;
     }
     else
     {
-        CHECK_ERROR(strlen(info.name) < sizeof(dirent.name), NULL, "info.name is too small");
-        strncpy(dirent.name, info.name, sizeof(dirent.name) - 1);
-        dirent.type = info.type == LFS_TYPE_REG ? VFS_TYPE_FILE : VFS_TYPE_DIR;
+        CHECK_ERROR(strlen(info.name) < sizeof(dirent->name), NULL, "info.name is too small");
+        strncpy(dirent->name, info.name, sizeof(dirent->name) - 1);
+        dirent->name[sizeof(dirent->name) - 1] = '\0';
+        dirent->type = info.type == LFS_TYPE_REG ? VFS_TYPE_FILE : VFS_TYPE_DIR;
     }
 
-    result = &dirent;
+    result = dirent;
 
 done:
     return result;
 }
 
-
-static struct vfs vfs_lfs = {
-	.format = vfs_format,
+static const struct vfs m_vfs_lfs = {
+    .format = vfs_format,
     .mount = vfs_mount,
     .unmount = vfs_unmount,
     .remove = vfs_remove,
@@ -543,48 +625,154 @@ static struct vfs vfs_lfs = {
     .seek = vfs_seek,
     .tell = vfs_tell,
 
-	.mkdir = vfs_mkdir,
+    .mkdir = vfs_mkdir,
     .opendir = vfs_opendir,
     .closedir = vfs_closedir,
     .readdir = vfs_readdir,
 };
 
-struct vfs *vfs_lfs_get(const char *image, bool write, size_t name_max, size_t io_size, size_t block_size,
-                        size_t block_count)
+struct vfs *vfs_lfs_get(const char *image, bool write, const struct bd_config *bd_config,
+                        const struct vfs_lfs_config *config)
 {
     struct vfs *result = NULL;
 
-    m_context.file = fopen(image, write ? "w+b" : "rb");
-    CHECK_ERROR(m_context.file != NULL, NULL, "fopen() failed: %s", strerror(errno));
+    struct vfs *vfs = NULL;
+    struct context *context = NULL;
+    bool mutex = false;
 
-    m_lfs_config.context = &m_context;
+    CHECK_ERROR(image != NULL, NULL, "image == NULL");
+    CHECK_ERROR(bd_config != NULL, NULL, "bd_config == NULL");
+    CHECK_ERROR(config != NULL, NULL, "config == NULL");
 
-    if (io_size != 0) {
-        m_lfs_config.read_size = io_size;
-        m_lfs_config.prog_size = io_size;
-        m_lfs_config.cache_size = io_size;
-        m_lfs_config.lookahead_size = io_size;
-    }
+    vfs = malloc(sizeof(*vfs));
+    CHECK_ERROR(vfs != NULL, NULL, "malloc() failed");
+    *vfs = m_vfs_lfs;
 
-    if (block_size != 0) {
-        m_lfs_config.block_size = block_size;
-    }
+    context = calloc(1, sizeof(*context));
+    CHECK_ERROR(context != NULL, NULL, "calloc() failed");
 
-    m_lfs_config.block_count = block_count != 0 ? block_count : 4059;
-    m_lfs_config.name_max = name_max;
+    int err = pthread_mutex_init(&context->mutex, NULL);
+    CHECK_ERROR(err == 0, NULL, "pthread_mutex_init() failed: %d", err);
+    mutex = true;
 
-    if (write) {
-        for (size_t i = 0; i < m_lfs_config.block_count * m_lfs_config.block_size; i++) {
-            int c = fputc(0xff, m_context.file);
-            CHECK_ERROR(c == 0xFF, NULL, "fputc() failed: %d", c);
-        }
+    context->config = m_default_config;
+    context->config.context = context;
+
+    config_resolve(config, &context->config);
+    CHECK_ERROR(config_valid(&context->config), NULL,
+                "invalid lfs configuration: read: %" PRIu32 ", prog: %" PRIu32 ", cache: %" PRIu32
+                ", lookahead: %" PRIu32 ", block: %" PRIu32, context->config.read_size, context->config.prog_size,
+                context->config.cache_size, context->config.lookahead_size, context->config.block_size);
+
+    context->stats = bd_config->stats;
 
+    context->bd = bd_open(bd_config, image, write, context->config.block_size, context->config.block_count);
+    CHECK_ERROR(context->bd != NULL, NULL, "bd_open() failed");
+
+    if (write) {
         lfs_t lfs = {0};
-        int err = lfs_format(&lfs, &m_lfs_config);
+        err = lfs_format(&lfs, &context->config);
         CHECK_ERROR(err == 0, NULL, "lfs_format() failed: %d", err);
     }
 
-    result = &vfs_lfs;
+    vfs->opaque = context;
+    result = vfs;
+
+done:
+    if (result == NULL) {
+        if (context != NULL) {
+            if (context->bd != NULL) {
+                context->bd->close(context->bd);
+            }
+            if (mutex) {
+                pthread_mutex_destroy(&context->mutex);
+            }
+        }
+        free(context);
+        free(vfs);
+    }
+    return result;
+}
+
+int vfs_lfs_put(struct vfs *vfs)
+{
+    int result = 0;
+
+    struct context *context = vfs_context(vfs);
+
+    CHECK_ERROR(context != NULL, -1, "vfs == NULL");
+    CHECK_ERROR(!context->mounted, -1, "image is still mounted");
+
+    int err = context->bd->close(context->bd);
+    if (err != 0) {
+        ERROR("bd->close() failed: %d", err);
+        result = -1;
+    }
+
+    pthread_mutex_destroy(&context->mutex);
+    free(context);
+    free(vfs);
+
+done:
+    return result;
+}
+
+int vfs_lfs_report(struct vfs *vfs, FILE *text, FILE *json)
+{
+    int result = 0;
+
+    struct context *context = vfs_context(vfs);
+
+    CHECK_ERROR(context != NULL, -1, "vfs == NULL");
+    CHECK_ERROR(context->stats, -1, "statistics are not enabled");
+
+    vfs_lock(context);
+    bd_stats_report(context->bd, context->payload_written, context->payload_read, text, NULL);
+
+    // counters of the last mount, they survive lfs_unmount()
+    const struct lfs_lcache *lcache = &context->lfs.lcache;
+    uint64_t reads = (uint64_t)lcache->hits + lcache->misses;
+    fprintf(text, "lfs read cache: %" PRIu32 " hits, %" PRIu32 " misses, %.1f%% hit rate", lcache->hits,
+            lcache->misses, reads != 0 ? 100.0 * lcache->hits / reads : 0.0);
+    if (context->config.read_cache_ways != 0) {
+        fprintf(text, " (%" PRIu32 " ways x %" PRIu32 " sets x %" PRIu32 " bytes)\n",
+                context->config.read_cache_ways, context->config.read_cache_sets, context->config.read_cache_line);
+    } else {
+        fprintf(text, " (single line)\n");
+    }
+
+    const struct lfs_mcache *mcache = &context->lfs.mcache;
+    uint64_t fetches = (uint64_t)mcache->hits + mcache->misses;
+    fprintf(text,
+            "lfs mdir cache: %" PRIu32 " hits, %" PRIu32 " misses, %.1f%% hit rate (%" PRIu32 " pairs), %" PRIu32
+            " indexed lookups\n",
+            mcache->hits, mcache->misses, fetches != 0 ? 100.0 * mcache->hits / fetches : 0.0,
+            context->config.mdir_cache_size, mcache->indexed);
+
+    const struct lfs_nindex *nindex = &context->lfs.nindex;
+    fprintf(text, "lfs name index: %" PRIu32 " seeks, %" PRIu32 " pairs skipped (%" PRIu32 " directories)\n",
+            nindex->seeks, nindex->skipped, context->config.name_index_size);
+
+    if (json != NULL) {
+        fprintf(json, "{\n");
+        bd_stats_report_fields(context->bd, context->payload_written, context->payload_read, json);
+        fprintf(json, ",\n  \"lfs\": {\n");
+        fprintf(json,
+                "    \"read_cache\": {\"hits\": %" PRIu32 ", \"misses\": %" PRIu32 ", \"ways\": %" PRIu32
+                ", \"sets\": %" PRIu32 ", \"line\": %" PRIu32 "},\n",
+                lcache->hits, lcache->misses, context->config.read_cache_ways, context->config.read_cache_sets,
+                context->config.read_cache_line);
+        fprintf(json,
+                "    \"mdir_cache\": {\"hits\": %" PRIu32 ", \"misses\": %" PRIu32 ", \"pairs\": %" PRIu32
+                ", \"indexed\": %" PRIu32 "},\n",
+                mcache->hits, mcache->misses, context->config.mdir_cache_size, mcache->indexed);
+        fprintf(json,
+                "    \"name_index\": {\"seeks\": %" PRIu32 ", \"skipped\": %" PRIu32 ", \"directories\": %" PRIu32
+                "}\n",
+                nindex->seeks, nindex->skipped, context->config.name_index_size);
+        fprintf(json, "  }\n}\n");
+    }
+    vfs_unlock(context);
 
 done:
     return result;
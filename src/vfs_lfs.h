@@ -15,13 +15,71 @@
 #pragma once
 
 #include <stdbool.h>
+#include <stdio.h>
 #include <sys/types.h>
 #include <sys/stat.h>
 
 #include "vfs.h"
-
-struct vfs *vfs_lfs_get(const char *image, bool write, size_t name_max, size_t io_size, size_t block_size,
-                        size_t block_count);
+#include "bd.h"
+
+// lfs parameters of an image, fields left 0 take the defaults.
+struct vfs_lfs_config
+{
+    size_t name_max;
+    // default of the four sizes below, without it lookahead_size covers the
+    // whole image
+    size_t io_size;
+    size_t read_size;
+    size_t prog_size;
+    size_t cache_size;
+    size_t lookahead_size;
+    size_t block_size;
+    size_t block_count;
+    // erase cycles of a metadata block before lfs moves it, -1 disables
+    // wear leveling [default: -1]
+    int32_t block_cycles;
+    // lines of the lfs read cache, see read_cache_ways in lfs_config; ways
+    // 0 disables it, line 0 is cache_size
+    size_t read_cache_ways;
+    size_t read_cache_sets;
+    size_t read_cache_line;
+    // fetched metadata pairs kept in RAM, see mdir_cache_size in lfs_config;
+    // -1 disables the cache [default: 1024]
+    int32_t mdir_cache_size;
+    // directories whose pairs are indexed by name, see name_index_size in
+    // lfs_config; -1 disables the index [default: 64]
+    int32_t name_index_size;
+    // split pairs at the end of directories filled in name order, see
+    // bulk_load in lfs_config
+    bool bulk_load;
+    // blocks of each open file whose position is kept, see ctz_cache_size
+    // in lfs_config; -1 disables the cache [default: 64]
+    int32_t ctz_cache_size;
+};
+
+// Checks config against the lfs_init() asserts: cache_size is a multiple of
+// read_size and prog_size, block_size of cache_size, lookahead_size of 8,
+// name_index_size is below 0xffff.
+bool vfs_lfs_config_valid(const struct vfs_lfs_config *config);
+
+// Replaces the sizes and geometry left 0 in config with the values an image
+// opened with it gets.
+void vfs_lfs_config_resolve(struct vfs_lfs_config *config);
+
+// Opens image, formatting it when write is set. Every call returns a separate
+// instance with its own lfs state and lock, images may be used from different
+// threads concurrently.
+struct vfs *vfs_lfs_get(const char *image, bool write, const struct bd_config *bd_config,
+                        const struct vfs_lfs_config *config);
+
+// Releases the image opened by vfs_lfs_get() and frees vfs, it must be
+// unmounted.
+int vfs_lfs_put(struct vfs *vfs);
+
+// Prints block device statistics of the image opened with bd_config->stats,
+// see bd_stats_report(), and the counters of the lfs caches, to text and as
+// the "lfs" member of the JSON object to json. json may be NULL.
+int vfs_lfs_report(struct vfs *vfs, FILE *text, FILE *json);
 
 int vfs_format(struct vfs *vfs);
 
@@ -47,6 +105,7 @@ int32_t vfs_seek(struct vfs *vfs, void *fd, int32_t off, int whence);
 
 int32_t vfs_tell(struct vfs *vfs, void *fd);
 
+
 int32_t vfs_stat(struct vfs *vfs, const char *path, struct stat *s);
 
 
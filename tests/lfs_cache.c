@@ -0,0 +1,193 @@
+#include "unity_fixture.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "lfs/lfs.h"
+#include "lfs_ram.h"
+
+// small blocks so the directories span several pairs and files get CTZ lists
+#define BLOCK_SIZE 512
+#define BLOCK_COUNT 1024
+#define FILES 120
+#define BIG_SIZE (96 * 1024)
+
+// lfs-tool defaults, see config_resolve() in vfs_lfs.c
+#define MDIR_CACHE_SIZE 1024
+#define NAME_INDEX_SIZE 64
+#define CTZ_CACHE_SIZE 64
+
+static uint8_t m_image[BLOCK_SIZE * BLOCK_COUNT];
+static uint8_t m_reference[BLOCK_SIZE * BLOCK_COUNT];
+
+static struct lfs_config config(lfs_size_t mdir_cache_size, lfs_size_t name_index_size, lfs_size_t ctz_cache_size)
+{
+    struct lfs_config config = lfs_ram_config(m_image, BLOCK_SIZE, BLOCK_COUNT);
+    config.mdir_cache_size = mdir_cache_size;
+    config.name_index_size = name_index_size;
+    config.ctz_cache_size = ctz_cache_size;
+    return config;
+}
+
+static uint8_t pattern(unsigned file, lfs_off_t pos)
+{
+    return (uint8_t)((pos + file * 131) * 2654435761u >> 24);
+}
+
+static void file_check(lfs_t *lfs, const char *path, unsigned file, lfs_size_t size)
+{
+    uint8_t buffer[BLOCK_SIZE];
+    lfs_file_t fd;
+    TEST_ASSERT_EQUAL(0, lfs_file_open(lfs, &fd, path, LFS_O_RDONLY));
+    TEST_ASSERT_EQUAL(size, lfs_file_size(lfs, &fd));
+    for (lfs_off_t pos = 0; pos < size; pos += sizeof(buffer)) {
+        lfs_size_t chunk = size - pos < sizeof(buffer) ? size - pos : sizeof(buffer);
+        TEST_ASSERT_EQUAL(chunk, lfs_file_read(lfs, &fd, buffer, sizeof(buffer)));
+        for (lfs_off_t i = 0; i < chunk; i++) {
+            TEST_ASSERT_EQUAL_HEX8(pattern(file, pos + i), buffer[i]);
+        }
+    }
+    TEST_ASSERT_EQUAL(0, lfs_file_close(lfs, &fd));
+}
+
+// Creates, renames, removes and reads back files with user attributes, then
+// reads a large file at random offsets. The image is left in m_image.
+static void workload(const struct lfs_config *config)
+{
+    char path[32];
+    char to[32];
+    uint8_t buffer[BLOCK_SIZE];
+    lfs_size_t sizes[FILES];
+    lfs_t lfs;
+    lfs_file_t fd;
+
+    memset(m_image, 0xff, sizeof(m_image));
+    TEST_ASSERT_EQUAL(0, lfs_format(&lfs, config));
+    TEST_ASSERT_EQUAL(0, lfs_mount(&lfs, config));
+    TEST_ASSERT_EQUAL(0, lfs_mkdir(&lfs, "src"));
+    TEST_ASSERT_EQUAL(0, lfs_mkdir(&lfs, "dst"));
+
+    srand(1);
+    for (unsigned i = 0; i < FILES; i++) {
+        // out of name order, so entries land in the middle of pairs
+        unsigned file = i * 37 % FILES;
+        sizes[file] = rand() % (3 * BLOCK_SIZE);
+        snprintf(path, sizeof(path), "src/file%03u", file);
+
+        TEST_ASSERT_EQUAL(0, lfs_file_open(&lfs, &fd, path, LFS_O_WRONLY | LFS_O_CREAT | LFS_O_EXCL));
+        for (lfs_off_t pos = 0; pos < sizes[file]; pos++) {
+            uint8_t byte = pattern(file, pos);
+            TEST_ASSERT_EQUAL(1, lfs_file_write(&lfs, &fd, &byte, 1));
+        }
+        TEST_ASSERT_EQUAL(0, lfs_file_close(&lfs, &fd));
+        if (file % 3 == 0) {
+            uint32_t value = file;
+            TEST_ASSERT_EQUAL(0, lfs_setattr(&lfs, path, file % 4, &value, sizeof(value)));
+        }
+    }
+
+    for (unsigned file = 0; file < FILES; file += 2) {
+        snprintf(path, sizeof(path), "src/file%03u", file);
+        snprintf(to, sizeof(to), "dst/file%03u", file);
+        TEST_ASSERT_EQUAL(0, lfs_rename(&lfs, path, to));
+    }
+    for (unsigned file = 0; file < FILES; file += 5) {
+        snprintf(path, sizeof(path), "%s/file%03u", file % 2 == 0 ? "dst" : "src", file);
+        TEST_ASSERT_EQUAL(0, lfs_remove(&lfs, path));
+    }
+
+    TEST_ASSERT_EQUAL(0, lfs_file_open(&lfs, &fd, "big", LFS_O_RDWR | LFS_O_CREAT));
+    for (lfs_off_t pos = 0; pos < BIG_SIZE; pos += sizeof(buffer)) {
+        for (lfs_off_t i = 0; i < sizeof(buffer); i++) {
+            buffer[i] = pattern(FILES, pos + i);
+        }
+        TEST_ASSERT_EQUAL(sizeof(buffer), lfs_file_write(&lfs, &fd, buffer, sizeof(buffer)));
+    }
+    TEST_ASSERT_EQUAL(0, lfs_file_sync(&lfs, &fd));
+    for (unsigned i = 0; i < 200; i++) {
+        lfs_off_t pos = rand() % (BIG_SIZE - sizeof(buffer));
+        TEST_ASSERT_EQUAL(pos, lfs_file_seek(&lfs, &fd, pos, LFS_SEEK_SET));
+        TEST_ASSERT_EQUAL(sizeof(buffer), lfs_file_read(&lfs, &fd, buffer, sizeof(buffer)));
+        for (lfs_off_t j = 0; j < sizeof(buffer); j++) {
+            TEST_ASSERT_EQUAL_HEX8(pattern(FILES, pos + j), buffer[j]);
+        }
+    }
+    TEST_ASSERT_EQUAL(0, lfs_file_close(&lfs, &fd));
+
+    // again after a remount, which starts from empty caches
+    TEST_ASSERT_EQUAL(0, lfs_unmount(&lfs));
+    TEST_ASSERT_EQUAL(0, lfs_mount(&lfs, config));
+    for (unsigned file = 0; file < FILES; file++) {
+        snprintf(path, sizeof(path), "%s/file%03u", file % 2 == 0 ? "dst" : "src", file);
+        struct lfs_info info;
+        if (file % 5 == 0) {
+            TEST_ASSERT_EQUAL(LFS_ERR_NOENT, lfs_stat(&lfs, path, &info));
+            continue;
+        }
+
+        file_check(&lfs, path, file, sizes[file]);
+        if (file % 3 == 0) {
+            uint32_t value = 0;
+            TEST_ASSERT_EQUAL(sizeof(value), lfs_getattr(&lfs, path, file % 4, &value, sizeof(value)));
+            TEST_ASSERT_EQUAL(file, value);
+        }
+    }
+    file_check(&lfs, "big", FILES, BIG_SIZE);
+    TEST_ASSERT_EQUAL(0, lfs_unmount(&lfs));
+}
+
+// the workload must leave the same image with both configurations
+static void image_equal(const struct lfs_config *without, const struct lfs_config *with)
+{
+    workload(without);
+    memcpy(m_reference, m_image, sizeof(m_image));
+    workload(with);
+    TEST_ASSERT_EQUAL_MEMORY(m_reference, m_image, sizeof(m_image));
+}
+
+TEST_GROUP(LfsCache);
+
+TEST_SETUP(LfsCache)
+{}
+
+TEST_TEAR_DOWN(LfsCache)
+{}
+
+TEST(LfsCache, MdirCache)
+{
+    struct lfs_config without = config(0, 0, 0);
+    struct lfs_config with = config(MDIR_CACHE_SIZE, 0, 0);
+    image_equal(&without, &with);
+}
+
+TEST(LfsCache, NameIndex)
+{
+    // the name index needs the metadata pair cache
+    struct lfs_config without = config(MDIR_CACHE_SIZE, 0, 0);
+    struct lfs_config with = config(MDIR_CACHE_SIZE, NAME_INDEX_SIZE, 0);
+    image_equal(&without, &with);
+}
+
+TEST(LfsCache, CtzCache)
+{
+    struct lfs_config without = config(0, 0, 0);
+    struct lfs_config with = config(0, 0, CTZ_CACHE_SIZE);
+    image_equal(&without, &with);
+}
+
+TEST(LfsCache, Defaults)
+{
+    struct lfs_config without = config(0, 0, 0);
+    struct lfs_config with = config(MDIR_CACHE_SIZE, NAME_INDEX_SIZE, CTZ_CACHE_SIZE);
+    with.compact_table = true;
+    image_equal(&without, &with);
+}
+
+TEST_GROUP_RUNNER(LfsCache)
+{
+    RUN_TEST_CASE(LfsCache, MdirCache);
+    RUN_TEST_CASE(LfsCache, NameIndex);
+    RUN_TEST_CASE(LfsCache, CtzCache);
+    RUN_TEST_CASE(LfsCache, Defaults);
+}
@@ -0,0 +1,159 @@
+#include "unity_fixture.h"
+
+#include <stdio.h>
+#include <string.h>
+
+#include "lfs/lfs.h"
+#include "lfs/lfs_util.h"
+#include "lfs_ram.h"
+
+// small blocks so the directories compact and split often
+#define BLOCK_SIZE 512
+#define BLOCK_COUNT 256
+#define FILES 48
+#define ATTRS 4
+
+// CRC of the image RenameAttrs leaves, as left by the recursive
+// lfs_dir_traverse of littlefs v2.1
+#define RENAME_ATTRS_CRC 0xbeb3daa6
+
+static uint8_t m_image[BLOCK_SIZE * BLOCK_COUNT];
+
+// the metadata pair cache is off, every compaction goes through
+// lfs_dir_traverse unless compact_table is set
+static struct lfs_config m_config;
+
+static uint32_t attr_value(unsigned file, uint8_t type)
+{
+    return file * ATTRS + type + (type == 1 ? 1000 : 0);
+}
+
+// where file ends up after the renames of RenameAttrs, false if another
+// file was renamed over it
+static bool file_path(unsigned file, char *path, size_t size)
+{
+    switch (file % 6) {
+        case 1:
+            snprintf(path, size, "src/moved%02u", file);
+            return true;
+        case 3:
+            snprintf(path, size, "src/file%02u", file + 2);
+            return true;
+        case 5:
+            return false;
+        default:
+            snprintf(path, size, "dst/file%02u", file);
+            return true;
+    }
+}
+
+// Renames files with user attributes between and within directories, and
+// over each other, after rewriting and removing some of the attributes. The
+// image is left in m_image.
+static void rename_attrs(void)
+{
+    char path[32];
+    char to[32];
+    lfs_t lfs;
+    lfs_file_t fd;
+
+    TEST_ASSERT_EQUAL(0, lfs_format(&lfs, &m_config));
+    TEST_ASSERT_EQUAL(0, lfs_mount(&lfs, &m_config));
+    TEST_ASSERT_EQUAL(0, lfs_mkdir(&lfs, "src"));
+    TEST_ASSERT_EQUAL(0, lfs_mkdir(&lfs, "dst"));
+
+    for (unsigned file = 0; file < FILES; file++) {
+        snprintf(path, sizeof(path), "src/file%02u", file);
+        TEST_ASSERT_EQUAL(0, lfs_file_open(&lfs, &fd, path, LFS_O_WRONLY | LFS_O_CREAT | LFS_O_EXCL));
+        TEST_ASSERT_EQUAL(sizeof(file), lfs_file_write(&lfs, &fd, &file, sizeof(file)));
+        TEST_ASSERT_EQUAL(0, lfs_file_close(&lfs, &fd));
+        for (uint8_t type = 0; type < ATTRS; type++) {
+            uint32_t value = file * ATTRS + type;
+            TEST_ASSERT_EQUAL(0, lfs_setattr(&lfs, path, type, &value, sizeof(value)));
+        }
+    }
+    for (unsigned file = 0; file < FILES; file++) {
+        snprintf(path, sizeof(path), "src/file%02u", file);
+        uint32_t value = attr_value(file, 1);
+        TEST_ASSERT_EQUAL(0, lfs_setattr(&lfs, path, 1, &value, sizeof(value)));
+        if (file % 4 == 0) {
+            TEST_ASSERT_EQUAL(0, lfs_removeattr(&lfs, path, 2));
+        }
+    }
+
+    for (unsigned file = 0; file < FILES; file++) {
+        snprintf(path, sizeof(path), "src/file%02u", file);
+        if (file_path(file, to, sizeof(to))) {
+            TEST_ASSERT_EQUAL(0, lfs_rename(&lfs, path, to));
+        }
+    }
+
+    TEST_ASSERT_EQUAL(0, lfs_unmount(&lfs));
+    TEST_ASSERT_EQUAL(0, lfs_mount(&lfs, &m_config));
+    for (unsigned file = 0; file < FILES; file++) {
+        struct lfs_info info;
+        if (file % 2 == 0) {
+            snprintf(path, sizeof(path), "src/file%02u", file);
+            TEST_ASSERT_EQUAL(LFS_ERR_NOENT, lfs_stat(&lfs, path, &info));
+        }
+        if (!file_path(file, path, sizeof(path))) {
+            continue;
+        }
+
+        unsigned data = 0;
+        TEST_ASSERT_EQUAL(0, lfs_file_open(&lfs, &fd, path, LFS_O_RDONLY));
+        TEST_ASSERT_EQUAL(sizeof(data), lfs_file_read(&lfs, &fd, &data, sizeof(data)));
+        TEST_ASSERT_EQUAL(0, lfs_file_close(&lfs, &fd));
+        TEST_ASSERT_EQUAL(file, data);
+
+        for (uint8_t type = 0; type < ATTRS; type++) {
+            uint32_t value = 0;
+            lfs_ssize_t res = lfs_getattr(&lfs, path, type, &value, sizeof(value));
+            if (type == 2 && file % 4 == 0) {
+                TEST_ASSERT_EQUAL(LFS_ERR_NOATTR, res);
+            } else {
+                TEST_ASSERT_EQUAL(sizeof(value), res);
+                TEST_ASSERT_EQUAL(attr_value(file, type), value);
+            }
+        }
+    }
+    TEST_ASSERT_EQUAL(0, lfs_unmount(&lfs));
+}
+
+TEST_GROUP(LfsCompact);
+
+TEST_SETUP(LfsCompact)
+{
+    m_config = lfs_ram_config(m_image, BLOCK_SIZE, BLOCK_COUNT);
+}
+
+TEST_TEAR_DOWN(LfsCompact)
+{}
+
+// The redundant tags rename_attrs leaves in the logs and the moves pending
+// at each compaction must compact to the same image as before.
+TEST(LfsCompact, RenameAttrs)
+{
+    rename_attrs();
+    TEST_ASSERT_EQUAL_HEX32(RENAME_ATTRS_CRC, lfs_crc(0xffffffff, m_image, sizeof(m_image)));
+}
+
+// The one-pass compaction must keep the same tags as lfs_dir_traverse.
+TEST(LfsCompact, Table)
+{
+    static uint8_t reference[sizeof(m_image)];
+
+    rename_attrs();
+    memcpy(reference, m_image, sizeof(m_image));
+
+    m_config = lfs_ram_config(m_image, BLOCK_SIZE, BLOCK_COUNT);
+    m_config.compact_table = true;
+    rename_attrs();
+    TEST_ASSERT_EQUAL_MEMORY(reference, m_image, sizeof(m_image));
+}
+
+TEST_GROUP_RUNNER(LfsCompact)
+{
+    RUN_TEST_CASE(LfsCompact, RenameAttrs);
+    RUN_TEST_CASE(LfsCompact, Table);
+}
@@ -0,0 +1,77 @@
+#include "unity_fixture.h"
+
+#include <stdlib.h>
+
+#include "lfs/lfs_util.h"
+
+// covers every alignment and tail length around the 16 and 64 byte steps
+#define BUFFER_SIZE 1024
+
+static uint8_t m_buffer[BUFFER_SIZE + 16];
+
+static void crc_equal(lfs_crc_t crc)
+{
+    for (size_t off = 0; off < 16; off++) {
+        for (size_t size = 0; size <= BUFFER_SIZE; size += size < 200 ? 1 : 37) {
+            uint32_t seed = rand();
+            TEST_ASSERT_EQUAL_HEX32(lfs_crc_nibble(seed, m_buffer + off, size),
+                                    crc(seed, m_buffer + off, size));
+        }
+    }
+}
+
+TEST_GROUP(LfsCrc);
+
+TEST_SETUP(LfsCrc)
+{
+    srand(1);
+    for (size_t i = 0; i < sizeof(m_buffer); i++) {
+        m_buffer[i] = rand();
+    }
+}
+
+TEST_TEAR_DOWN(LfsCrc)
+{}
+
+TEST(LfsCrc, Check)
+{
+    // CRC-32 check value is ~crc("123456789") from ~0
+    TEST_ASSERT_EQUAL_HEX32(0xcbf43926, ~lfs_crc(0xffffffff, "123456789", 9));
+}
+
+TEST(LfsCrc, Slice8)
+{
+    crc_equal(lfs_crc_slice8);
+}
+
+TEST(LfsCrc, Hardware)
+{
+    lfs_crc_t crc = lfs_crc_hw();
+    if (crc == NULL) {
+        TEST_IGNORE_MESSAGE("no hardware CRC on this CPU");
+    }
+    crc_equal(crc);
+}
+
+TEST(LfsCrc, Dispatch)
+{
+    crc_equal(lfs_crc);
+}
+
+TEST(LfsCrc, Chained)
+{
+    uint32_t crc = 0xffffffff;
+    for (size_t off = 0; off < BUFFER_SIZE; off += 100) {
+        crc = lfs_crc(crc, m_buffer + off, off + 100 <= BUFFER_SIZE ? 100 : BUFFER_SIZE - off);
+    }
+    TEST_ASSERT_EQUAL_HEX32(lfs_crc_nibble(0xffffffff, m_buffer, BUFFER_SIZE), crc);
+}
+
+TEST_GROUP_RUNNER(LfsCrc)
+{
+    RUN_TEST_CASE(LfsCrc, Check);
+    RUN_TEST_CASE(LfsCrc, Slice8);
+    RUN_TEST_CASE(LfsCrc, Hardware);
+    RUN_TEST_CASE(LfsCrc, Dispatch);
+    RUN_TEST_CASE(LfsCrc, Chained);
+}
@@ -0,0 +1,51 @@
+#include "lfs_ram.h"
+
+#include <string.h>
+
+static int ram_read(const struct lfs_config *c, lfs_block_t block, lfs_off_t off, void *buffer, lfs_size_t size)
+{
+    const uint8_t *image = c->context;
+    memcpy(buffer, image + (size_t)block * c->block_size + off, size);
+    return 0;
+}
+
+static int ram_prog(const struct lfs_config *c, lfs_block_t block, lfs_off_t off, const void *buffer,
+                    lfs_size_t size)
+{
+    uint8_t *image = c->context;
+    memcpy(image + (size_t)block * c->block_size + off, buffer, size);
+    return 0;
+}
+
+static int ram_erase(const struct lfs_config *c, lfs_block_t block)
+{
+    uint8_t *image = c->context;
+    memset(image + (size_t)block * c->block_size, 0xff, c->block_size);
+    return 0;
+}
+
+static int ram_sync(const struct lfs_config *c)
+{
+    return 0;
+}
+
+struct lfs_config lfs_ram_config(uint8_t *image, lfs_size_t block_size, lfs_size_t block_count)
+{
+    struct lfs_config config = {
+        .context = image,
+        .read = ram_read,
+        .prog = ram_prog,
+        .erase = ram_erase,
+        .sync = ram_sync,
+        .read_size = 16,
+        .prog_size = 16,
+        .block_size = block_size,
+        .block_count = block_count,
+        .block_cycles = -1,
+        .cache_size = 64,
+        .lookahead_size = ((block_count + 7) / 8 + 7) / 8 * 8,
+    };
+
+    memset(image, 0xff, (size_t)block_size * block_count);
+    return config;
+}
@@ -0,0 +1,11 @@
+#pragma once
+
+#include <stdint.h>
+
+#include "lfs/lfs.h"
+
+// lfs_config of an image in RAM: block_count blocks of block_size at image,
+// read and prog sizes of 16 bytes, a cache of 64 bytes, a lookahead covering
+// the whole image and no wear leveling. Optional fields are left 0. The
+// image is erased.
+struct lfs_config lfs_ram_config(uint8_t *image, lfs_size_t block_size, lfs_size_t block_count);
@@ -2,6 +2,10 @@
 
 static void RunAllTests() {
     RUN_TEST_GROUP(LfsTool);
+    RUN_TEST_GROUP(LfsCrc);
+    RUN_TEST_GROUP(LfsCache);
+    RUN_TEST_GROUP(LfsCompact);
+    RUN_TEST_GROUP(VfsLfs);
 }
 
 int main(int argc, const char **argv) {
@@ -0,0 +1,34 @@
+#include "unity_fixture.h"
+
+#include "vfs_lfs.h"
+
+TEST_GROUP(VfsLfs);
+
+TEST_SETUP(VfsLfs)
+{}
+
+TEST_TEAR_DOWN(VfsLfs)
+{}
+
+TEST(VfsLfs, ConfigDefaults)
+{
+    struct vfs_lfs_config config = {0};
+    TEST_ASSERT_TRUE(vfs_lfs_config_valid(&config));
+}
+
+TEST(VfsLfs, ConfigNameIndex)
+{
+    // lfs_init() asserts the index fits 16-bit slots
+    struct vfs_lfs_config config = {.name_index_size = 0xfffe};
+    TEST_ASSERT_TRUE(vfs_lfs_config_valid(&config));
+    config.name_index_size = 0xffff;
+    TEST_ASSERT_FALSE(vfs_lfs_config_valid(&config));
+    config.name_index_size = 70000;
+    TEST_ASSERT_FALSE(vfs_lfs_config_valid(&config));
+}
+
+TEST_GROUP_RUNNER(VfsLfs)
+{
+    RUN_TEST_CASE(VfsLfs, ConfigDefaults);
+    RUN_TEST_CASE(VfsLfs, ConfigNameIndex);
+}